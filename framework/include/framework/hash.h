@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// Fast non-cryptographic 64-bit hash, used to detect changes in cached files.
+// Consumes eight bytes per step so that hashing large meshes stays cheap compared to parsing them.
+[[nodiscard]] inline uint64_t hashBytes(std::span<const std::byte> bytes, uint64_t seed = 0)
+{
+    constexpr uint64_t prime = 0x9e3779b97f4a7c15ull;
+    const auto mix = [](uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    };
+
+    uint64_t hash = seed ^ (bytes.size() * prime);
+    size_t i = 0;
+    for (; i + 8 <= bytes.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes.data() + i, sizeof(word));
+        hash = (hash ^ mix(word)) * prime;
+    }
+    if (i < bytes.size()) {
+        uint64_t tail = 0;
+        std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+        hash = (hash ^ mix(tail)) * prime;
+    }
+    return mix(hash);
+}
+
+template <typename T>
+[[nodiscard]] inline uint64_t hashBytes(std::span<const T> values, uint64_t seed = 0)
+{
+    return hashBytes(std::as_bytes(values), seed);
+}
@@ -2,17 +2,99 @@
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
+#include <glm/ext/vector_int2.hpp>
+#include <glm/ext/vector_uint4_sized.hpp>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
+#include <array>
+#include <cstdint>
 #include <filesystem>
 #include <vector>
 
 struct Image {
 public:
+    // Texels are kept in the precision of the source file: 8 bits per channel (RGBA) for regular images and
+    // 32 bit floats (RGB) for high dynamic range (.hdr) images.
+    enum class Format {
+        RGBA8,
+        RGB32F
+    };
+    // Order of the texels in memory. Tiled stores the image as 8x8 tiles (in row major order) with the
+    // texels inside a tile in Z-order, such that every 4x4 block of RGBA8 texels fills exactly one cache line.
+    // Lookups that move across rows (e.g. at grazing angles, or bilinear footprints) then touch fewer cache lines.
+    enum class Layout {
+        RowMajor,
+        Tiled
+    };
+
+    // Load the image using the layout set by setDefaultImageLayout().
+    // Besides the image itself (level 0) a box filtered mipmap chain down to 1x1 texels is built.
     explicit Image(const std::filesystem::path& filePath);
+    // Images that are only read once (e.g. to convert them) can skip building the mipmap chain.
+    Image(const std::filesystem::path& filePath, Layout layout, bool buildMipmaps = true);
+
+    // Color of the texel in column x and row y of the given mipmap level, where row 0 is the top row.
+    [[nodiscard]] glm::vec3 getTexel(int x, int y, int level = 0) const;
+    [[nodiscard]] int numLevels() const;
+    // Width and height of a mipmap level.
+    [[nodiscard]] glm::ivec2 levelResolution(int level) const;
+    // Memory used by the texels of all levels.
+    [[nodiscard]] size_t sizeInBytes() const;
 
 public:
     int width, height;
-    std::vector<glm::vec3> pixels;
+    Format format;
+    Layout layout;
+    std::filesystem::path filePath; // File that the image was loaded from.
+
+private:
+    struct Level {
+        int width, height;
+        size_t offset; // Index of the first texel of the level.
+        size_t tilesPerRow;
+    };
+
+    [[nodiscard]] size_t texelIndex(int x, int y, int level) const;
+    // Copy tightly packed row major texels into level 0 and compute the other levels from it.
+    template <typename Texel>
+    void storeTexels(const Texel* pSource, std::vector<Texel>& texels, bool buildMipmaps);
+
+private:
+    std::vector<Level> m_levels;
+    std::vector<glm::u8vec4> m_texels8;
+    std::vector<glm::vec3> m_texelsFloat;
 };
+
+// Maps 8-bit channel values to floats in [0, 1].
+inline constexpr std::array<float, 256> unormToFloat = []() {
+    std::array<float, 256> table {};
+    for (size_t i = 0; i < table.size(); i++)
+        table[i] = static_cast<float>(i) / 255.0f;
+    return table;
+}();
+
+// Layout used by images that are loaded without specifying one; RowMajor unless changed.
+void setDefaultImageLayout(Image::Layout layout);
+[[nodiscard]] Image::Layout defaultImageLayout();
+
+inline size_t Image::texelIndex(int x, int y, int level) const
+{
+    const Level& levelInfo = m_levels[static_cast<size_t>(level)];
+    if (layout == Layout::RowMajor)
+        return levelInfo.offset + static_cast<size_t>(y) * static_cast<size_t>(levelInfo.width) + static_cast<size_t>(x);
+
+    // Interleave the bits of the position inside the tile: x0 y0 x1 y1 x2 y2.
+    const auto spreadBits = [](unsigned v) { return (v & 1u) | ((v & 2u) << 1) | ((v & 4u) << 2); };
+    const size_t tile = static_cast<size_t>(y >> 3) * levelInfo.tilesPerRow + static_cast<size_t>(x >> 3);
+    return levelInfo.offset + ((tile << 6) | spreadBits(static_cast<unsigned>(x) & 7u) | (spreadBits(static_cast<unsigned>(y) & 7u) << 1));
+}
+
+inline glm::vec3 Image::getTexel(int x, int y, int level) const
+{
+    const size_t index = texelIndex(x, y, level);
+    if (format == Format::RGB32F)
+        return m_texelsFloat[index];
+    const glm::u8vec4 texel = m_texels8[index];
+    return glm::vec3(unormToFloat[texel.r], unormToFloat[texel.g], unormToFloat[texel.b]);
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "image.h"
+#include "texture_cache.h"
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
@@ -28,9 +29,10 @@ struct Material {
 	// Optional texture that replaces kd; use as follows:
 	// 
 	// if (material.kdTexture) {
-	//   material.kdTexture->getTexel(...);
+	//   material.kdTexture->image().getTexel(...);
 	// }
-	std::shared_ptr<Image> kdTexture;
+	// The image is decoded on first use and shared by all materials that use the same file (see texture_cache.h).
+	std::shared_ptr<Texture> kdTexture;
 };
 
 struct Mesh {
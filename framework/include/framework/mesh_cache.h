@@ -0,0 +1,26 @@
+#pragma once
+#include "mesh.h"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// Binary cache of meshes loaded by loadMesh(). Parsing large OBJ files dominates start-up time, so the
+// flattened sub meshes (vertices, triangles and materials) are written to a versioned binary file that
+// is memory mapped on the next run. A cache file is only used when the source OBJ file and all of its
+// material libraries still have the same size and either the same modification time or the same content hash.
+
+// Directory in which cache files are stored. Caching is disabled while the directory is empty (the default).
+void setMeshCacheDirectory(const std::filesystem::path& directory);
+[[nodiscard]] const std::filesystem::path& meshCacheDirectory();
+
+// Path of the cache file belonging to the given OBJ file.
+[[nodiscard]] std::filesystem::path meshCachePath(const std::filesystem::path& objFile, bool centerAndNormalize);
+
+// Returns the cached meshes if the cache file exists and is up to date with the OBJ file.
+[[nodiscard]] std::optional<std::vector<Mesh>> readMeshCache(const std::filesystem::path& cacheFile, const std::filesystem::path& objFile, bool centerAndNormalize);
+
+// (Re)generate the cache file for the given OBJ file. Returns false if the file could not be written.
+bool writeMeshCache(const std::filesystem::path& cacheFile, const std::filesystem::path& objFile, bool centerAndNormalize, std::span<const Mesh> meshes);
@@ -0,0 +1,11 @@
+#pragma once
+#include "mesh.h"
+#include <filesystem>
+#include <vector>
+
+// Parallel Wavefront OBJ parser used by loadMesh(). The file is memory mapped, split into chunks at line
+// boundaries and parsed by all hardware threads. Faces are triangulated and split into one sub mesh per
+// group/object and material, and identical vertices are merged within each sub mesh.
+// Material libraries (.mtl) referenced by the file are loaded from the directory of the OBJ file.
+// Prints the reason and throws std::exception if the file cannot be read or contains invalid indices.
+[[nodiscard]] std::vector<Mesh> loadObj(const std::filesystem::path& file);
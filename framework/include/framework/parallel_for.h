@@ -0,0 +1,29 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// The framework does not depend on OpenMP, so its loaders spread work over threads with these helpers.
+
+[[nodiscard]] inline size_t numHardwareThreads()
+{
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+// Calls f(i) for every i in [0, count) using all hardware threads.
+template <typename F>
+void parallelFor(size_t count, F&& f)
+{
+    std::atomic_size_t next { 0 };
+    const auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+            f(i);
+    };
+
+    std::vector<std::jthread> threads;
+    for (size_t i = 1; i < std::min(count, numHardwareThreads()); ++i)
+        threads.emplace_back(worker);
+    worker();
+}
@@ -10,4 +10,12 @@ struct Ray {
     glm::vec3 origin { 0.0f };
     glm::vec3 direction { 0.0f, 0.0f, -1.0f };
     float t { std::numeric_limits<float>::max() };
+
+    // Ray differentials (Igehy, "Tracing Ray Differentials"): the change of the origin and direction when
+    // moving one pixel to the right (x) or up (y). Used to select the texture level of detail; they stay
+    // zero for rays that do not track them (e.g. shadow rays), which are then sampled at full resolution.
+    glm::vec3 dOriginDx { 0.0f };
+    glm::vec3 dOriginDy { 0.0f };
+    glm::vec3 dDirectionDx { 0.0f };
+    glm::vec3 dDirectionDy { 0.0f };
 };
@@ -0,0 +1,62 @@
+#pragma once
+#include "image.h"
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+
+// Image file that is decoded the first time its texels are needed. Obtain textures through loadTexture() so
+// that all materials referring to the same file share a single decoded copy. The cache may unload the decoded image
+// to stay within its budget, after which the next access decodes it again.
+class Texture {
+public:
+    explicit Texture(const std::filesystem::path& filePath);
+
+    // Decodes the image on first use; safe to call from multiple threads at once. The image stays valid until the
+    // next call to loadTexture(), setTextureCacheBudget() or trimTextureCache(), which may unload it, so textures
+    // must not be loaded while rendering.
+    [[nodiscard]] const Image& image() const;
+    [[nodiscard]] bool isLoaded() const;
+    [[nodiscard]] const std::filesystem::path& filePath() const;
+    // Memory used by the decoded image, 0 if it has not been decoded yet.
+    [[nodiscard]] size_t sizeInBytes() const;
+    // When the texture was last requested through loadTexture() or accessed through image(), in ticks of a clock
+    // that advances with every request.
+    [[nodiscard]] uint64_t lastUse() const;
+    // Free the decoded image until the next image() call, which decodes it again. Used by the cache to stay within
+    // its budget; invalidates the image returned by earlier image() calls.
+    void unload();
+
+private:
+    friend std::shared_ptr<Texture> loadTexture(const std::filesystem::path& filePath);
+
+    std::filesystem::path m_filePath;
+    mutable std::mutex m_loadMutex;
+    mutable std::unique_ptr<Image> m_pImage;
+    mutable std::atomic_bool m_isLoaded { false };
+    mutable std::atomic<uint64_t> m_lastUse { 0 };
+};
+
+struct TextureCacheStatistics {
+    size_t numTextures = 0; // Textures in the cache.
+    size_t numLoaded = 0; // Textures that have been decoded.
+    size_t memoryUsage = 0; // Bytes used by the decoded textures.
+    size_t hits = 0; // Requests that were served by an existing texture.
+    size_t misses = 0; // Requests that created a new texture.
+    size_t evictions = 0; // Textures dropped or unloaded to stay within the memory budget.
+};
+
+// Returns the texture of the given file, shared with all earlier requests for the same (canonical) path.
+// Prints an error and throws std::exception if the file does not exist.
+[[nodiscard]] std::shared_ptr<Texture> loadTexture(const std::filesystem::path& filePath);
+
+// The decoded images of all textures, whether materials still use them or not, are kept within the budget. Once
+// they exceed it, the least recently used textures (by request or image() access) are dropped if no material uses
+// them any more, and otherwise unloaded until their next access. Images decoded after the last trim (e.g. while
+// rendering) are only counted by the next one, so the memory usage can exceed the budget in between.
+void setTextureCacheBudget(size_t bytes);
+// Drop or unload textures until the cache fits in its budget. Also happens on every loadTexture() call.
+void trimTextureCache();
+
+[[nodiscard]] TextureCacheStatistics textureCacheStatistics();
@@ -16,6 +16,9 @@ public:
 	// NOTE(Mathijs): field of view in radians! (use glm::radians(...) to convert from degrees to radians).
 	Trackball(Window* pWindow, float fovy, float distanceFromLookAt = 4.0f, float rotationX = 0.0f, float rotationY = 0.0f);
 	Trackball(Window* pWindow, float fovy, const glm::vec3& lookAt, float distanceFromLookAt = 4.0f, float rotationX = 0.0f, float rotationY = 0.0f);
+	// Camera without a window (e.g. for rendering to a file without a display), so it cannot be moved with the mouse.
+	// The aspect ratio is the width divided by the height of the image.
+	Trackball(float aspectRatio, float fovy, float distanceFromLookAt = 4.0f, float rotationX = 0.0f, float rotationY = 0.0f);
 	~Trackball() = default;
 
 	static void printHelp();
@@ -37,6 +40,9 @@ public:
 
 	// Generate ray given pixel in NDC space (ranging from -1 to +1. (-1,-1) at bottom left, (+1, +1) at top right).
 	[[nodiscard]] Ray generateRay(const glm::vec2& pixel) const;
+	// Same as above, but also computes the ray differentials for a pixel of the given size (in normalized
+	// screen coordinates, i.e. 2 / resolution for one screen pixel).
+	[[nodiscard]] Ray generateRay(const glm::vec2& pixel, const glm::vec2& pixelSize) const;
 
 private:
 
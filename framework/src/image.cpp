@@ -1,16 +1,42 @@
 #include "image.h"
+#include "parallel_for.h"
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #define STB_IMAGE_IMPLEMENTATION
+#include <glm/common.hpp>
+#include <glm/vec4.hpp>
 #include <stb/stb_image.h>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <exception>
 #include <iostream>
 #include <string>
+#include <type_traits>
+
+static Image::Layout s_defaultLayout = Image::Layout::RowMajor;
+
+void setDefaultImageLayout(Image::Layout layout)
+{
+	s_defaultLayout = layout;
+}
+
+Image::Layout defaultImageLayout()
+{
+	return s_defaultLayout;
+}
 
 Image::Image(const std::filesystem::path& filePath)
+	: Image(filePath, defaultImageLayout())
+{
+}
+
+Image::Image(const std::filesystem::path& filePath, Layout layout, bool buildMipmaps)
+	: layout(layout)
+	, filePath(filePath)
 {
 	if (!std::filesystem::exists(filePath)) {
 		std::cerr << "Texture file " << filePath << " does not exists!" << std::endl;
@@ -19,17 +45,125 @@ Image::Image(const std::filesystem::path& filePath)
 
 	const auto filePathStr = filePath.string(); // Create l-value so c_str() is safe.
 	[[maybe_unused]] int numChannelsInSourceImage;
-	stbi_uc* stbPixels = stbi_load(filePathStr.c_str(), &width, &height, &numChannelsInSourceImage, STBI_rgb);
+	format = stbi_is_hdr(filePathStr.c_str()) ? Format::RGB32F : Format::RGBA8;
+	void* stbPixels;
+	if (format == Format::RGB32F)
+		stbPixels = stbi_loadf(filePathStr.c_str(), &width, &height, &numChannelsInSourceImage, STBI_rgb);
+	else
+		stbPixels = stbi_load(filePathStr.c_str(), &width, &height, &numChannelsInSourceImage, STBI_rgb_alpha);
 
 	if (!stbPixels) {
 		std::cerr << "Failed to read texture " << filePath << " using stb_image.h" << std::endl;
 		throw std::exception();
 	}
 
-	constexpr size_t numChannels = 3; // STBI_rgb == 3 channels
-	for (size_t i = 0; i < width * height * numChannels; i += numChannels) {
-            pixels.emplace_back(stbPixels[i + 0] / 255.0f, stbPixels[i + 1] / 255.0f, stbPixels[i + 2] / 255.0f);
-	}
+	if (format == Format::RGB32F)
+		storeTexels(static_cast<const glm::vec3*>(stbPixels), m_texelsFloat, buildMipmaps);
+	else
+		storeTexels(static_cast<const glm::u8vec4*>(stbPixels), m_texels8, buildMipmaps);
 
 	stbi_image_free(stbPixels);
 }
+
+static glm::vec4 toVec4(const glm::u8vec4& texel)
+{
+	return glm::vec4(texel);
+}
+
+static glm::vec4 toVec4(const glm::vec3& texel)
+{
+	return glm::vec4(texel, 0.0f);
+}
+
+template <typename Texel>
+static Texel fromVec4(const glm::vec4& value)
+{
+	if constexpr (std::is_same_v<Texel, glm::u8vec4>)
+		return glm::u8vec4(glm::round(glm::clamp(value, 0.0f, 255.0f)));
+	else
+		return glm::vec3(value);
+}
+
+// Source texels covered by texel i when reducing sourceSize texels to size texels, and the fraction of the
+// source texel that is covered. Most texels cover two source texels; at odd sizes they partially cover a third.
+struct FilterTap {
+	int index;
+	float weight;
+};
+static std::vector<FilterTap> boxFilterTaps(int i, int sourceSize, int size)
+{
+	const float scale = static_cast<float>(sourceSize) / static_cast<float>(size);
+	const float begin = static_cast<float>(i) * scale, end = static_cast<float>(i + 1) * scale;
+	std::vector<FilterTap> taps;
+	for (int source = static_cast<int>(begin); source < std::min(static_cast<int>(std::ceil(end)), sourceSize); source++) {
+		const float coverage = std::min(end, static_cast<float>(source + 1)) - std::max(begin, static_cast<float>(source));
+		taps.push_back({ source, coverage / scale });
+	}
+	return taps;
+}
+
+template <typename Texel>
+void Image::storeTexels(const Texel* pSource, std::vector<Texel>& texels, bool buildMipmaps)
+{
+	// Each level halves the resolution (rounding down) until it reaches 1x1. Tiled levels are padded to a
+	// whole number of tiles.
+	size_t numTexels = 0;
+	for (glm::ivec2 resolution { width, height };; resolution = glm::max(resolution / 2, 1)) {
+		Level& level = m_levels.emplace_back(Level { resolution.x, resolution.y, numTexels, (static_cast<size_t>(resolution.x) + 7) / 8 });
+		if (layout == Layout::RowMajor)
+			numTexels += static_cast<size_t>(level.width) * static_cast<size_t>(level.height);
+		else
+			numTexels += level.tilesPerRow * ((static_cast<size_t>(level.height) + 7) / 8) * 64;
+		if (!buildMipmaps || resolution == glm::ivec2(1))
+			break;
+	}
+	texels.resize(numTexels);
+
+	if (layout == Layout::RowMajor) {
+		// stb_image returns the texels tightly packed in the same layout as we store them.
+		std::memcpy(texels.data(), pSource, static_cast<size_t>(width) * static_cast<size_t>(height) * sizeof(Texel));
+	} else {
+		parallelFor(static_cast<size_t>(height), [&](size_t y) {
+			for (int x = 0; x < width; x++)
+				texels[texelIndex(x, static_cast<int>(y), 0)] = pSource[y * static_cast<size_t>(width) + static_cast<size_t>(x)];
+		});
+	}
+
+	// Every level depends on the previous one, so only the rows of a level are computed in parallel.
+	for (int level = 1; level < numLevels(); level++) {
+		const Level& source = m_levels[static_cast<size_t>(level - 1)];
+		const Level& destination = m_levels[static_cast<size_t>(level)];
+		std::vector<std::vector<FilterTap>> columnTaps(static_cast<size_t>(destination.width));
+		for (int x = 0; x < destination.width; x++)
+			columnTaps[static_cast<size_t>(x)] = boxFilterTaps(x, source.width, destination.width);
+
+		parallelFor(static_cast<size_t>(destination.height), [&](size_t row) {
+			const int y = static_cast<int>(row);
+			const auto rowTaps = boxFilterTaps(y, source.height, destination.height);
+			for (int x = 0; x < destination.width; x++) {
+				glm::vec4 sum { 0.0f };
+				for (const FilterTap& rowTap : rowTaps) {
+					for (const FilterTap& columnTap : columnTaps[static_cast<size_t>(x)])
+						sum += rowTap.weight * columnTap.weight * toVec4(texels[texelIndex(columnTap.index, rowTap.index, level - 1)]);
+				}
+				texels[texelIndex(x, y, level)] = fromVec4<Texel>(sum);
+			}
+		});
+	}
+}
+
+int Image::numLevels() const
+{
+	return static_cast<int>(m_levels.size());
+}
+
+glm::ivec2 Image::levelResolution(int level) const
+{
+	const Level& levelInfo = m_levels[static_cast<size_t>(level)];
+	return { levelInfo.width, levelInfo.height };
+}
+
+size_t Image::sizeInBytes() const
+{
+	return m_texels8.size() * sizeof(glm::u8vec4) + m_texelsFloat.size() * sizeof(glm::vec3);
+}
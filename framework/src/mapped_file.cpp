@@ -0,0 +1,107 @@
+#include "mapped_file.h"
+#include <utility>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::filesystem::path& filePath)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        return;
+    }
+    const void* pData = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (pData == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return;
+    }
+    m_fileHandle = file;
+    m_mappingHandle = mapping;
+    m_pData = static_cast<const std::byte*>(pData);
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    const int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat fileStat;
+    if (::fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        ::close(fd);
+        return;
+    }
+    void* pData = ::mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file.
+    ::close(fd);
+    if (pData == MAP_FAILED)
+        return;
+    m_pData = static_cast<const std::byte*>(pData);
+    m_size = static_cast<size_t>(fileStat.st_size);
+#endif
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other) {
+        close();
+        std::swap(m_pData, other.m_pData);
+        std::swap(m_size, other.m_size);
+#ifdef _WIN32
+        std::swap(m_fileHandle, other.m_fileHandle);
+        std::swap(m_mappingHandle, other.m_mappingHandle);
+#endif
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::isOpen() const
+{
+    return m_pData != nullptr;
+}
+
+std::span<const std::byte> MappedFile::bytes() const
+{
+    return { m_pData, m_size };
+}
+
+void MappedFile::close()
+{
+    if (!m_pData)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(m_pData);
+    CloseHandle(m_mappingHandle);
+    CloseHandle(m_fileHandle);
+    m_fileHandle = m_mappingHandle = nullptr;
+#else
+    ::munmap(const_cast<std::byte*>(m_pData), m_size);
+#endif
+    m_pData = nullptr;
+    m_size = 0;
+}
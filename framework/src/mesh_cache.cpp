@@ -0,0 +1,345 @@
+#include "mesh_cache.h"
+#include "hash.h"
+#include "mapped_file.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable_v<Vertex> && sizeof(Vertex) == 32);
+static_assert(std::is_trivially_copyable_v<glm::uvec3> && sizeof(glm::uvec3) == 12);
+
+// Bump whenever the layout of the cache file changes.
+static constexpr uint32_t cacheVersion = 1;
+static constexpr char cacheMagic[8] = { 'C', 'G', 'M', 'E', 'S', 'H', '\0', '\0' };
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t centerAndNormalize;
+    uint64_t contentHash; // Hash over the contents of all dependencies.
+    uint64_t dependencyCount;
+    uint64_t dependencyOffset;
+    uint64_t meshCount;
+    uint64_t meshOffset;
+};
+
+// A file that the cached meshes were generated from (the OBJ file and its material libraries).
+struct CacheDependency {
+    uint64_t size;
+    int64_t modificationTime;
+    uint64_t pathOffset;
+    uint64_t pathLength;
+};
+
+struct CacheMesh {
+    uint64_t vertexOffset;
+    uint64_t vertexCount;
+    uint64_t triangleOffset;
+    uint64_t triangleCount;
+    float kd[3];
+    float ks[3];
+    float shininess;
+    float transparency;
+    uint64_t texturePathOffset;
+    uint64_t texturePathLength; // Zero if the material has no texture.
+};
+
+static std::filesystem::path s_cacheDirectory;
+
+void setMeshCacheDirectory(const std::filesystem::path& directory)
+{
+    s_cacheDirectory = directory;
+}
+
+const std::filesystem::path& meshCacheDirectory()
+{
+    return s_cacheDirectory;
+}
+
+std::filesystem::path meshCachePath(const std::filesystem::path& objFile, bool centerAndNormalize)
+{
+    std::error_code error;
+    auto canonicalPath = std::filesystem::weakly_canonical(objFile, error);
+    if (error)
+        canonicalPath = std::filesystem::absolute(objFile);
+    const auto pathString = canonicalPath.generic_string();
+    const auto pathHash = hashBytes(std::span<const char>(pathString), centerAndNormalize ? 1 : 0);
+    return s_cacheDirectory / fmt::format("{}_{:016x}.meshcache", objFile.stem().string(), pathHash);
+}
+
+static int64_t modificationTime(const std::filesystem::path& file)
+{
+    std::error_code error;
+    const auto time = std::filesystem::last_write_time(file, error);
+    return error ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+}
+
+// Material libraries referenced by "mtllib" statements, resolved relative to the OBJ file.
+static std::vector<std::filesystem::path> findMaterialLibraries(const std::filesystem::path& objFile, std::span<const std::byte> objBytes)
+{
+    std::vector<std::filesystem::path> out;
+    const std::string_view text { reinterpret_cast<const char*>(objBytes.data()), objBytes.size() };
+    for (size_t lineStart = 0; lineStart < text.size();) {
+        const size_t lineEnd = std::min(text.find('\n', lineStart), text.size());
+        auto line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        if (!line.starts_with("mtllib"))
+            continue;
+        line.remove_prefix(6);
+        while (!line.empty()) {
+            const size_t begin = line.find_first_not_of(" \t\r");
+            if (begin == std::string_view::npos)
+                break;
+            line.remove_prefix(begin);
+            const size_t end = std::min(line.find_first_of(" \t\r"), line.size());
+            out.push_back(objFile.parent_path() / std::string(line.substr(0, end)));
+            line.remove_prefix(end);
+        }
+    }
+    return out;
+}
+
+// Hash the contents of all dependencies. Returns false if any of them cannot be read.
+static bool hashDependencies(std::span<const std::filesystem::path> dependencies, uint64_t& outHash)
+{
+    outHash = cacheVersion;
+    for (const auto& dependency : dependencies) {
+        std::error_code error;
+        if (std::filesystem::file_size(dependency, error) == 0 && !error)
+            continue;
+        MappedFile file { dependency };
+        if (!file.isOpen())
+            return false;
+        outHash = hashBytes(file.bytes(), outHash);
+    }
+    return true;
+}
+
+// Write a file through a uniquely named temporary file, so that concurrent readers (or other processes
+// regenerating the same cache) never observe a partially written cache file.
+template <typename F>
+static bool writeFileAtomically(const std::filesystem::path& filePath, F&& writeContents)
+{
+    std::error_code error;
+    std::filesystem::create_directories(filePath.parent_path(), error);
+    auto tmpFile = filePath;
+    tmpFile += fmt::format(".{:08x}.tmp", std::random_device {}());
+    {
+        std::ofstream stream { tmpFile, std::ios::binary | std::ios::trunc };
+        if (!stream)
+            return false;
+        writeContents(stream);
+        if (!stream)
+            return false;
+    }
+    std::filesystem::rename(tmpFile, filePath, error);
+    if (error) {
+        std::filesystem::remove(tmpFile, error);
+        return false;
+    }
+    return true;
+}
+
+template <typename T>
+static const T* readAt(std::span<const std::byte> bytes, uint64_t offset, uint64_t count = 1)
+{
+    if (offset > bytes.size() || count > (bytes.size() - offset) / sizeof(T))
+        return nullptr;
+    return reinterpret_cast<const T*>(bytes.data() + offset);
+}
+
+static std::optional<std::string_view> readString(std::span<const std::byte> bytes, uint64_t offset, uint64_t length)
+{
+    const char* pChars = readAt<char>(bytes, offset, length);
+    if (!pChars)
+        return {};
+    return std::string_view { pChars, length };
+}
+
+// readMeshCache() while the cache file is mapped. If the cache is valid but the modification times of its
+// dependencies changed, outRefreshedFile receives a copy of the cache file with the new modification times.
+static std::optional<std::vector<Mesh>> readMappedMeshCache(
+    const std::filesystem::path& cacheFile, const std::filesystem::path& objFile, bool centerAndNormalize, std::vector<std::byte>& outRefreshedFile)
+{
+    const MappedFile file { cacheFile };
+    if (!file.isOpen())
+        return {};
+    const auto bytes = file.bytes();
+
+    const auto* pHeader = readAt<CacheHeader>(bytes, 0);
+    if (!pHeader || std::memcmp(pHeader->magic, cacheMagic, sizeof(cacheMagic)) != 0 || pHeader->version != cacheVersion)
+        return {};
+    if (pHeader->centerAndNormalize != uint32_t(centerAndNormalize))
+        return {};
+
+    // Validate the dependencies: sizes must match, and if any modification time changed then the content hash must still match.
+    const auto* pDependencies = readAt<CacheDependency>(bytes, pHeader->dependencyOffset, pHeader->dependencyCount);
+    if (!pDependencies || pHeader->dependencyCount == 0)
+        return {};
+    std::vector<std::filesystem::path> dependencyPaths;
+    std::vector<int64_t> modificationTimes;
+    bool modified = false;
+    for (uint64_t i = 0; i < pHeader->dependencyCount; ++i) {
+        const auto& dependency = pDependencies[i];
+        const auto path = readString(bytes, dependency.pathOffset, dependency.pathLength);
+        if (!path)
+            return {};
+        dependencyPaths.emplace_back(*path);
+        std::error_code error;
+        if (std::filesystem::file_size(dependencyPaths.back(), error) != dependency.size || error)
+            return {};
+        modificationTimes.push_back(modificationTime(dependencyPaths.back()));
+        modified |= modificationTimes.back() != dependency.modificationTime;
+    }
+    if (dependencyPaths.front() != std::filesystem::weakly_canonical(objFile))
+        return {};
+    if (uint64_t contentHash; modified && (!hashDependencies(dependencyPaths, contentHash) || contentHash != pHeader->contentHash))
+        return {};
+
+    const auto* pMeshes = readAt<CacheMesh>(bytes, pHeader->meshOffset, pHeader->meshCount);
+    if (!pMeshes)
+        return {};
+    std::vector<Mesh> out(pHeader->meshCount);
+    for (uint64_t i = 0; i < pHeader->meshCount; ++i) {
+        const auto& cachedMesh = pMeshes[i];
+        const auto* pVertices = readAt<Vertex>(bytes, cachedMesh.vertexOffset, cachedMesh.vertexCount);
+        const auto* pTriangles = readAt<glm::uvec3>(bytes, cachedMesh.triangleOffset, cachedMesh.triangleCount);
+        const auto texturePath = readString(bytes, cachedMesh.texturePathOffset, cachedMesh.texturePathLength);
+        if (!pVertices || !pTriangles || !texturePath)
+            return {};
+
+        // Mesh owns its storage, so the mapped arrays are copied out in bulk instead of being parsed.
+        Mesh& mesh = out[i];
+        mesh.vertices.resize(cachedMesh.vertexCount);
+        std::memcpy(mesh.vertices.data(), pVertices, cachedMesh.vertexCount * sizeof(Vertex));
+        mesh.triangles.resize(cachedMesh.triangleCount);
+        std::memcpy(mesh.triangles.data(), pTriangles, cachedMesh.triangleCount * sizeof(glm::uvec3));
+
+        mesh.material.kd = glm::vec3(cachedMesh.kd[0], cachedMesh.kd[1], cachedMesh.kd[2]);
+        mesh.material.ks = glm::vec3(cachedMesh.ks[0], cachedMesh.ks[1], cachedMesh.ks[2]);
+        mesh.material.shininess = cachedMesh.shininess;
+        mesh.material.transparency = cachedMesh.transparency;
+        if (!texturePath->empty())
+            mesh.material.kdTexture = loadTexture(std::filesystem::path(*texturePath));
+    }
+
+    // The contents did not change (e.g. the files were touched or checked out again). Record the new modification
+    // times so that later runs can skip hashing the dependencies again.
+    if (modified) {
+        outRefreshedFile.assign(std::begin(bytes), std::end(bytes));
+        for (uint64_t i = 0; i < pHeader->dependencyCount; ++i) {
+            const uint64_t offset = pHeader->dependencyOffset + i * sizeof(CacheDependency) + offsetof(CacheDependency, modificationTime);
+            std::memcpy(outRefreshedFile.data() + offset, &modificationTimes[i], sizeof(int64_t));
+        }
+    }
+    return out;
+}
+
+std::optional<std::vector<Mesh>> readMeshCache(const std::filesystem::path& cacheFile, const std::filesystem::path& objFile, bool centerAndNormalize)
+{
+    if (!std::filesystem::exists(cacheFile))
+        return {};
+    std::vector<std::byte> refreshedFile;
+    auto out = readMappedMeshCache(cacheFile, objFile, centerAndNormalize, refreshedFile);
+    // The cache file is no longer mapped, so it can be replaced. Failing to do so only costs hashing again next time.
+    if (out && !refreshedFile.empty()) {
+        (void)writeFileAtomically(cacheFile, [&](std::ofstream& stream) {
+            stream.write(reinterpret_cast<const char*>(refreshedFile.data()), std::streamsize(refreshedFile.size()));
+        });
+    }
+    return out;
+}
+
+bool writeMeshCache(const std::filesystem::path& cacheFile, const std::filesystem::path& objFile, bool centerAndNormalize, std::span<const Mesh> meshes)
+{
+    std::vector<std::filesystem::path> dependencyPaths { std::filesystem::weakly_canonical(objFile) };
+    {
+        const MappedFile objBytes { objFile };
+        for (const auto& materialLibrary : findMaterialLibraries(objFile, objBytes.bytes())) {
+            if (std::filesystem::exists(materialLibrary))
+                dependencyPaths.push_back(std::filesystem::weakly_canonical(materialLibrary));
+        }
+    }
+
+    CacheHeader header {};
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.centerAndNormalize = centerAndNormalize;
+    if (!hashDependencies(dependencyPaths, header.contentHash))
+        return false;
+
+    // Layout: header, dependency table, mesh table, string data, vertex and triangle data (16 byte aligned).
+    const auto align = [](uint64_t offset) { return (offset + 15) & ~uint64_t(15); };
+    std::vector<CacheDependency> dependencies(dependencyPaths.size());
+    std::vector<CacheMesh> cacheMeshes(meshes.size());
+    std::string strings;
+    header.dependencyCount = dependencies.size();
+    header.dependencyOffset = sizeof(CacheHeader);
+    header.meshCount = cacheMeshes.size();
+    header.meshOffset = header.dependencyOffset + dependencies.size() * sizeof(CacheDependency);
+    const uint64_t stringOffset = header.meshOffset + cacheMeshes.size() * sizeof(CacheMesh);
+
+    const auto addString = [&](const std::string& str) {
+        const uint64_t offset = stringOffset + strings.size();
+        strings += str;
+        return offset;
+    };
+    for (size_t i = 0; i < dependencyPaths.size(); ++i) {
+        const auto pathString = dependencyPaths[i].string();
+        dependencies[i].size = std::filesystem::file_size(dependencyPaths[i]);
+        dependencies[i].modificationTime = modificationTime(dependencyPaths[i]);
+        dependencies[i].pathOffset = addString(pathString);
+        dependencies[i].pathLength = pathString.size();
+    }
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        const auto& material = meshes[i].material;
+        auto& cacheMesh = cacheMeshes[i];
+        std::memcpy(cacheMesh.kd, &material.kd, sizeof(cacheMesh.kd));
+        std::memcpy(cacheMesh.ks, &material.ks, sizeof(cacheMesh.ks));
+        cacheMesh.shininess = material.shininess;
+        cacheMesh.transparency = material.transparency;
+        const auto texturePath = material.kdTexture ? material.kdTexture->filePath().string() : std::string();
+        cacheMesh.texturePathOffset = addString(texturePath);
+        cacheMesh.texturePathLength = texturePath.size();
+    }
+
+    uint64_t dataOffset = align(stringOffset + strings.size());
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        cacheMeshes[i].vertexOffset = dataOffset;
+        cacheMeshes[i].vertexCount = meshes[i].vertices.size();
+        dataOffset = align(dataOffset + meshes[i].vertices.size() * sizeof(Vertex));
+        cacheMeshes[i].triangleOffset = dataOffset;
+        cacheMeshes[i].triangleCount = meshes[i].triangles.size();
+        dataOffset = align(dataOffset + meshes[i].triangles.size() * sizeof(glm::uvec3));
+    }
+
+    return writeFileAtomically(cacheFile, [&](std::ofstream& stream) {
+        const auto write = [&](const void* pData, size_t size) { stream.write(static_cast<const char*>(pData), std::streamsize(size)); };
+        const auto pad = [&]() {
+            const char zeros[16] {};
+            const auto position = uint64_t(stream.tellp());
+            write(zeros, align(position) - position);
+        };
+        write(&header, sizeof(header));
+        write(dependencies.data(), dependencies.size() * sizeof(CacheDependency));
+        write(cacheMeshes.data(), cacheMeshes.size() * sizeof(CacheMesh));
+        write(strings.data(), strings.size());
+        for (const auto& mesh : meshes) {
+            pad();
+            write(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+            pad();
+            write(mesh.triangles.data(), mesh.triangles.size() * sizeof(glm::uvec3));
+        }
+        pad();
+    });
+}
@@ -0,0 +1,523 @@
+#include "obj_loader.h"
+#include "mapped_file.h"
+#include "parallel_for.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <tinyobjloader/tiny_obj_loader.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Chunks of the file smaller than this are not worth handing to another thread.
+static constexpr size_t minChunkSize = 1 << 16;
+// Ranges (of triangles or vertices) smaller than this are processed by a single thread.
+static constexpr size_t minBlockSize = 1 << 14;
+
+// Zero based indices of the attributes of a face corner; texCoord and normal are -1 if absent.
+struct ObjIndex {
+    int32_t position;
+    int32_t texCoord;
+    int32_t normal;
+};
+using ObjTriangle = std::array<ObjIndex, 3>;
+
+enum class ObjEventType {
+    NewShape,
+    UseMaterial,
+    MaterialLibrary
+};
+
+// Statement that changes how the triangles following it are grouped into sub meshes.
+struct ObjEvent {
+    ObjEventType type;
+    size_t triangle; // Index of the first triangle after the statement.
+    std::string argument;
+};
+
+struct ObjChunk {
+    std::string_view text;
+    // Number of attributes inside this chunk, and in all chunks before it.
+    size_t numPositions = 0, numTexCoords = 0, numNormals = 0;
+    size_t firstPosition = 0, firstTexCoord = 0, firstNormal = 0, firstTriangle = 0;
+
+    std::vector<ObjTriangle> triangles;
+    // For each quad, the index of the first of the two triangles it was split into.
+    std::vector<size_t> quads;
+    std::vector<ObjEvent> events;
+    std::string error;
+};
+
+struct ObjAttributes {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texCoords;
+    std::vector<glm::vec3> normals;
+};
+
+// Range of triangles that becomes a single Mesh.
+struct ObjSubMesh {
+    size_t begin, end;
+    int materialID;
+};
+
+// Number of blocks to split a range of count elements into; a single block when not running in parallel.
+static size_t numBlocks(size_t count, bool parallel)
+{
+    return parallel ? std::clamp<size_t>(count / minBlockSize, 1, 4 * numHardwareThreads()) : 1;
+}
+
+static size_t blockBegin(size_t count, size_t numBlocks, size_t block)
+{
+    return count * block / numBlocks;
+}
+
+// Calls f(begin, end) for consecutive blocks covering [0, count).
+template <typename F>
+static void forEachBlock(size_t count, bool parallel, F&& f)
+{
+    const size_t blocks = numBlocks(count, parallel);
+    parallelFor(blocks, [&](size_t block) { f(blockBegin(count, blocks, block), blockBegin(count, blocks, block + 1)); });
+}
+
+// Sorts the blocks in parallel and merges them pairwise.
+template <typename Compare>
+static void parallelSort(std::vector<uint32_t>& values, Compare compare)
+{
+    size_t blocks = 1;
+    while (2 * blocks <= numHardwareThreads() && values.size() / (2 * blocks) >= minBlockSize)
+        blocks *= 2;
+    const auto blockIter = [&](size_t block) { return std::begin(values) + blockBegin(values.size(), blocks, block); };
+
+    parallelFor(blocks, [&](size_t block) { std::sort(blockIter(block), blockIter(block + 1), compare); });
+    for (size_t width = 1; width < blocks; width *= 2) {
+        parallelFor(blocks / (2 * width), [&](size_t pair) {
+            const size_t block = 2 * width * pair;
+            std::inplace_merge(blockIter(block), blockIter(block + width), blockIter(block + 2 * width), compare);
+        });
+    }
+}
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Removes the first line from text and returns it (without the line break).
+static std::string_view nextLine(std::string_view& text)
+{
+    const size_t end = text.find('\n');
+    const std::string_view line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    return line;
+}
+
+// Removes the first whitespace separated token from line and returns it.
+static std::string_view nextToken(std::string_view& line)
+{
+    size_t begin = 0;
+    while (begin < line.size() && isSpace(line[begin]))
+        ++begin;
+    size_t end = begin;
+    while (end < line.size() && !isSpace(line[end]))
+        ++end;
+    const std::string_view token = line.substr(begin, end - begin);
+    line.remove_prefix(end);
+    return token;
+}
+
+// Missing or malformed values are read as zero.
+static float parseFloat(std::string_view token)
+{
+    if (!token.empty() && token.front() == '+')
+        token.remove_prefix(1);
+    float value = 0.0f;
+    std::from_chars(token.data(), token.data() + token.size(), value);
+    return value;
+}
+
+// Converts a one based (or negative, relative to the numDefined attributes before it) index to a zero based index.
+static bool parseIndex(std::string_view token, size_t numDefined, int32_t& index)
+{
+    if (token.empty()) {
+        index = -1;
+        return true;
+    }
+    int64_t value = 0;
+    const auto [pEnd, errorCode] = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (errorCode != std::errc() || pEnd != token.data() + token.size() || value == 0)
+        return false;
+    // Indices that do not fit are corrupt; narrowing them would wrap around to a valid looking index.
+    const int64_t zeroBased = value > 0 ? value - 1 : static_cast<int64_t>(numDefined) + value;
+    if (zeroBased < 0 || zeroBased > std::numeric_limits<int32_t>::max())
+        return false;
+    index = static_cast<int32_t>(zeroBased);
+    return true;
+}
+
+// Parses a face corner of the form v, v/vt, v//vn or v/vt/vn.
+static bool parseCorner(std::string_view token, size_t numPositions, size_t numTexCoords, size_t numNormals, ObjIndex& corner)
+{
+    const size_t firstSlash = token.find('/');
+    const size_t secondSlash = firstSlash == std::string_view::npos ? firstSlash : token.find('/', firstSlash + 1);
+    const auto part = [&](size_t begin, size_t end) {
+        return begin == std::string_view::npos ? std::string_view {} : token.substr(begin, end == std::string_view::npos ? end : end - begin);
+    };
+    const auto afterSlash = [](size_t slash) { return slash == std::string_view::npos ? slash : slash + 1; };
+
+    const auto positionToken = part(0, firstSlash);
+    return !positionToken.empty()
+        && parseIndex(positionToken, numPositions, corner.position)
+        && parseIndex(part(afterSlash(firstSlash), secondSlash), numTexCoords, corner.texCoord)
+        && parseIndex(part(afterSlash(secondSlash), std::string_view::npos), numNormals, corner.normal);
+}
+
+static void countAttributes(ObjChunk& chunk)
+{
+    for (std::string_view text = chunk.text; !text.empty();) {
+        std::string_view line = nextLine(text);
+        const std::string_view keyword = nextToken(line);
+        if (keyword == "v")
+            ++chunk.numPositions;
+        else if (keyword == "vt")
+            ++chunk.numTexCoords;
+        else if (keyword == "vn")
+            ++chunk.numNormals;
+    }
+}
+
+// Writes the attributes of the chunk to their final position and collects its triangles and events.
+static void parseChunk(ObjChunk& chunk, ObjAttributes& attributes)
+{
+    size_t numPositions = chunk.firstPosition, numTexCoords = chunk.firstTexCoord, numNormals = chunk.firstNormal;
+    std::vector<ObjIndex> polygon;
+    for (std::string_view text = chunk.text; !text.empty();) {
+        std::string_view line = nextLine(text);
+        const std::string_view keyword = nextToken(line);
+        if (keyword == "v") {
+            const float x = parseFloat(nextToken(line));
+            const float y = parseFloat(nextToken(line));
+            const float z = parseFloat(nextToken(line));
+            attributes.positions[numPositions++] = glm::vec3(x, y, z);
+        } else if (keyword == "vt") {
+            const float u = parseFloat(nextToken(line));
+            const float v = parseFloat(nextToken(line));
+            attributes.texCoords[numTexCoords++] = glm::vec2(u, v);
+        } else if (keyword == "vn") {
+            const float x = parseFloat(nextToken(line));
+            const float y = parseFloat(nextToken(line));
+            const float z = parseFloat(nextToken(line));
+            attributes.normals[numNormals++] = glm::vec3(x, y, z);
+        } else if (keyword == "f") {
+            polygon.clear();
+            const std::string_view face = line;
+            for (auto token = nextToken(line); !token.empty(); token = nextToken(line)) {
+                ObjIndex corner;
+                if (!parseCorner(token, numPositions, numTexCoords, numNormals, corner)) {
+                    chunk.error = "invalid face \"f" + std::string(face) + "\"";
+                    return;
+                }
+                polygon.push_back(corner);
+            }
+            // Degenerate faces are skipped; polygons are split into a triangle fan.
+            if (polygon.size() == 4)
+                chunk.quads.push_back(chunk.triangles.size());
+            for (size_t i = 2; i < polygon.size(); ++i)
+                chunk.triangles.push_back({ polygon[0], polygon[i - 1], polygon[i] });
+        } else if (keyword == "o" || keyword == "g") {
+            chunk.events.push_back({ ObjEventType::NewShape, chunk.triangles.size(), {} });
+        } else if (keyword == "usemtl") {
+            chunk.events.push_back({ ObjEventType::UseMaterial, chunk.triangles.size(), std::string(nextToken(line)) });
+        } else if (keyword == "mtllib") {
+            chunk.events.push_back({ ObjEventType::MaterialLibrary, chunk.triangles.size(), std::string(line) });
+        }
+    }
+}
+
+// Checks that all indices refer to existing attributes, and splits quads along their shortest diagonal.
+// Indices can only be checked once every chunk has been parsed because faces may refer to later vertices.
+// Texture coordinate and normal indices are ignored if the file contains no such attributes at all.
+static void finalizeTriangles(ObjChunk& chunk, const ObjAttributes& attributes)
+{
+    const auto isValid = [](int32_t index, size_t size, bool optional) {
+        return (optional && index == -1) || (index >= 0 && static_cast<size_t>(index) < size);
+    };
+    for (ObjTriangle& triangle : chunk.triangles) {
+        for (ObjIndex& corner : triangle) {
+            if (attributes.texCoords.empty())
+                corner.texCoord = -1;
+            if (attributes.normals.empty())
+                corner.normal = -1;
+            if (!isValid(corner.position, attributes.positions.size(), false)
+                || !isValid(corner.texCoord, attributes.texCoords.size(), true)
+                || !isValid(corner.normal, attributes.normals.size(), true)) {
+                chunk.error = "face refers to a vertex attribute that does not exist";
+                return;
+            }
+        }
+    }
+
+    for (const size_t quad : chunk.quads) {
+        // The fan split the quad into (0, 1, 2) and (0, 2, 3).
+        const auto [i0, i1, i2] = chunk.triangles[quad];
+        const ObjIndex i3 = chunk.triangles[quad + 1][2];
+        const auto& positions = attributes.positions;
+        const auto e02 = positions[i2.position] - positions[i0.position];
+        const auto e13 = positions[i3.position] - positions[i1.position];
+        if (glm::dot(e02, e02) >= glm::dot(e13, e13)) {
+            chunk.triangles[quad] = { i0, i1, i3 };
+            chunk.triangles[quad + 1] = { i1, i2, i3 };
+        }
+    }
+}
+
+// Loads the first of the listed material libraries that can be opened.
+static void loadMaterialLibrary(const std::filesystem::path& baseDir, std::string_view fileNames, std::vector<tinyobj::material_t>& materials, std::map<std::string, int>& materialMap)
+{
+    for (auto fileName = nextToken(fileNames); !fileName.empty(); fileName = nextToken(fileNames)) {
+        std::ifstream stream { baseDir / fileName };
+        if (!stream)
+            continue;
+        std::string warn, error;
+        tinyobj::LoadMtl(&materialMap, &materials, &stream, &warn, &error);
+        return;
+    }
+}
+
+// Floats are compared by their bit pattern (with -0 equal to +0) to group equal vertices during sorting.
+static bool vertexLess(const Vertex& lhs, const Vertex& rhs)
+{
+    const auto key = [](const Vertex& vertex) {
+        const std::array values { vertex.position.x, vertex.position.y, vertex.position.z, vertex.normal.x, vertex.normal.y, vertex.normal.z, vertex.texCoord.s, vertex.texCoord.t };
+        std::array<uint32_t, 8> bits;
+        std::transform(std::begin(values), std::end(values), std::begin(bits), [](float value) { return value == 0.0f ? 0u : std::bit_cast<uint32_t>(value); });
+        return bits;
+    };
+    return key(lhs) < key(rhs);
+}
+
+// Creates the vertices of the triangles and merges equal vertices. Vertices are numbered in order of first
+// use, which gives the same result as deduplicating with a hash map while walking over the triangles.
+static void buildSubMesh(std::span<const ObjTriangle> objTriangles, const ObjAttributes& attributes, bool parallel, Mesh& mesh)
+{
+    const size_t numCorners = 3 * objTriangles.size();
+    std::vector<Vertex> corners(numCorners);
+    forEachBlock(objTriangles.size(), parallel, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const ObjTriangle& triangle = objTriangles[i];
+            const glm::vec3 v0 = attributes.positions[triangle[0].position];
+            const glm::vec3 v1 = attributes.positions[triangle[1].position];
+            const glm::vec3 v2 = attributes.positions[triangle[2].position];
+            const auto geometricNormal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+            for (unsigned j = 0; j < 3; j++) {
+                const ObjIndex& corner = triangle[j];
+                corners[3 * i + j] = Vertex {
+                    .position = attributes.positions[corner.position],
+                    .normal = corner.normal != -1 ? attributes.normals[corner.normal] : geometricNormal,
+                    .texCoord = corner.texCoord != -1 ? attributes.texCoords[corner.texCoord] : glm::vec2(0)
+                };
+            }
+        }
+    });
+
+    // Sort the corners such that equal vertices are adjacent, with the first use of each vertex in front.
+    std::vector<uint32_t> order(numCorners);
+    std::iota(std::begin(order), std::end(order), 0u);
+    const auto compare = [&](uint32_t lhs, uint32_t rhs) {
+        if (vertexLess(corners[lhs], corners[rhs]))
+            return true;
+        if (vertexLess(corners[rhs], corners[lhs]))
+            return false;
+        return lhs < rhs;
+    };
+    if (parallel)
+        parallelSort(order, compare);
+    else
+        std::sort(std::begin(order), std::end(order), compare);
+
+    // Map each corner to the first corner with an equal vertex.
+    std::vector<uint32_t> representative(numCorners);
+    forEachBlock(numCorners, parallel, [&](size_t begin, size_t end) {
+        if (begin == end)
+            return;
+        size_t groupStart = begin;
+        while (groupStart > 0 && corners[order[groupStart - 1]] == corners[order[groupStart]])
+            --groupStart;
+        for (size_t i = begin; i < end; ++i) {
+            if (i != begin && !(corners[order[i]] == corners[order[i - 1]]))
+                groupStart = i;
+            representative[order[i]] = order[groupStart];
+        }
+    });
+
+    // Number the unique vertices in order of first use (a parallel prefix sum over the blocks).
+    const size_t blocks = numBlocks(numCorners, parallel);
+    std::vector<size_t> blockFirstVertex(blocks + 1, 0);
+    parallelFor(blocks, [&](size_t block) {
+        for (size_t i = blockBegin(numCorners, blocks, block); i < blockBegin(numCorners, blocks, block + 1); ++i)
+            blockFirstVertex[block + 1] += (representative[i] == i);
+    });
+    std::partial_sum(std::begin(blockFirstVertex), std::end(blockFirstVertex), std::begin(blockFirstVertex));
+
+    std::vector<uint32_t> vertexIndex(numCorners);
+    mesh.vertices.resize(blockFirstVertex.back());
+    parallelFor(blocks, [&](size_t block) {
+        size_t vertex = blockFirstVertex[block];
+        for (size_t i = blockBegin(numCorners, blocks, block); i < blockBegin(numCorners, blocks, block + 1); ++i) {
+            if (representative[i] == i) {
+                vertexIndex[i] = static_cast<uint32_t>(vertex);
+                mesh.vertices[vertex++] = corners[i];
+            }
+        }
+    });
+
+    mesh.triangles.resize(objTriangles.size());
+    forEachBlock(objTriangles.size(), parallel, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            for (unsigned j = 0; j < 3; j++)
+                mesh.triangles[i][j] = vertexIndex[representative[3 * i + j]];
+        }
+    });
+}
+
+std::vector<Mesh> loadObj(const std::filesystem::path& file)
+{
+    const MappedFile mappedFile { file };
+    if (!mappedFile.isOpen()) {
+        // Mapping an empty file fails; it simply contains no meshes.
+        std::error_code errorCode;
+        if (std::filesystem::file_size(file, errorCode) == 0 && !errorCode)
+            return {};
+        std::cerr << "Failed to load mesh " << file << std::endl;
+        throw std::exception();
+    }
+    const std::string_view text { reinterpret_cast<const char*>(mappedFile.bytes().data()), mappedFile.bytes().size() };
+    const auto baseDir = file.parent_path();
+
+    // Split the file into chunks that end at a line break.
+    std::vector<ObjChunk> chunks;
+    const size_t maxChunks = std::clamp<size_t>(text.size() / minChunkSize, 1, 4 * numHardwareThreads());
+    for (size_t i = 1, begin = 0; begin < text.size(); ++i) {
+        size_t end = text.size();
+        if (i < maxChunks) {
+            end = text.find('\n', std::max(begin, text.size() * i / maxChunks));
+            end = end == std::string_view::npos ? text.size() : end + 1;
+        }
+        chunks.emplace_back().text = text.substr(begin, end - begin);
+        begin = end;
+    }
+
+    // Count the attributes in each chunk so that every chunk knows where to store its own attributes and
+    // how to resolve relative indices.
+    parallelFor(chunks.size(), [&](size_t i) { countAttributes(chunks[i]); });
+    for (size_t i = 1; i < chunks.size(); ++i) {
+        chunks[i].firstPosition = chunks[i - 1].firstPosition + chunks[i - 1].numPositions;
+        chunks[i].firstTexCoord = chunks[i - 1].firstTexCoord + chunks[i - 1].numTexCoords;
+        chunks[i].firstNormal = chunks[i - 1].firstNormal + chunks[i - 1].numNormals;
+    }
+    ObjAttributes attributes;
+    attributes.positions.resize(chunks.back().firstPosition + chunks.back().numPositions);
+    attributes.texCoords.resize(chunks.back().firstTexCoord + chunks.back().numTexCoords);
+    attributes.normals.resize(chunks.back().firstNormal + chunks.back().numNormals);
+
+    const auto checkErrors = [&]() {
+        for (const auto& chunk : chunks) {
+            if (!chunk.error.empty()) {
+                std::cerr << "Failed to load mesh " << file << ": " << chunk.error << std::endl;
+                throw std::exception();
+            }
+        }
+    };
+    parallelFor(chunks.size(), [&](size_t i) { parseChunk(chunks[i], attributes); });
+    checkErrors();
+    parallelFor(chunks.size(), [&](size_t i) { finalizeTriangles(chunks[i], attributes); });
+    checkErrors();
+
+    // Concatenate the triangles of all chunks.
+    for (size_t i = 1; i < chunks.size(); ++i)
+        chunks[i].firstTriangle = chunks[i - 1].firstTriangle + chunks[i - 1].triangles.size();
+    std::vector<ObjTriangle> triangles(chunks.back().firstTriangle + chunks.back().triangles.size());
+    parallelFor(chunks.size(), [&](size_t i) {
+        std::copy(std::begin(chunks[i].triangles), std::end(chunks[i].triangles), std::begin(triangles) + chunks[i].firstTriangle);
+        chunks[i].triangles = {};
+    });
+
+    // Start a new sub mesh for every object/group and whenever the material changes.
+    std::vector<tinyobj::material_t> materials;
+    std::map<std::string, int> materialMap;
+    std::vector<ObjSubMesh> subMeshes;
+    size_t startTriangle = 0;
+    int materialID = -1;
+    const auto endSubMesh = [&](size_t endTriangle) {
+        if (endTriangle > startTriangle)
+            subMeshes.push_back({ startTriangle, endTriangle, materialID });
+        startTriangle = endTriangle;
+    };
+    for (const auto& chunk : chunks) {
+        for (const auto& event : chunk.events) {
+            const size_t triangle = chunk.firstTriangle + event.triangle;
+            if (event.type == ObjEventType::NewShape) {
+                endSubMesh(triangle);
+            } else if (event.type == ObjEventType::UseMaterial) {
+                const auto iter = materialMap.find(event.argument);
+                const int newMaterialID = iter == std::end(materialMap) ? -1 : iter->second;
+                if (newMaterialID != materialID) {
+                    endSubMesh(triangle);
+                    materialID = newMaterialID;
+                }
+            } else {
+                loadMaterialLibrary(baseDir, event.argument, materials, materialMap);
+            }
+        }
+    }
+    endSubMesh(triangles.size());
+
+    // Large sub meshes use all threads by themselves, small sub meshes are built concurrently.
+    std::vector<Mesh> out(subMeshes.size());
+    std::vector<size_t> smallSubMeshes;
+    for (size_t i = 0; i < subMeshes.size(); ++i) {
+        const auto& subMesh = subMeshes[i];
+        const std::span subMeshTriangles { triangles.data() + subMesh.begin, subMesh.end - subMesh.begin };
+        if (subMeshTriangles.size() >= minBlockSize)
+            buildSubMesh(subMeshTriangles, attributes, true, out[i]);
+        else
+            smallSubMeshes.push_back(i);
+    }
+    parallelFor(smallSubMeshes.size(), [&](size_t i) {
+        const auto& subMesh = subMeshes[smallSubMeshes[i]];
+        buildSubMesh({ triangles.data() + subMesh.begin, subMesh.end - subMesh.begin }, attributes, false, out[smallSubMeshes[i]]);
+    });
+
+    for (size_t i = 0; i < subMeshes.size(); ++i) {
+        Mesh& mesh = out[i];
+        if (subMeshes[i].materialID == -1) {
+            mesh.material.kd = glm::vec3(1.0f);
+            mesh.material.ks = glm::vec3(0.0f);
+            mesh.material.shininess = 1.0f;
+        } else {
+            const auto& objMaterial = materials[subMeshes[i].materialID];
+            mesh.material.kd = glm::vec3(objMaterial.diffuse[0], objMaterial.diffuse[1], objMaterial.diffuse[2]);
+            if (!objMaterial.diffuse_texname.empty()) {
+                mesh.material.kdTexture = loadTexture(baseDir / objMaterial.diffuse_texname);
+            }
+            mesh.material.ks = glm::vec3(objMaterial.specular[0], objMaterial.specular[1], objMaterial.specular[2]);
+            mesh.material.shininess = objMaterial.shininess;
+            mesh.material.transparency = objMaterial.dissolve;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,153 @@
+#include "texture_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+struct TextureCache {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<Texture>> textures;
+    size_t budget = size_t(512) << 20;
+    size_t hits = 0, misses = 0, evictions = 0;
+};
+
+// Advanced by every request. Textures remember its value when they were last requested or accessed, so all
+// textures used since the same request count as equally recent. This keeps the texel lookups to two relaxed loads,
+// without a shared counter that every thread would write.
+std::atomic<uint64_t> useClock { 0 };
+}
+
+static TextureCache& textureCache()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+Texture::Texture(const std::filesystem::path& filePath)
+    : m_filePath(filePath)
+{
+}
+
+const Image& Texture::image() const
+{
+    const uint64_t now = useClock.load(std::memory_order_relaxed);
+    if (m_lastUse.load(std::memory_order_relaxed) != now)
+        m_lastUse.store(now, std::memory_order_relaxed);
+    // Once decoded, lookups only read the flag.
+    if (!m_isLoaded.load(std::memory_order_acquire)) {
+        std::lock_guard lock { m_loadMutex };
+        if (!m_pImage) {
+            m_pImage = std::make_unique<Image>(m_filePath);
+            m_isLoaded.store(true, std::memory_order_release);
+        }
+    }
+    return *m_pImage;
+}
+
+void Texture::unload()
+{
+    std::lock_guard lock { m_loadMutex };
+    m_isLoaded.store(false, std::memory_order_relaxed);
+    m_pImage.reset();
+}
+
+bool Texture::isLoaded() const
+{
+    return m_isLoaded;
+}
+
+const std::filesystem::path& Texture::filePath() const
+{
+    return m_filePath;
+}
+
+uint64_t Texture::lastUse() const
+{
+    return m_lastUse.load(std::memory_order_relaxed);
+}
+
+size_t Texture::sizeInBytes() const
+{
+    return m_isLoaded ? m_pImage->sizeInBytes() : 0;
+}
+
+// Requires the cache mutex to be held.
+static void trimLocked(TextureCache& cache)
+{
+    size_t memoryUsage = 0;
+    std::vector<std::pair<uint64_t, std::string>> candidates;
+    for (const auto& [key, pTexture] : cache.textures) {
+        memoryUsage += pTexture->sizeInBytes();
+        if (pTexture->isLoaded() || pTexture.use_count() == 1)
+            candidates.emplace_back(pTexture->lastUse(), key);
+    }
+    std::sort(std::begin(candidates), std::end(candidates));
+    for (const auto& [lastUse, key] : candidates) {
+        if (memoryUsage <= cache.budget)
+            break;
+        const auto iter = cache.textures.find(key);
+        memoryUsage -= iter->second->sizeInBytes();
+        // The materials that still use a texture keep it; only its decoded image is freed.
+        if (iter->second.use_count() == 1)
+            cache.textures.erase(iter);
+        else
+            iter->second->unload();
+        ++cache.evictions;
+    }
+}
+
+std::shared_ptr<Texture> loadTexture(const std::filesystem::path& filePath)
+{
+    std::error_code errorCode;
+    const auto canonicalPath = std::filesystem::canonical(filePath, errorCode);
+    if (errorCode) {
+        std::cerr << "Texture file " << filePath << " does not exists!" << std::endl;
+        throw std::exception();
+    }
+
+    auto& cache = textureCache();
+    std::lock_guard lock { cache.mutex };
+    auto& pCachedTexture = cache.textures[canonicalPath.string()];
+    if (pCachedTexture) {
+        ++cache.hits;
+    } else {
+        pCachedTexture = std::make_shared<Texture>(canonicalPath);
+        ++cache.misses;
+    }
+    pCachedTexture->m_lastUse.store(useClock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    auto pTexture = pCachedTexture;
+    trimLocked(cache);
+    return pTexture;
+}
+
+void setTextureCacheBudget(size_t bytes)
+{
+    auto& cache = textureCache();
+    std::lock_guard lock { cache.mutex };
+    cache.budget = bytes;
+    trimLocked(cache);
+}
+
+void trimTextureCache()
+{
+    auto& cache = textureCache();
+    std::lock_guard lock { cache.mutex };
+    trimLocked(cache);
+}
+
+TextureCacheStatistics textureCacheStatistics()
+{
+    auto& cache = textureCache();
+    std::lock_guard lock { cache.mutex };
+    TextureCacheStatistics statistics { .numTextures = cache.textures.size(), .hits = cache.hits, .misses = cache.misses, .evictions = cache.evictions };
+    for (const auto& [key, pTexture] : cache.textures) {
+        statistics.numLoaded += pTexture->isLoaded();
+        statistics.memoryUsage += pTexture->sizeInBytes();
+    }
+    return statistics;
+}
@@ -4,6 +4,7 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/gtc/quaternion.hpp>
 DISABLE_WARNINGS_POP()
 #include <algorithm>
+#include <cmath>
 #include <framework/opengl_includes.h>
 #include <framework/trackball.h>
 #include <framework/window.h>
@@ -49,6 +50,16 @@ Trackball::Trackball(Window* pWindow, float fovy, const glm::vec3& lookAt, float
     });
 }
 
+Trackball::Trackball(float aspectRatio, float fovy, float distFromLookAt, float rotationX, float rotationY)
+    : m_pWindow(nullptr)
+    , m_fovy(fovy)
+    , m_halfScreenSpaceHeight(std::tan(m_fovy / 2.0f))
+    , m_halfScreenSpaceWidth(aspectRatio * m_halfScreenSpaceHeight)
+    , m_distanceFromLookAt(distFromLookAt)
+    , m_rotationEulerAngles(rotationX, rotationY, 0)
+{
+}
+
 void Trackball::printHelp()
 {
     std::cout << "Left button: turn in XY," << std::endl;
@@ -85,7 +96,8 @@ glm::mat4 Trackball::viewMatrix() const
 
 glm::mat4 Trackball::projectionMatrix() const
 {
-    return glm::perspective(m_fovy, m_pWindow->getAspectRatio(), 0.01f, 100.0f);
+    const float aspectRatio = m_pWindow ? m_pWindow->getAspectRatio() : m_halfScreenSpaceWidth / m_halfScreenSpaceHeight;
+    return glm::perspective(m_fovy, aspectRatio, 0.01f, 100.0f);
 }
 
 glm::vec3 Trackball::rotationEulerAngles() const {
@@ -109,6 +121,23 @@ Ray Trackball::generateRay(const glm::vec2& pixel) const
     return ray;
 }
 
+Ray Trackball::generateRay(const glm::vec2& pixel, const glm::vec2& pixelSize) const
+{
+    Ray ray = generateRay(pixel);
+
+    // Derivative of normalize(d) with respect to the screen position, where d is the unnormalized camera space
+    // direction: (dot(d, d) * dd - dot(d, dd) * d) / |d|^3.
+    const glm::vec3 direction { -pixel.x * m_halfScreenSpaceWidth, pixel.y * m_halfScreenSpaceHeight, 1.0f };
+    const float squaredLength = glm::dot(direction, direction);
+    const auto derivative = [&](const glm::vec3& dDirection) {
+        const glm::vec3 cameraSpace = (squaredLength * dDirection - glm::dot(direction, dDirection) * direction) / (squaredLength * std::sqrt(squaredLength));
+        return glm::quat(m_rotationEulerAngles) * cameraSpace;
+    };
+    ray.dDirectionDx = derivative(glm::vec3(-pixelSize.x * m_halfScreenSpaceWidth, 0.0f, 0.0f));
+    ray.dDirectionDy = derivative(glm::vec3(0.0f, pixelSize.y * m_halfScreenSpaceHeight, 0.0f));
+    return ray;
+}
+
 glm::vec3 Trackball::forward() const
 {
     return glm::quat(m_rotationEulerAngles) * glm::vec3(0, 0, 1);
@@ -79,13 +79,13 @@ Window::Window(std::string_view title, const glm::ivec2& windowSize, OpenGLVersi
     glfwMakeContextCurrent(m_pWindow);
     glfwSwapInterval(1); // Enable vsync. To disable vsync set this to 0.
 
-    float xScale, yScale;
-    glfwGetWindowContentScale(m_pWindow, &xScale, &yScale);
-    std::cout << "Window content scale: " << xScale << ", " << yScale << std::endl;
-
     glfwGetWindowSize(m_pWindow, &m_windowSize.x, &m_windowSize.y);
 
     if (m_presentable) {
+        float xScale, yScale;
+        glfwGetWindowContentScale(m_pWindow, &xScale, &yScale);
+        std::cout << "Window content scale: " << xScale << ", " << yScale << std::endl;
+
         if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
             glfwTerminate();
             std::cerr << "Could not initialize GLEW" << std::endl;
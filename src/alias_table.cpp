@@ -0,0 +1,64 @@
+#include "alias_table.h"
+#include <algorithm>
+
+AliasTable::AliasTable(std::span<const float> weights)
+    : m_bins(weights.size())
+{
+    double totalWeight = 0.0;
+    for (const float weight : weights)
+        totalWeight += weight;
+    m_totalWeight = static_cast<float>(totalWeight);
+    if (weights.empty())
+        return;
+
+    // Scale the weights such that the average bin holds exactly 1.
+    const double numBins = static_cast<double>(weights.size());
+    std::vector<double> scaled(weights.size());
+    std::vector<uint32_t> small, large;
+    for (uint32_t i = 0; i < weights.size(); i++) {
+        scaled[i] = totalWeight > 0.0 ? weights[i] * numBins / totalWeight : 1.0;
+        m_bins[i] = { 1.0f, i, static_cast<float>(scaled[i] / numBins) };
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    // Fill up each under-full bin with the excess of an over-full one.
+    while (!small.empty() && !large.empty()) {
+        const uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+        m_bins[s].threshold = static_cast<float>(scaled[s]);
+        m_bins[s].alias = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Whatever is left is full up to rounding errors.
+    for (const uint32_t i : small)
+        m_bins[i].threshold = 1.0f;
+    for (const uint32_t i : large)
+        m_bins[i].threshold = 1.0f;
+}
+
+uint32_t AliasTable::sample(float random) const
+{
+    // The integer part selects the bin, the fraction decides between the bin and its alias.
+    const float scaled = random * static_cast<float>(m_bins.size());
+    const uint32_t bin = std::min(static_cast<uint32_t>(scaled), static_cast<uint32_t>(m_bins.size() - 1));
+    return scaled - static_cast<float>(bin) < m_bins[bin].threshold ? bin : m_bins[bin].alias;
+}
+
+float AliasTable::probability(uint32_t index) const
+{
+    return m_bins[index].probability;
+}
+
+float AliasTable::totalWeight() const
+{
+    return m_totalWeight;
+}
+
+size_t AliasTable::size() const
+{
+    return m_bins.size();
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Walker/Vose alias table: draws an index with probability proportional to its weight in O(1).
+class AliasTable {
+public:
+    AliasTable() = default;
+    // Weights must be non-negative. If they are all zero, every index is equally likely.
+    explicit AliasTable(std::span<const float> weights);
+
+    // Draw an index using a single uniform random number in [0, 1).
+    [[nodiscard]] uint32_t sample(float random) const;
+    // Probability with which sample() returns the given index.
+    [[nodiscard]] float probability(uint32_t index) const;
+
+    [[nodiscard]] float totalWeight() const;
+    [[nodiscard]] size_t size() const;
+
+private:
+    struct Bin {
+        float threshold; // Probability of keeping the index of the bin rather than taking its alias.
+        uint32_t alias;
+        float probability;
+    };
+    std::vector<Bin> m_bins;
+    float m_totalWeight = 0.0f;
+};
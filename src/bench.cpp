@@ -0,0 +1,301 @@
+#include "bounding_volume_hierarchy.h"
+#include "bvh_interface.h"
+#include "config.h"
+#include "draw.h"
+#include "light.h"
+#include "render.h"
+#include "scene.h"
+#include "screen.h"
+#include "shading.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/core.h>
+#include <fmt/ostream.h>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <framework/trackball.h>
+#include <framework/variant_helper.h>
+#include <framework/window.h>
+#include <functional>
+#include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Benchmark of the bundled scenes: BVH build time, rays per second of each kind of ray and the time of a whole frame,
+// for a fixed camera and a few fixed feature sets. Every measurement is repeated and reported as percentiles in JSON.
+//
+// Usage: FinalProjectBench [--runs N] [--warmup N] [--resolution N] [--output file.json]
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchSettings {
+    int runs = 5; // Measured repetitions.
+    int warmup = 1; // Repetitions that are not measured, to warm up caches (and the texture cache).
+    int resolution = 256; // Width and height of the rendered images.
+    std::filesystem::path outputFile; // Print to the standard output when empty.
+};
+
+struct FeatureSet {
+    const char* name;
+    Features features;
+};
+
+static std::vector<FeatureSet> benchFeatureSets()
+{
+    Features basic {};
+    basic.enableShading = true;
+    basic.enableHardShadow = true;
+    basic.enableAccelStructure = true;
+
+    Features full = basic;
+    full.enableRecursive = true;
+    full.enableSoftShadow = true;
+    full.enableNormalInterp = true;
+    full.enableTextureMapping = true;
+    full.extra.enableBvhSahBinning = true;
+    full.extra.enableBilinearTextureFiltering = true;
+    return { { "basic", basic }, { "full", full } };
+}
+
+struct Percentiles {
+    double min, p50, p90, p99, max;
+};
+
+struct RayBatchResult {
+    size_t count = 0;
+    Percentiles raysPerSecond {};
+};
+
+struct SceneResult {
+    std::string scene;
+    std::string features;
+    size_t numTriangles;
+    size_t numSpheres;
+    Percentiles bvhBuildMs;
+    RayBatchResult primary, shadow, secondary;
+    Percentiles frameMs;
+};
+
+// Minimum, percentiles and maximum of the measurements (nearest rank).
+static Percentiles summarize(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    const auto percentile = [&](double p) { return values[size_t(p / 100.0 * double(values.size() - 1) + 0.5)]; };
+    return { values.front(), percentile(50.0), percentile(90.0), percentile(99.0), values.back() };
+}
+
+// Run func warmup + runs times and return the durations of the measured runs in milliseconds.
+static std::vector<double> measure(const BenchSettings& settings, const std::function<void()>& func)
+{
+    std::vector<double> durations;
+    for (int i = 0; i < settings.warmup + settings.runs; i++) {
+        const auto start = Clock::now();
+        func();
+        const auto end = Clock::now();
+        if (i >= settings.warmup)
+            durations.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return durations;
+}
+
+// Rays per second of a batch of rays traced in the given time (in milliseconds).
+static std::vector<double> raysPerSecond(size_t numRays, std::vector<double> durations)
+{
+    for (double& duration : durations)
+        duration = double(numRays) / std::max(duration, 1e-6) * 1000.0;
+    return durations;
+}
+
+// A point on each light, for the shadow rays.
+static std::vector<glm::vec3> lightPositions(const Scene& scene)
+{
+    std::vector<glm::vec3> positions;
+    for (const auto& light : scene.lights) {
+        std::visit(make_visitor(
+                       [&](const PointLight& pointLight) { positions.push_back(pointLight.position); },
+                       [&](const SegmentLight& segmentLight) { positions.push_back((segmentLight.endpoint0 + segmentLight.endpoint1) * 0.5f); },
+                       [&](const ParallelogramLight& parallelogramLight) { positions.push_back(parallelogramLight.v0 + (parallelogramLight.edge01 + parallelogramLight.edge02) * 0.5f); }),
+            light);
+    }
+    return positions;
+}
+
+// Trace every ray of the batch with intersect() (or intersectAny() for shadow rays), on all threads like the renderer.
+static void traceRays(const BvhInterface& bvh, std::span<const Ray> rays, const Features& features, bool shadowRays)
+{
+#ifdef NDEBUG
+#pragma omp parallel for schedule(guided)
+#endif
+    for (int i = 0; i < int(rays.size()); i++) {
+        Ray ray = rays[size_t(i)];
+        if (shadowRays) {
+            (void)bvh.intersectAny(ray, features);
+        } else {
+            HitInfo hitInfo;
+            (void)bvh.intersect(ray, hitInfo, features);
+        }
+    }
+}
+
+static SceneResult benchScene(SceneType sceneType, const FeatureSet& featureSet, const Trackball& camera, const BenchSettings& settings)
+{
+    Scene scene = loadScenePrebuilt(sceneType, DATA_DIR);
+    const Features& features = featureSet.features;
+    compileSceneLights(scene, features);
+
+    // The bundled scenes have no instances, so BvhInterface holds a single BoundingVolumeHierarchy.
+    const auto buildTimes = measure(settings, [&]() { BoundingVolumeHierarchy { &scene, features }; });
+    const BvhInterface bvh { &scene, features };
+
+    // Camera rays through the pixel centers, then shadow rays from their hits towards every light and the mirror
+    // reflections of the hits.
+    const glm::vec2 pixelSize { 2.0f / float(settings.resolution) };
+    std::vector<Ray> cameraRays, shadowRays, secondaryRays;
+    const auto lights = lightPositions(scene);
+    for (int y = 0; y < settings.resolution; y++) {
+        for (int x = 0; x < settings.resolution; x++) {
+            const glm::vec2 normalizedPixelPos = (glm::vec2(x, y) + 0.5f) * pixelSize - 1.0f;
+            Ray ray = camera.generateRay(normalizedPixelPos, pixelSize);
+            cameraRays.push_back(ray);
+            HitInfo hitInfo;
+            if (!bvh.intersect(ray, hitInfo, features))
+                continue;
+            const glm::vec3 hitPoint = ray.origin + ray.t * ray.direction;
+            for (const auto& lightPosition : lights) {
+                const glm::vec3 toLight = lightPosition - hitPoint;
+                shadowRays.push_back(Ray { hitPoint + glm::normalize(toLight) * 0.001f, toLight, 1.0f - 0.01f });
+            }
+            secondaryRays.push_back(computeReflectionRay(ray, hitInfo));
+        }
+    }
+
+    Screen screen { glm::ivec2(settings.resolution), false };
+    const auto frameTimes = measure(settings, [&]() { renderRayTracing(scene, camera, bvh, screen, features); });
+
+    const auto rayBatch = [&](std::span<const Ray> rays, bool shadow) {
+        RayBatchResult result { rays.size() };
+        if (!rays.empty())
+            result.raysPerSecond = summarize(raysPerSecond(rays.size(), measure(settings, [&]() { traceRays(bvh, rays, features, shadow); })));
+        return result;
+    };
+    size_t numTriangles = 0;
+    for (const auto& mesh : scene.meshes)
+        numTriangles += mesh.triangles.size();
+    return SceneResult {
+        .scene = serialize(sceneType),
+        .features = featureSet.name,
+        .numTriangles = numTriangles,
+        .numSpheres = scene.spheres.size(),
+        .bvhBuildMs = summarize(buildTimes),
+        .primary = rayBatch(cameraRays, false),
+        .shadow = rayBatch(shadowRays, true),
+        .secondary = rayBatch(secondaryRays, false),
+        .frameMs = summarize(frameTimes),
+    };
+}
+
+static std::string toJson(const Percentiles& percentiles)
+{
+    return fmt::format(R"({{ "min": {}, "p50": {}, "p90": {}, "p99": {}, "max": {} }})", percentiles.min, percentiles.p50, percentiles.p90, percentiles.p99, percentiles.max);
+}
+
+static std::string toJson(const RayBatchResult& rayBatch)
+{
+    return fmt::format(R"({{ "count": {}, "rays_per_second": {} }})", rayBatch.count, toJson(rayBatch.raysPerSecond));
+}
+
+static void writeJson(std::ostream& stream, const BenchSettings& settings, std::span<const SceneResult> results)
+{
+    fmt::print(stream, "{{\n  \"runs\": {},\n  \"warmup\": {},\n  \"resolution\": {},\n  \"results\": [", settings.runs, settings.warmup, settings.resolution);
+    for (size_t i = 0; i < results.size(); i++) {
+        const SceneResult& result = results[i];
+        fmt::print(stream, "{}\n    {{\n", i == 0 ? "" : ",");
+        fmt::print(stream, "      \"scene\": \"{}\",\n      \"features\": \"{}\",\n", result.scene, result.features);
+        fmt::print(stream, "      \"triangles\": {},\n      \"spheres\": {},\n", result.numTriangles, result.numSpheres);
+        fmt::print(stream, "      \"bvh_build_ms\": {},\n", toJson(result.bvhBuildMs));
+        fmt::print(stream, "      \"primary\": {},\n", toJson(result.primary));
+        fmt::print(stream, "      \"shadow\": {},\n", toJson(result.shadow));
+        fmt::print(stream, "      \"secondary\": {},\n", toJson(result.secondary));
+        fmt::print(stream, "      \"frame_ms\": {}\n    }}", toJson(result.frameMs));
+    }
+    fmt::print(stream, "\n  ]\n}}\n");
+}
+
+static bool parseArguments(int argc, char** argv, BenchSettings& settings)
+{
+    for (int i = 1; i < argc; i++) {
+        const std::string_view argument { argv[i] };
+        if (i + 1 >= argc) {
+            std::cerr << "Error: Missing value for " << argument << std::endl;
+            return false;
+        }
+        if (argument == "--runs") {
+            settings.runs = std::max(std::atoi(argv[++i]), 1);
+        } else if (argument == "--warmup") {
+            settings.warmup = std::max(std::atoi(argv[++i]), 0);
+        } else if (argument == "--resolution") {
+            settings.resolution = std::max(std::atoi(argv[++i]), 1);
+        } else if (argument == "--output") {
+            settings.outputFile = argv[++i];
+        } else {
+            std::cerr << "Error: Unknown argument " << argument << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchSettings settings;
+    if (!parseArguments(argc, argv, settings)) {
+        std::cerr << "Usage: " << argv[0] << " [--runs N] [--warmup N] [--resolution N] [--output file.json]" << std::endl;
+        return 1;
+    }
+
+    // The camera needs a window (for its aspect ratio), which is never shown; see the command-line rendering in main.cpp.
+    enableDebugDraw = false;
+    Window window { "Final Project Benchmark", glm::ivec2(settings.resolution), OpenGLVersion::GL2, false };
+    const CameraConfig cameraConfig {};
+    Trackball camera { &window, glm::radians(cameraConfig.fieldOfView), cameraConfig.distanceFromLookAt };
+    camera.setCamera(cameraConfig.lookAt, glm::radians(cameraConfig.rotation), cameraConfig.distanceFromLookAt);
+
+    constexpr std::array sceneTypes { SceneType::SingleTriangle, SceneType::Cube, SceneType::CubeTextured, SceneType::CornellBox,
+        SceneType::CornellBoxParallelogramLight, SceneType::Monkey, SceneType::Teapot, SceneType::Dragon, SceneType::Spheres, SceneType::Custom };
+    std::vector<SceneResult> results;
+    for (const SceneType sceneType : sceneTypes) {
+        for (const auto& featureSet : benchFeatureSets()) {
+            std::cerr << "Benchmarking " << serialize(sceneType) << " (" << featureSet.name << ")" << std::endl;
+            try {
+                results.push_back(benchScene(sceneType, featureSet, camera, settings));
+            } catch (const std::exception&) {
+                // Scenes whose meshes are not in the data directory (loadMesh() prints which file is missing).
+                std::cerr << "Skipping " << serialize(sceneType) << std::endl;
+                break;
+            }
+        }
+    }
+
+    if (settings.outputFile.empty()) {
+        writeJson(std::cout, settings, results);
+        return 0;
+    }
+    std::ofstream stream { settings.outputFile };
+    writeJson(stream, settings, results);
+    if (!stream) {
+        std::cerr << "Error: Could not write " << settings.outputFile << std::endl;
+        return 1;
+    }
+    fmt::print(stderr, "Results saved to {}\n", settings.outputFile.string());
+    return 0;
+}
@@ -1,41 +1,261 @@
 #include "bounding_volume_hierarchy.h"
+#include "bvh_statistics.h"
 #include "draw.h"
 #include "interpolate.h"
 #include "intersect.h"
+#include "linear_bvh.h"
 #include "scene.h"
+#include "spatial_split_bvh.h"
 #include "texture.h"
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <deque>
+#include <framework/hash.h>
+#include <framework/mapped_file.h>
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <fstream>
 #include <glm/glm.hpp>
 #include <iostream>
+#include <random>
+#include <tuple>
+#include <type_traits>
 
 int depthOfRecursion = 0;
 
+uint64_t nextBvhGeneration()
+{
+    static std::atomic<uint64_t> generation { 0 };
+    return ++generation;
+}
+
 BoundingVolumeHierarchy::BoundingVolumeHierarchy(Scene* pScene, const Features& features)
     : m_pScene(pScene)
+    , m_endMesh(uint32_t(pScene->meshes.size()))
+{
+    build(features);
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(Scene* pScene, uint32_t firstMesh, uint32_t endMesh, bool includeSpheres, const Features& features)
+    : m_pScene(pScene)
+    , m_firstMesh(firstMesh)
+    , m_endMesh(endMesh)
+    , m_includeSpheres(includeSpheres)
+{
+    build(features);
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(Scene* pScene, const Features& features, const std::filesystem::path& cacheFile)
+    : m_pScene(pScene)
+    , m_endMesh(uint32_t(pScene->meshes.size()))
+{
+    if (load(cacheFile, features))
+        return;
+    build(features);
+    if (!save(cacheFile))
+        std::cerr << "Failed to write BVH cache " << cacheFile << std::endl;
+}
+
+void BoundingVolumeHierarchy::build(const Features& features)
 {
-    this->m_pScene = pScene;
-    auto triangles = std::vector<TriangleOrNode>();
-    for (size_t i = 0; i < pScene->meshes.size(); ++i) {
-        const auto& mesh = pScene->meshes[i];
+    auto triangles = std::vector<Primitive>();
+    for (uint32_t i = m_firstMesh; i < m_endMesh; ++i) {
+        const auto& mesh = m_pScene->meshes[i];
         for (size_t j = 0; j < mesh.triangles.size(); ++j) {
-            triangles.push_back(TriangleOrNode { i, j });
+            triangles.push_back(Primitive { uint32_t(i), uint32_t(j) });
         }
     }
-    if (features.extra.enableBvhSahBinning) {
+    if (m_includeSpheres) {
+        for (size_t j = 0; j < m_pScene->spheres.size(); ++j)
+            triangles.push_back(Primitive { Primitive::sphereMeshIndex, uint32_t(j) });
+    }
+    this->m_settings = features.bvh;
+    this->m_sahBinning = features.extra.enableBvhSahBinning;
+    this->nodes.clear();
+    this->debugPlanes.assign(size_t(features.bvh.maxDepth) + 2, {});
+    if (features.bvh.buildQuality == BvhBuildQuality::Fast) {
+        this->nodes = buildLinearBvh(triangles, *this->m_pScene, this->m_settings);
+    } else if (features.bvh.buildQuality == BvhBuildQuality::High) {
+        this->nodes = buildSpatialSplitBvh(triangles, *this->m_pScene, this->m_settings);
+    } else if (features.extra.enableBvhSahBinning) {
         sahConstructorHelper(triangles, 0, triangles.size(), 0, 0);
     } else {
         constructorHelper(triangles, 0, triangles.size(), 0, 0);
     }
+    // The builders sort the triangles in place such that every leaf covers a contiguous range (the spatial split
+    // builder may repeat triangles in several leaves).
+    this->primitives = std::move(triangles);
+    computeStatistics();
+    this->m_generation = nextBvhGeneration();
+}
 
+void BoundingVolumeHierarchy::computeStatistics()
+{
     this->m_numLevels = 0;
+    this->m_numLeaves = 0;
     for (const auto& node : this->nodes) {
         this->m_numLevels = std::max(this->m_numLevels, node.level + 1);
+        this->m_numLeaves += node.isLeaf ? 1 : 0;
+    }
+    this->m_innerNodesByLevel.assign(size_t(this->m_numLevels), {});
+    for (uint32_t i = 0; i < this->nodes.size(); ++i) {
+        if (!this->nodes[i].isLeaf)
+            this->m_innerNodesByLevel[size_t(this->nodes[i].level)].push_back(i);
     }
+    std::vector<Node> refittedNodes = this->nodes;
+    refitBoxes(refittedNodes);
+    this->m_builtSahCost = computeBvhStatistics(refittedNodes).sahCost;
 }
 
-glm::vec3 getMedian(const TriangleOrNode& triangle, const Scene& scene)
+// On-disk layout of a stored hierarchy: header, node array, primitive array.
+static constexpr char bvhFileMagic[8] = { 'C', 'G', 'B', 'V', 'H', '\0', '\0', '\0' };
+// Version 2 added spheres to the primitives, version 3 the build quality, version 4 spatial splits.
+static constexpr uint32_t bvhFileVersion = 4;
+static_assert(std::is_trivially_copyable_v<Node> && std::is_trivially_copyable_v<Primitive>);
+
+struct BvhFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sahBinning;
+    int32_t binCount;
+    int32_t leafSize;
+    int32_t maxDepth;
+    uint32_t buildQuality;
+    int32_t optimizationPasses;
+    float spatialSplitMemoryFactor;
+    uint64_t sceneHash;
+    uint64_t nodeCount;
+    uint64_t primitiveCount;
+};
+
+static bool isValidPrimitive(const Primitive& primitive, const Scene& scene)
 {
+    if (primitive.isSphere())
+        return primitive.triangleIndex < scene.spheres.size();
+    return primitive.meshIndex < scene.meshes.size() && primitive.triangleIndex < scene.meshes[primitive.meshIndex].triangles.size();
+}
+
+uint64_t computeSceneHash(const Scene& scene)
+{
+    uint64_t hash = scene.meshes.size();
+    for (const auto& mesh : scene.meshes) {
+        hash = hashBytes(std::span<const Vertex>(mesh.vertices), hash);
+        hash = hashBytes(std::span<const glm::uvec3>(mesh.triangles), hash);
+    }
+    for (const auto& sphere : scene.spheres) {
+        const glm::vec4 geometry { sphere.center, sphere.radius };
+        hash = hashBytes(std::span<const glm::vec4>(&geometry, 1), hash);
+    }
+    return hash;
+}
+
+static BvhFileHeader makeBvhFileHeader(const Scene& scene, bool sahBinning, const BvhSettings& settings)
+{
+    BvhFileHeader header {};
+    std::memcpy(header.magic, bvhFileMagic, sizeof(bvhFileMagic));
+    header.version = bvhFileVersion;
+    // SAH binning only affects full quality builds, the rotation passes only fast builds and the reference
+    // budget only high quality builds. The split plane count matters for SAH binning and spatial splits.
+    const bool fast = settings.buildQuality == BvhBuildQuality::Fast;
+    const bool high = settings.buildQuality == BvhBuildQuality::High;
+    header.sahBinning = sahBinning && settings.buildQuality == BvhBuildQuality::Full;
+    header.binCount = header.sahBinning || high ? settings.binCount : 0;
+    header.buildQuality = uint32_t(settings.buildQuality);
+    header.optimizationPasses = fast ? settings.optimizationPasses : 0;
+    header.spatialSplitMemoryFactor = high ? settings.spatialSplitMemoryFactor : 0.0f;
+    header.leafSize = settings.leafSize;
+    header.maxDepth = settings.maxDepth;
+    header.sceneHash = computeSceneHash(scene);
+    return header;
+}
+
+bool BoundingVolumeHierarchy::save(const std::filesystem::path& filePath) const
+{
+    auto header = makeBvhFileHeader(*m_pScene, m_sahBinning, m_settings);
+    header.nodeCount = nodes.size();
+    header.primitiveCount = primitives.size();
+
+    std::error_code error;
+    if (filePath.has_parent_path())
+        std::filesystem::create_directories(filePath.parent_path(), error);
+    // Write to a uniquely named temporary file first so that concurrent readers never observe a partially written file.
+    auto tmpPath = filePath;
+    tmpPath += fmt::format(".{:08x}.tmp", std::random_device {}());
+    {
+        std::ofstream stream { tmpPath, std::ios::binary | std::ios::trunc };
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(nodes.data()), std::streamsize(nodes.size() * sizeof(Node)));
+        stream.write(reinterpret_cast<const char*>(primitives.data()), std::streamsize(primitives.size() * sizeof(Primitive)));
+        if (!stream)
+            return false;
+    }
+    std::filesystem::rename(tmpPath, filePath, error);
+    return !error;
+}
+
+bool BoundingVolumeHierarchy::load(const std::filesystem::path& filePath, const Features& features)
+{
+    if (!std::filesystem::exists(filePath))
+        return false;
+    const MappedFile file { filePath };
+    const auto bytes = file.bytes();
+    if (bytes.size() < sizeof(BvhFileHeader))
+        return false;
+
+    BvhFileHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    const auto expected = makeBvhFileHeader(*m_pScene, features.extra.enableBvhSahBinning, features.bvh);
+    if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version
+        || header.sahBinning != expected.sahBinning || header.binCount != expected.binCount || header.leafSize != expected.leafSize
+        || header.maxDepth != expected.maxDepth || header.buildQuality != expected.buildQuality
+        || header.optimizationPasses != expected.optimizationPasses || header.spatialSplitMemoryFactor != expected.spatialSplitMemoryFactor
+        || header.sceneHash != expected.sceneHash)
+        return false;
+    // Bound the counts by the file size first, so that corrupted counts cannot overflow the size computation.
+    const size_t payloadSize = bytes.size() - sizeof(header);
+    if (header.nodeCount > payloadSize / sizeof(Node) || header.primitiveCount > payloadSize / sizeof(Primitive))
+        return false;
+    if (payloadSize != header.nodeCount * sizeof(Node) + header.primitiveCount * sizeof(Primitive))
+        return false;
+
+    const std::byte* pNodes = bytes.data() + sizeof(header);
+    const std::byte* pPrimitives = pNodes + header.nodeCount * sizeof(Node);
+    std::vector<Node> loadedNodes(header.nodeCount);
+    std::memcpy(loadedNodes.data(), pNodes, header.nodeCount * sizeof(Node));
+    std::vector<Primitive> loadedPrimitives(header.primitiveCount);
+    std::memcpy(loadedPrimitives.data(), pPrimitives, header.primitiveCount * sizeof(Primitive));
+
+    // Reject files whose indices point outside of the arrays (e.g. truncated or corrupted files).
+    const bool validNodes = std::all_of(std::begin(loadedNodes), std::end(loadedNodes), [&](const Node& node) {
+        if (node.isLeaf)
+            return uint64_t(node.primitiveOffset()) + node.primitiveCount() <= loadedPrimitives.size();
+        return node.leftChild() < loadedNodes.size() && node.rightChild() < loadedNodes.size();
+    });
+    const bool validPrimitives = std::all_of(std::begin(loadedPrimitives), std::end(loadedPrimitives), [&](const Primitive& primitive) {
+        return isValidPrimitive(primitive, *m_pScene);
+    });
+    if (!validNodes || !validPrimitives)
+        return false;
+
+    this->nodes = std::move(loadedNodes);
+    this->primitives = std::move(loadedPrimitives);
+    this->m_settings = features.bvh;
+    this->m_sahBinning = features.extra.enableBvhSahBinning;
+    // Split planes are only recorded while building; they are not stored.
+    this->debugPlanes.assign(size_t(features.bvh.maxDepth) + 2, {});
+    computeStatistics();
+    this->m_generation = nextBvhGeneration();
+    return true;
+}
+
+glm::vec3 getMedian(const Primitive& triangle, const Scene& scene)
+{
+    if (triangle.isSphere())
+        return scene.spheres[triangle.triangleIndex].center;
     const auto& mesh = scene.meshes[triangle.meshIndex];
     const auto& tr = mesh.triangles[triangle.triangleIndex]; // uvec3, indices of points of a single triangle
     const auto& p1 = mesh.vertices[tr.x].position;
@@ -45,14 +265,20 @@ glm::vec3 getMedian(const TriangleOrNode& triangle, const Scene& scene)
 }
 
 AxisAlignedBox getBox(
-    const std::vector<TriangleOrNode>::iterator begin,
-    const std::vector<TriangleOrNode>::iterator end,
+    std::vector<Primitive>::const_iterator begin,
+    std::vector<Primitive>::const_iterator end,
     const Scene& scene)
 {
     glm::vec3 lower = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
     glm::vec3 upper = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
     for (auto it = begin; it != end; it += 1) {
         auto triangle = *it;
+        if (triangle.isSphere()) {
+            const auto& sphere = scene.spheres[triangle.triangleIndex];
+            lower = glm::min(lower, sphere.center - sphere.radius);
+            upper = glm::max(upper, sphere.center + sphere.radius);
+            continue;
+        }
         const auto& mesh = scene.meshes[triangle.meshIndex];
         const auto& tr = mesh.triangles[triangle.triangleIndex];
         const auto &v1 = mesh.vertices[tr.x].position, v2 = mesh.vertices[tr.y].position, v3 = mesh.vertices[tr.z].position;
@@ -67,18 +293,17 @@ AxisAlignedBox getBox(
     return { lower, upper };
 }
 // which axis can work as a depth indicator
-size_t BoundingVolumeHierarchy::constructorHelper(std::vector<TriangleOrNode>& triangles, size_t left, size_t right, int whichAxis, int level)
+size_t BoundingVolumeHierarchy::constructorHelper(std::vector<Primitive>& triangles, size_t left, size_t right, int whichAxis, int level)
 {
     const auto beginIt = triangles.begin() + left;
     const auto endIt = triangles.begin() + right;
 
-    if (right - left <= 1 || level > 16) {
-        this->nodes.push_back({ true, level, std::vector<TriangleOrNode>(beginIt, endIt), getBox(beginIt, endIt, *this->m_pScene) });
-        this->m_numLeaves += 1;
+    if (right - left <= size_t(m_settings.leafSize) || level > m_settings.maxDepth) {
+        this->nodes.push_back(Node { .box = getBox(beginIt, endIt, *this->m_pScene), .level = level, .isLeaf = true, .first = uint32_t(left), .second = uint32_t(right - left) });
         return this->nodes.size() - 1;
     }
 
-    std::sort(triangles.begin() + left, triangles.begin() + right, [this, whichAxis](const TriangleOrNode& triangle1, const TriangleOrNode& triangle2) {
+    std::sort(triangles.begin() + left, triangles.begin() + right, [this, whichAxis](const Primitive& triangle1, const Primitive& triangle2) {
         const auto median1 = getMedian(triangle1, *this->m_pScene);
         const auto median2 = getMedian(triangle2, *this->m_pScene);
         return median1[whichAxis] < median2[whichAxis];
@@ -88,8 +313,7 @@ size_t BoundingVolumeHierarchy::constructorHelper(std::vector<TriangleOrNode>& t
     const auto leftIndex = this->constructorHelper(triangles, left, median, (whichAxis + 1) % 3, level + 1);
     const auto rightIndex = this->constructorHelper(triangles, median, right, (whichAxis + 1) % 3, level + 1);
 
-    const auto children = std::vector<TriangleOrNode> { { 0, 0, leftIndex }, { 0, 0, rightIndex } };
-    this->nodes.push_back({ false, level, children, getBox(beginIt, endIt, *this->m_pScene) });
+    this->nodes.push_back(Node { .box = getBox(beginIt, endIt, *this->m_pScene), .level = level, .isLeaf = false, .first = uint32_t(leftIndex), .second = uint32_t(rightIndex) });
     return this->nodes.size() - 1;
 }
 
@@ -113,15 +337,15 @@ float getProb(const AxisAlignedBox& inner, const AxisAlignedBox& outer)
 }
 
 // cost calculation function
-std::pair<float, std::vector<TriangleOrNode>::iterator> calculateCostOfDivision(
-    const std::vector<TriangleOrNode>::iterator begin,
-    const std::vector<TriangleOrNode>::iterator end,
+std::pair<float, std::vector<Primitive>::iterator> calculateCostOfDivision(
+    const std::vector<Primitive>::iterator begin,
+    const std::vector<Primitive>::iterator end,
     const Scene& scene,
     float boundary,
     int whichAxis)
 {
     auto middle = begin;
-    while (getMedian(*middle, scene)[whichAxis] < boundary && middle != end)
+    while (middle != end && getMedian(*middle, scene)[whichAxis] < boundary)
         ++middle;
     auto outerBox = getBox(begin, end, scene);
     auto leftBox = getBox(begin, middle, scene);
@@ -130,24 +354,23 @@ std::pair<float, std::vector<TriangleOrNode>::iterator> calculateCostOfDivision(
 }
 
 // which axis can work as a depth indicator
-size_t BoundingVolumeHierarchy::sahConstructorHelper(std::vector<TriangleOrNode>& triangles, size_t left, size_t right, int whichAxis, int level)
+size_t BoundingVolumeHierarchy::sahConstructorHelper(std::vector<Primitive>& triangles, size_t left, size_t right, int whichAxis, int level)
 {
     const auto beginIt = triangles.begin() + left;
     const auto endIt = triangles.begin() + right;
 
-    if (right - left <= 1 || level > 16) {
-        this->nodes.push_back({ true, level, std::vector<TriangleOrNode>(beginIt, endIt), getBox(beginIt, endIt, *this->m_pScene) });
-        this->m_numLeaves += 1;
+    if (right - left <= size_t(m_settings.leafSize) || level > m_settings.maxDepth) {
+        this->nodes.push_back(Node { .box = getBox(beginIt, endIt, *this->m_pScene), .level = level, .isLeaf = true, .first = uint32_t(left), .second = uint32_t(right - left) });
         return this->nodes.size() - 1;
     }
 
-    std::sort(triangles.begin() + left, triangles.begin() + right, [this, whichAxis](const TriangleOrNode& triangle1, const TriangleOrNode& triangle2) {
+    std::sort(triangles.begin() + left, triangles.begin() + right, [this, whichAxis](const Primitive& triangle1, const Primitive& triangle2) {
         const auto median1 = getMedian(triangle1, *this->m_pScene);
         const auto median2 = getMedian(triangle2, *this->m_pScene);
         return median1[whichAxis] < median2[whichAxis];
     });
 
-    const size_t planesNumber = std::min(static_cast<size_t>(5), right - left - 1);
+    const size_t planesNumber = std::min(static_cast<size_t>(m_settings.binCount), right - left - 1);
     const auto leftBoundary = getMedian(*beginIt, *this->m_pScene)[whichAxis];
     const auto rightBoundary = getMedian(*(endIt - 1), *this->m_pScene)[whichAxis];
     const float step = (rightBoundary - leftBoundary) / (planesNumber + 1);
@@ -172,11 +395,62 @@ size_t BoundingVolumeHierarchy::sahConstructorHelper(std::vector<TriangleOrNode>
     const auto leftIndex = this->sahConstructorHelper(triangles, left, median, (whichAxis + 1) % 3, level + 1);
     const auto rightIndex = this->sahConstructorHelper(triangles, median, right, (whichAxis + 1) % 3, level + 1);
 
-    const auto children = std::vector<TriangleOrNode> { { 0, 0, leftIndex }, { 0, 0, rightIndex } };
-    this->nodes.push_back({ false, level, children, getBox(beginIt, endIt, *this->m_pScene) });
+    this->nodes.push_back(Node { .box = getBox(beginIt, endIt, *this->m_pScene), .level = level, .isLeaf = false, .first = uint32_t(leftIndex), .second = uint32_t(rightIndex) });
     return this->nodes.size() - 1;
 }
 
+float BoundingVolumeHierarchy::sahCost() const
+{
+    return computeBvhStatistics(this->nodes).sahCost;
+}
+
+BvhStatistics BoundingVolumeHierarchy::statistics() const
+{
+    BvhStatistics statistics = computeBvhStatistics(this->nodes);
+    statistics.numReferences = this->primitives.size();
+    statistics.memoryBytes = this->nodes.size() * sizeof(Node) + this->primitives.size() * sizeof(Primitive);
+    return statistics;
+}
+
+void BoundingVolumeHierarchy::refitBoxes(std::vector<Node>& refittedNodes) const
+{
+    // Leaves first, then the inner nodes level by level from the bottom up: the children of an inner node are
+    // always one level deeper, so every level only reads boxes that are already up to date.
+#pragma omp parallel for
+    for (int i = 0; i < static_cast<int>(refittedNodes.size()); i++) {
+        Node& node = refittedNodes[size_t(i)];
+        if (node.isLeaf) {
+            const auto begin = this->primitives.begin() + node.primitiveOffset();
+            node.box = getBox(begin, begin + node.primitiveCount(), *this->m_pScene);
+        }
+    }
+    for (auto levelIt = this->m_innerNodesByLevel.rbegin(); levelIt != this->m_innerNodesByLevel.rend(); ++levelIt) {
+        const std::vector<uint32_t>& levelNodes = *levelIt;
+#pragma omp parallel for
+        for (int i = 0; i < static_cast<int>(levelNodes.size()); i++) {
+            Node& node = refittedNodes[levelNodes[size_t(i)]];
+            const AxisAlignedBox& left = refittedNodes[node.leftChild()].box;
+            const AxisAlignedBox& right = refittedNodes[node.rightChild()].box;
+            node.box = { glm::min(left.lower, right.lower), glm::max(left.upper, right.upper) };
+        }
+    }
+}
+
+bool BoundingVolumeHierarchy::refit(const Features& features)
+{
+    refitBoxes(this->nodes);
+    // Split planes are only recorded while building; those of the old vertex positions would be misleading.
+    for (auto& levelPlanes : this->debugPlanes)
+        levelPlanes.clear();
+
+    if (sahCost() > this->m_builtSahCost * features.bvh.refitRebuildThreshold) {
+        build(features);
+        return true;
+    }
+    this->m_generation = nextBvhGeneration();
+    return false;
+}
+
 // Return the depth of the tree that you constructed. This is used to tell the
 // slider in the UI how many steps it should display for Visual Debug 1.
 int BoundingVolumeHierarchy::numLevels() const
@@ -218,6 +492,17 @@ void drawLeafTriangle(const glm::uvec3& triangle, const Mesh& mesh, const glm::v
     drawTriangle(v0, v1, v2, color);
 }
 
+static void drawLeafPrimitive(const Primitive& primitive, const Scene& scene, const glm::vec3& color)
+{
+    if (primitive.isSphere()) {
+        const auto& sphere = scene.spheres[primitive.triangleIndex];
+        drawSphere(sphere.center, sphere.radius, color);
+    } else {
+        const auto& mesh = scene.meshes[primitive.meshIndex];
+        drawLeafTriangle(mesh.triangles[primitive.triangleIndex], mesh, color);
+    }
+}
+
 // Use this function to visualize your leaf nodes. This is useful for debugging. The function
 // receives the leaf node to be draw (think of the ith leaf node). Draw the AABB of the leaf node and all contained triangles.
 // You can draw the triangles with different colors. NoteL leafIdx is not the index in the node vector, it is the
@@ -228,16 +513,13 @@ void BoundingVolumeHierarchy::debugDrawLeaf(int leafIdx)
     // AxisAlignedBox aabb{ glm::vec3(-0.05f), glm::vec3(0.05f, 1.05f, 1.05f) };
     // drawShape(aabb, DrawMode::Filled, glm::vec3(0.0f, 1.0f, 0.0f), 0.2f);
     size_t leafCounter = 0;
-    for (size_t i = 0; i <= this->nodes.size(); ++i) {
+    for (size_t i = 0; i < this->nodes.size(); ++i) {
         if (this->nodes[i].isLeaf)
             ++leafCounter;
         if (this->nodes[i].isLeaf && leafCounter == leafIdx) {
             drawAABB(this->nodes[i].box, DrawMode::Wireframe, glm::vec3(0.0f, 1.05f, 1.05f), 1.0f);
-            for (const auto& triangle : this->nodes[i].triangles) {
-                const auto& mesh = this->m_pScene->meshes[triangle.meshIndex];
-                const auto& tr = mesh.triangles[triangle.triangleIndex];
-                drawLeafTriangle(tr, mesh, { 1.0f, 1.0f, 0.0f });
-            }
+            for (uint32_t j = 0; j < this->nodes[i].primitiveCount(); ++j)
+                drawLeafPrimitive(this->primitives[this->nodes[i].primitiveOffset() + j], *this->m_pScene, { 1.0f, 1.0f, 0.0f });
         }
     }
     // Draw the AABB as a (white) wireframe box.
@@ -250,7 +532,7 @@ void BoundingVolumeHierarchy::debugDrawLeaf(int leafIdx)
 
 void BoundingVolumeHierarchy::debugDrawSahLevel(int level, const Features& features)
 {
-    if (!features.extra.enableBvhSahBinning) {
+    if (!features.extra.enableBvhSahBinning || level < 0 || size_t(level) >= this->debugPlanes.size()) {
         return;
     }
     const auto color = glm::vec3(173.0 / 256, 216.0 / 256, 230.0 / 256);
@@ -293,7 +575,10 @@ bool intersectWithLeafTriangle(Ray& ray, HitInfo& hitInfo, glm::uvec3 triangle,
         if (features.enableTextureMapping) {
             hitInfo.texCoord = interpolateTexCoord(v0.texCoord, v1.texCoord, v2.texCoord, hitInfo.barycentricCoord);
             if (hitInfo.material.kdTexture) {
-                hitInfo.material.kd = acquireTexel(hitInfo.material.kdTexture.operator*(), hitInfo.texCoord, features);
+                glm::vec2 dTexCoordDx { 0.0f }, dTexCoordDy { 0.0f };
+                if (features.extra.enableMipmapTextureFiltering)
+                    std::tie(dTexCoordDx, dTexCoordDy) = computeTexCoordDifferentials(ray, v0, v1, v2);
+                hitInfo.material.kd = acquireTexel(hitInfo.material.kdTexture->image(), hitInfo.texCoord, dTexCoordDx, dTexCoordDy, features);
             }
         }
 
@@ -302,11 +587,14 @@ bool intersectWithLeafTriangle(Ray& ray, HitInfo& hitInfo, glm::uvec3 triangle,
     return false;
 }
 
-float getClosestIntersectionWithBox(const AxisAlignedBox& box, const Ray& ray)
+bool intersectWithLeafSphere(Ray& ray, HitInfo& hitInfo, const Sphere& sphere)
 {
-    Ray newRay = { ray.origin, ray.direction, ray.t };
-    intersectRayWithShape(box, newRay);
-    return newRay.t;
+    if (!intersectRayWithShape(sphere, ray, hitInfo))
+        return false;
+    hitInfo.material = sphere.material;
+    hitInfo.normal = glm::normalize(ray.origin + ray.direction * ray.t - sphere.center);
+    hitInfo.normal = shoudlBeReverted(ray, hitInfo) ? -hitInfo.normal : hitInfo.normal;
+    return true;
 }
 
 // Return true if something is hit, returns false otherwise. Only find hits if they are closer than t stored
@@ -316,10 +604,13 @@ float getClosestIntersectionWithBox(const AxisAlignedBox& box, const Ray& ray)
 bool BoundingVolumeHierarchy::intersect(Ray& ray, HitInfo& hitInfo, const Features& features) const
 {
     // If BVH is not enabled, use the naive implementation.
+    TraversalCount count;
     if (!features.enableAccelStructure) {
         bool hit = false;
         // Intersect with all triangles of all meshes.
-        for (const auto& mesh : m_pScene->meshes) {
+        for (uint32_t meshIndex = m_firstMesh; meshIndex < m_endMesh; ++meshIndex) {
+            const auto& mesh = m_pScene->meshes[meshIndex];
+            count.primitivesTested += mesh.triangles.size();
             for (const auto& tri : mesh.triangles) {
                 if (intersectWithLeafTriangle(ray, hitInfo, tri, mesh, features)) {
                     hit = true;
@@ -327,54 +618,64 @@ bool BoundingVolumeHierarchy::intersect(Ray& ray, HitInfo& hitInfo, const Featur
             }
         }
         // Intersect with spheres.
-        for (const auto& sphere : m_pScene->spheres)
-            hit |= intersectRayWithShape(sphere, ray, hitInfo);
+        if (m_includeSpheres) {
+            count.primitivesTested += m_pScene->spheres.size();
+            for (const auto& sphere : m_pScene->spheres)
+                hit |= intersectWithLeafSphere(ray, hitInfo, sphere);
+        }
         return hit;
     } else {
         // Please note that you should use `features.enableNormalInterp` and `features.enableTextureMapping`
         // to isolate the code that is only needed for the normal interpolation and texture mapping features.
         if (this->nodes.empty())
             return false;
-        float closestIntersection = std::numeric_limits<float>::max();
+        // Only hits closer than the t the ray came with count, so nodes beyond it need not be visited.
+        float closestIntersection = ray.t;
+        bool hit = false;
 
         std::deque<size_t> deque;
-        auto lower = nodes[0].box.lower;
-        auto upper = nodes[0].box.upper;
-
-        if (getClosestIntersectionWithBox(this->nodes.back().box, ray) < closestIntersection) {
+        if (boxEntryDistance(this->nodes.back().box, ray) <= closestIntersection) {
             deque.push_back(nodes.size() - 1);
         }
 
-        glm::uvec3 intersectionTriangle = {};
-        size_t meshInd = -1;
+        Primitive closestPrimitive {};
         while (!deque.empty()) {
             const auto& next = this->nodes[deque.back()];
             deque.pop_back();
 
-            if (getClosestIntersectionWithBox(next.box, ray) > closestIntersection) {
+            if (boxEntryDistance(next.box, ray) > closestIntersection) {
                 continue;
             }
-            drawAABB(next.box, DrawMode::Wireframe, glm::vec3(1.0f, 1.00f, 1.0f), 1.0f);
+            count.nodesVisited++;
+            if (enableDebugDraw) {
+                drawAABB(next.box, DrawMode::Wireframe, glm::vec3(1.0f, 1.00f, 1.0f), 1.0f);
+            }
 
             if (next.isLeaf) {
-                for (const auto& triangle : next.triangles) {
-                    const auto& mesh = this->m_pScene->meshes[triangle.meshIndex];
-                    const auto& tr = mesh.triangles[triangle.triangleIndex];
-                    if (intersectWithLeafTriangle(ray, hitInfo, tr, mesh, features)) {
+                count.primitivesTested += next.primitiveCount();
+                for (uint32_t i = 0; i < next.primitiveCount(); ++i) {
+                    const auto& primitive = this->primitives[next.primitiveOffset() + i];
+                    bool primitiveHit;
+                    if (primitive.isSphere()) {
+                        primitiveHit = intersectWithLeafSphere(ray, hitInfo, this->m_pScene->spheres[primitive.triangleIndex]);
+                    } else {
+                        const auto& mesh = this->m_pScene->meshes[primitive.meshIndex];
+                        primitiveHit = intersectWithLeafTriangle(ray, hitInfo, mesh.triangles[primitive.triangleIndex], mesh, features);
+                    }
+                    if (primitiveHit) {
+                        hit = true;
                         closestIntersection = std::min(closestIntersection, ray.t);
-                        intersectionTriangle = tr;
-                        meshInd = triangle.meshIndex;
+                        closestPrimitive = primitive;
                     }
                 }
             } else {
-                for (const auto& nodeIndex : next.triangles) {
-                    auto index = nodeIndex.nodeIndex;
+                for (const auto index : { next.leftChild(), next.rightChild() }) {
                     const auto& child = this->nodes[index];
-                    float closest = getClosestIntersectionWithBox(child.box, ray);
+                    float closest = boxEntryDistance(child.box, ray);
 
-                    if (closest < closestIntersection) {
+                    if (closest <= closestIntersection) {
                         deque.push_back(index);
-                    } else if (closest < std::numeric_limits<float>::max() && features.debugOptimisedNodes) {
+                    } else if (closest < std::numeric_limits<float>::infinity() && features.debugOptimisedNodes && enableDebugDraw) {
                         // draw unvisited inteersected node
                         if(hitInfo.depthOfRecursion == depthOfRecursion){
                             drawAABB(next.box, DrawMode::Wireframe, glm::vec3(1.0f, 0.00f, 0.0f), 0.1f);
@@ -384,10 +685,98 @@ bool BoundingVolumeHierarchy::intersect(Ray& ray, HitInfo& hitInfo, const Featur
                 }
             }
         }
-        const auto intersectionHappened = closestIntersection != std::numeric_limits<float>::max();
-        if (intersectionHappened) {
-            drawLeafTriangle(intersectionTriangle, this->m_pScene->meshes[meshInd], { 0.0f, 1.0f, 0.0f });
+        const auto intersectionHappened = hit;
+        if (intersectionHappened && enableDebugDraw) {
+            drawLeafPrimitive(closestPrimitive, *this->m_pScene, { 0.0f, 1.0f, 0.0f });
         }
         return intersectionHappened;
     }
-}
\ No newline at end of file
+}
+// Test a single triangle or sphere of the scene, without computing any of the shading attributes of the hit.
+static bool intersectPrimitiveShape(Ray& ray, const Primitive& primitive, const Scene& scene)
+{
+    HitInfo hitInfo;
+    if (primitive.isSphere())
+        return intersectRayWithShape(scene.spheres[primitive.triangleIndex], ray, hitInfo);
+    const auto& mesh = scene.meshes[primitive.meshIndex];
+    const auto& triangle = mesh.triangles[primitive.triangleIndex];
+    return intersectRayWithTriangle(mesh.vertices[triangle[0]].position, mesh.vertices[triangle[1]].position, mesh.vertices[triangle[2]].position, ray, hitInfo);
+}
+
+bool BoundingVolumeHierarchy::intersectAny(Ray& ray, const Features& features, std::optional<Primitive>* pOccluder) const
+{
+    TraversalCount count;
+    if (!features.enableAccelStructure) {
+        for (uint32_t meshIndex = m_firstMesh; meshIndex < m_endMesh; ++meshIndex) {
+            for (uint32_t triangleIndex = 0; triangleIndex < m_pScene->meshes[meshIndex].triangles.size(); ++triangleIndex) {
+                const Primitive primitive { meshIndex, triangleIndex };
+                count.primitivesTested++;
+                if (intersectPrimitiveShape(ray, primitive, *m_pScene)) {
+                    if (pOccluder)
+                        *pOccluder = primitive;
+                    return true;
+                }
+            }
+        }
+        if (!m_includeSpheres)
+            return false;
+        for (uint32_t sphereIndex = 0; sphereIndex < m_pScene->spheres.size(); ++sphereIndex) {
+            const Primitive primitive { Primitive::sphereMeshIndex, sphereIndex };
+            count.primitivesTested++;
+            if (intersectPrimitiveShape(ray, primitive, *m_pScene)) {
+                if (pOccluder)
+                    *pOccluder = primitive;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (this->nodes.empty())
+        return false;
+    // Unlike intersect() the nodes are not visited in any particular order: any hit ends the traversal.
+    thread_local std::vector<uint32_t> stack;
+    stack.clear();
+    stack.push_back(uint32_t(this->nodes.size() - 1));
+    while (!stack.empty()) {
+        const auto& node = this->nodes[stack.back()];
+        stack.pop_back();
+        if (boxEntryDistance(node.box, ray) > ray.t)
+            continue;
+        count.nodesVisited++;
+
+        if (node.isLeaf) {
+            for (uint32_t i = 0; i < node.primitiveCount(); ++i) {
+                const auto& primitive = this->primitives[node.primitiveOffset() + i];
+                count.primitivesTested++;
+                if (intersectPrimitiveShape(ray, primitive, *m_pScene)) {
+                    if (pOccluder)
+                        *pOccluder = primitive;
+                    return true;
+                }
+            }
+        } else {
+            stack.push_back(node.leftChild());
+            stack.push_back(node.rightChild());
+        }
+    }
+    return false;
+}
+
+bool BoundingVolumeHierarchy::intersectPrimitive(Ray& ray, const Primitive& primitive) const
+{
+    if (!isValidPrimitive(primitive, *m_pScene))
+        return false;
+    return intersectPrimitiveShape(ray, primitive, *m_pScene);
+}
+
+uint64_t BoundingVolumeHierarchy::generation() const
+{
+    return m_generation;
+}
+
+const AxisAlignedBox& BoundingVolumeHierarchy::bounds() const
+{
+    static constexpr AxisAlignedBox empty { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) };
+    return this->nodes.empty() ? empty : this->nodes.back().box;
+}
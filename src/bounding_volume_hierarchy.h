@@ -1,47 +1,82 @@
 #pragma once
 #include "common.h"
 #include <array>
+#include <cstdint>
+#include <filesystem>
 #include <framework/ray.h>
+#include <optional>
 #include <vector>
 
 // Forward declaration.
+struct BvhStatistics;
 struct Scene;
 
 /**
- * meshIndex - index of the mesh inside mesh vector
- * triangleIndex - index of triangle inside this mesh
- * nodeIndex - index of node inside BVH node vector
+ * meshIndex - index of the mesh inside mesh vector, or sphereMeshIndex for a sphere
+ * triangleIndex - index of triangle inside this mesh, or of the sphere inside the sphere vector
  */
-struct TriangleOrNode {
-    size_t meshIndex;
-    size_t triangleIndex;
-    size_t nodeIndex;
+struct Primitive {
+    static constexpr uint32_t sphereMeshIndex = 0xFFFFFFFF;
+
+    uint32_t meshIndex;
+    uint32_t triangleIndex;
+
+    [[nodiscard]] bool isSphere() const { return meshIndex == sphereMeshIndex; }
 };
 
 extern int depthOfRecursion;
 /**
  * Node struct
- * level - level of the node from bottom of its subtree. i.e. leafs have 0 level
- * triangles - if node is leaf it stores indexes of vertices in the mesh (meshIndex and triangleIndex)
- *     and the second (y) coord for the index of the mesh inside the scene mesh vector.
- *     If node is NOT leaf it uses only the nodeIndex to store indices of the child nodes.
+ * level - depth of the node in the tree, i.e. the root has level 0
+ * first/second - if node is leaf it stores the range of its primitives inside the primitive vector
+ *     (offset and count). If node is NOT leaf it stores the indices of the two child nodes.
+ *
+ * Nodes (and primitives) are plain data so that a built hierarchy can be written to disk as is.
  */
 struct Node {
-    const bool isLeaf = false;
-    const int level = 0;
-    const std::vector<TriangleOrNode> triangles;
-    const AxisAlignedBox box;
+    AxisAlignedBox box;
+    int32_t level = 0;
+    uint32_t isLeaf = false;
+    uint32_t first = 0;
+    uint32_t second = 0;
+
+    [[nodiscard]] uint32_t primitiveOffset() const { return first; }
+    [[nodiscard]] uint32_t primitiveCount() const { return second; }
+    [[nodiscard]] uint32_t leftChild() const { return first; }
+    [[nodiscard]] uint32_t rightChild() const { return second; }
 };
 
 class BoundingVolumeHierarchy {
 public:
     // Constructor. Receives the scene and builds the bounding volume hierarchy.
     BoundingVolumeHierarchy(Scene* pScene, const Features& features);
+    // Constructor. Builds the hierarchy over the meshes [firstMesh, endMesh) of the scene and optionally its spheres,
+    // in the coordinates of those meshes; used for the bottom levels of an InstanceHierarchy.
+    BoundingVolumeHierarchy(Scene* pScene, uint32_t firstMesh, uint32_t endMesh, bool includeSpheres, const Features& features);
+    // Constructor. Loads the hierarchy from cacheFile if it was built for the same scene and build
+    // settings, otherwise builds it and (re)writes cacheFile.
+    BoundingVolumeHierarchy(Scene* pScene, const Features& features, const std::filesystem::path& cacheFile);
 
     // construction helper, returns index of last added node
-    size_t constructorHelper(std::vector<TriangleOrNode>& triangles, size_t left, size_t right, int whichAxis, int level);
-    size_t sahConstructorHelper(std::vector<TriangleOrNode>& triangles, size_t left, size_t right, int whichAxis, int level);
+    size_t constructorHelper(std::vector<Primitive>& triangles, size_t left, size_t right, int whichAxis, int level);
+    size_t sahConstructorHelper(std::vector<Primitive>& triangles, size_t left, size_t right, int whichAxis, int level);
 
+    // Write the nodes and primitives to a binary file, tagged with the scene hash and build settings.
+    bool save(const std::filesystem::path& filePath) const;
+    // Replace the hierarchy by the one stored in filePath. Returns false (and leaves the hierarchy untouched)
+    // if the file does not exist or was built for a different scene or with different build settings.
+    bool load(const std::filesystem::path& filePath, const Features& features);
+
+    // Update the node boxes to the current vertex positions without changing which triangles end up in which
+    // node, e.g. after animating the vertices. Falls back to a full rebuild once the SAH cost of the refitted
+    // hierarchy exceeds BvhSettings::refitRebuildThreshold times the cost it had when it was last built.
+    // Returns true if the hierarchy was rebuilt.
+    bool refit(const Features& features);
+    // Surface area heuristic cost of the hierarchy: the expected number of node visits and triangle tests of a
+    // ray that hits the root box.
+    [[nodiscard]] float sahCost() const;
+    // Node count, SAH cost, leaf histograms, memory footprint and so on (see bvh_statistics.h).
+    [[nodiscard]] BvhStatistics statistics() const;
 
     // Return how many levels there are in the tree that you have constructed.
     [[nodiscard]] int numLevels() const;
@@ -61,12 +96,53 @@ public:
     // Only find hits if they are closer than t stored in the ray and the intersection
     // is on the correct side of the origin (the new t >= 0).
     bool intersect(Ray& ray, HitInfo& hitInfo, const Features& features) const;
+    // Return true if anything is hit closer than t stored in the ray, stopping at the first such hit (which
+    // need not be the closest one). Meant for shadow rays: no shading attributes are computed and nothing
+    // is drawn. Sets ray.t to the distance of the hit and, if it was a triangle, stores it in pOccluder.
+    bool intersectAny(Ray& ray, const Features& features, std::optional<Primitive>* pOccluder = nullptr) const;
+    // Test a single triangle or sphere, e.g. one that blocked a previous shadow ray (see intersectAny()).
+    bool intersectPrimitive(Ray& ray, const Primitive& primitive) const;
+
+    // Changes every time the hierarchy is built, loaded or refitted; results cached for one generation are not valid for another.
+    [[nodiscard]] uint64_t generation() const;
+    // Box around all primitives of the hierarchy.
+    [[nodiscard]] const AxisAlignedBox& bounds() const;
+
+private:
+    void build(const Features& features);
+    void computeStatistics();
+    // Recompute the boxes of nodes (this hierarchy's nodes or a copy of them) from the current vertex positions.
+    void refitBoxes(std::vector<Node>& refittedNodes) const;
 
 private:
     int m_numLevels = 0;
     int m_numLeaves = 0;
     Scene* m_pScene;
-    std::vector<std::vector<AxisAlignedBox>> debugPlanes = std::vector<std::vector<AxisAlignedBox>>(30, std::vector<AxisAlignedBox>());
+    // Primitives covered by the hierarchy: the scene meshes [m_firstMesh, m_endMesh) and possibly the spheres.
+    uint32_t m_firstMesh = 0;
+    uint32_t m_endMesh = 0;
+    bool m_includeSpheres = true;
+    BvhSettings m_settings;
+    bool m_sahBinning = false;
+    uint64_t m_generation = 0;
+    // SAH cost right after the last build or load, to decide when refitting has degraded the hierarchy too much. It
+    // is the cost of the refitted boxes, because spatial splits clip leaf boxes tighter than refit() recomputes them.
+    float m_builtSahCost = 0.0f;
+    // Inner nodes per level, so that refit() can update all nodes of a level in parallel, deepest level first.
+    std::vector<std::vector<uint32_t>> m_innerNodesByLevel;
+    std::vector<std::vector<AxisAlignedBox>> debugPlanes;
 
     std::vector<Node> nodes;
-};
\ No newline at end of file
+    std::vector<Primitive> primitives;
+};
+
+// Every built or loaded hierarchy gets a new generation, so that caches of results that depend on the geometry
+// can tell whether they are still valid.
+uint64_t nextBvhGeneration();
+
+// Hash of all geometry in the scene; a stored hierarchy is only valid for a scene with the same hash.
+uint64_t computeSceneHash(const Scene& scene);
+
+// Centroid of a primitive and the box around a range of primitives, as used by the builders.
+glm::vec3 getMedian(const Primitive& triangle, const Scene& scene);
+AxisAlignedBox getBox(std::vector<Primitive>::const_iterator begin, std::vector<Primitive>::const_iterator end, const Scene& scene);
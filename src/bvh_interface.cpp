@@ -1,38 +1,73 @@
 #include "bvh_interface.h"
 #include "bounding_volume_hierarchy.h"
+#include "bvh_statistics.h"
+#include "instance_hierarchy.h"
+#include "scene.h"
+#include "trace.h"
 
 //! DON'T TOUCH THIS FILE!
 
 BvhInterface::BvhInterface(Scene* pScene, const Features& features)
 {
-    m_impl = new BoundingVolumeHierarchy(pScene, features);
+    const TraceScope traceScope { "Build BVH" };
+    if (!pScene->instances.empty())
+        m_pInstanceHierarchy = std::make_unique<InstanceHierarchy>(pScene, features);
+    else
+        m_impl = std::make_unique<BoundingVolumeHierarchy>(pScene, features);
+}
+
+BvhInterface::BvhInterface(Scene* pScene, const Features& features, const std::filesystem::path& cacheFile)
+{
+    const TraceScope traceScope { "Build BVH" };
+    // Only flat hierarchies are stored; the bottom levels of a two-level hierarchy are cheap to rebuild.
+    if (!pScene->instances.empty())
+        m_pInstanceHierarchy = std::make_unique<InstanceHierarchy>(pScene, features);
+    else
+        m_impl = std::make_unique<BoundingVolumeHierarchy>(pScene, features, cacheFile);
+}
+
+BvhInterface::~BvhInterface() = default;
+BvhInterface::BvhInterface(BvhInterface&&) noexcept = default;
+BvhInterface& BvhInterface::operator=(BvhInterface&&) noexcept = default;
+
+bool BvhInterface::save(const std::filesystem::path& filePath) const
+{
+    return m_impl && m_impl->save(filePath);
 }
 
 // Return the depth of the tree that you constructed. This is used to tell the
 // slider in the UI how many steps it should display for Visual Debug 1.
 int BvhInterface::numLevels() const
 {
-    return m_impl->numLevels();
+    return m_pInstanceHierarchy ? m_pInstanceHierarchy->numLevels() : m_impl->numLevels();
 }
 
 // Return the number of leaf nodes in the tree that you constructed. This is used to tell the
 // slider in the UI how many steps it should display for Visual Debug 2.
 int BvhInterface::numLeaves() const
 {
-    return m_impl->numLeaves();
+    return m_pInstanceHierarchy ? m_pInstanceHierarchy->numLeaves() : m_impl->numLeaves();
 }
 
+BvhStatistics BvhInterface::statistics() const
+{
+    return m_pInstanceHierarchy ? m_pInstanceHierarchy->statistics() : m_impl->statistics();
+}
 
 // Use this function to visualize your BVH. This is useful for debugging. Use the functions in
 // draw.h to draw the various shapes. We have extended the AABB draw functions to support wireframe
 // mode, arbitrary colors and transparency.
 void BvhInterface::debugDrawLevel(int level)
 {
-    m_impl->debugDrawLevel(level);
+    if (m_pInstanceHierarchy)
+        m_pInstanceHierarchy->debugDrawLevel(level);
+    else
+        m_impl->debugDrawLevel(level);
 }
 
 void BvhInterface::debugDrawSahLevel(int level, const Features& features) {
-    m_impl->debugDrawSahLevel(level, features);
+    if (m_impl)
+        m_impl->debugDrawSahLevel(level, features);
 }
 
 
@@ -42,7 +77,10 @@ void BvhInterface::debugDrawSahLevel(int level, const Features& features) {
 // i-th leaf node in the vector.
 void BvhInterface::debugDrawLeaf(int leafIdx)
 {
-    m_impl->debugDrawLeaf(leafIdx);
+    if (m_pInstanceHierarchy)
+        m_pInstanceHierarchy->debugDrawLeaf(leafIdx);
+    else
+        m_impl->debugDrawLeaf(leafIdx);
 }
 
 // Return true if something is hit, returns false otherwise. Only find hits if they are closer than t stored
@@ -51,5 +89,48 @@ void BvhInterface::debugDrawLeaf(int leafIdx)
 // file you like, including bounding_volume_hierarchy.h.
 bool BvhInterface::intersect(Ray& ray, HitInfo& hitInfo, const Features& features) const
 {
+    if (isTraversalCountingEnabled())
+        countRay();
+    if (m_pInstanceHierarchy)
+        return m_pInstanceHierarchy->intersect(ray, hitInfo, features);
     return m_impl->intersect(ray, hitInfo, features);
 }
+
+bool BvhInterface::intersectAny(Ray& ray, const Features& features, std::optional<Primitive>* pOccluder) const
+{
+    const bool hit = m_pInstanceHierarchy ? m_pInstanceHierarchy->intersectAny(ray, features) : m_impl->intersectAny(ray, features, pOccluder);
+    if (isTraversalCountingEnabled())
+        countRay(hit);
+    return hit;
+}
+
+bool BvhInterface::intersectPrimitive(Ray& ray, const Primitive& primitive) const
+{
+    // Two-level hierarchies never report occluders, so there is nothing to test.
+    const bool hit = m_impl && m_impl->intersectPrimitive(ray, primitive);
+    // A cached occluder that still blocks the ray replaces a whole traversal.
+    if (isTraversalCountingEnabled()) {
+        countTraversal(0, 1);
+        if (hit)
+            countRay(true);
+    }
+    return hit;
+}
+
+uint64_t BvhInterface::generation() const
+{
+    return m_pInstanceHierarchy ? m_pInstanceHierarchy->generation() : m_impl->generation();
+}
+
+void BvhInterface::setInstanceTransform(uint32_t instanceIndex, const glm::mat4x3& transform)
+{
+    if (m_pInstanceHierarchy)
+        m_pInstanceHierarchy->setTransform(instanceIndex, transform);
+}
+
+bool BvhInterface::refit(const Features& features)
+{
+    if (m_pInstanceHierarchy)
+        return m_pInstanceHierarchy->refit(features);
+    return m_impl->refit(features);
+}
@@ -1,12 +1,23 @@
 #pragma once
 #include "config.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x3.hpp>
+DISABLE_WARNINGS_POP()
 #include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
 #include <span>
 
 //! DON'T TOUCH THIS FILE! !//
 
 // Forward declaration.
 class BoundingVolumeHierarchy;
+class InstanceHierarchy;
+struct BvhStatistics;
+struct Primitive;
 struct Scene;
 
 class BvhInterface {
@@ -14,6 +25,18 @@ public:
 
     // Constructor. Receives the scene and builds the bounding volume hierarchy
     BvhInterface(Scene* pScene, const Features& features);
+    // Constructor. Loads the bounding volume hierarchy from cacheFile if it matches the scene and build
+    // settings; otherwise builds it and stores it in cacheFile.
+    BvhInterface(Scene* pScene, const Features& features, const std::filesystem::path& cacheFile);
+    // Defined where the hierarchies are complete types. The hierarchy can be moved, but not copied.
+    ~BvhInterface();
+    BvhInterface(BvhInterface&&) noexcept;
+    BvhInterface& operator=(BvhInterface&&) noexcept;
+    BvhInterface(const BvhInterface&) = delete;
+    BvhInterface& operator=(const BvhInterface&) = delete;
+
+    // Store the bounding volume hierarchy in a binary file.
+    bool save(const std::filesystem::path& filePath) const;
 
 
     // Return how many levels there are in the tree that you have constructed.
@@ -24,6 +47,9 @@ public:
     [[nodiscard]] int numLeaves() const;
 
 
+    // Quality and memory footprint of the hierarchy (see bvh_statistics.h).
+    [[nodiscard]] BvhStatistics statistics() const;
+
     // Visual Debug 1: Draw the bounding boxes of the nodes at the selected level.
     void debugDrawLevel(int level);
 
@@ -36,7 +62,23 @@ public:
     // Only find hits if they are closer than t stored in the ray and the intersection
     // is on the correct side of the origin (the new t >= 0).
     bool intersect(Ray& ray, HitInfo& hitInfo, const Features& features) const;
+    // Return true if anything is hit closer than t stored in the ray, stopping at the first hit found.
+    // Faster than intersect() for shadow rays; see BoundingVolumeHierarchy::intersectAny().
+    bool intersectAny(Ray& ray, const Features& features, std::optional<Primitive>* pOccluder = nullptr) const;
+    // Test a single triangle of the scene.
+    bool intersectPrimitive(Ray& ray, const Primitive& primitive) const;
+
+    // Changes whenever the hierarchy is (re)built or loaded.
+    [[nodiscard]] uint64_t generation() const;
+
+    // Move an instance of the scene (see Scene::instances); only the top level of the hierarchy is rebuilt.
+    void setInstanceTransform(uint32_t instanceIndex, const glm::mat4x3& transform);
+    // Update the hierarchy after the vertices of the scene moved, keeping its structure unless that has become
+    // too inefficient (see BoundingVolumeHierarchy::refit()). Returns true if it was rebuilt instead.
+    bool refit(const Features& features);
 
 private:
-    BoundingVolumeHierarchy* m_impl;
+    // Scenes with instances use a two-level hierarchy instead (m_impl is null then).
+    std::unique_ptr<BoundingVolumeHierarchy> m_impl;
+    std::unique_ptr<InstanceHierarchy> m_pInstanceHierarchy;
 };
@@ -0,0 +1,207 @@
+#include "bvh_statistics.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <toml/toml.hpp>
+DISABLE_WARNINGS_POP()
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+std::atomic_int numTraversalCountingScopes { 0 };
+
+static float surfaceArea(const AxisAlignedBox& box)
+{
+    const glm::vec3 extent = glm::max(box.upper - box.lower, 0.0f);
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+BvhStatistics computeBvhStatistics(std::span<const Node> nodes)
+{
+    BvhStatistics statistics;
+    statistics.numNodes = nodes.size();
+    if (nodes.empty())
+        return statistics;
+
+    // Every node is visited with a probability proportional to its surface area; node visits and primitive
+    // tests are weighted equally.
+    float cost = 0.0f, overlap = 0.0f;
+    for (const auto& node : nodes) {
+        statistics.numLevels = std::max(statistics.numLevels, node.level + 1);
+        if (node.isLeaf) {
+            statistics.numLeaves++;
+            cost += surfaceArea(node.box) * float(node.primitiveCount());
+            if (statistics.leafSizeHistogram.size() <= node.primitiveCount())
+                statistics.leafSizeHistogram.resize(node.primitiveCount() + 1);
+            statistics.leafSizeHistogram[node.primitiveCount()]++;
+            if (statistics.leafDepthHistogram.size() <= size_t(node.level))
+                statistics.leafDepthHistogram.resize(size_t(node.level) + 1);
+            statistics.leafDepthHistogram[size_t(node.level)]++;
+        } else {
+            cost += surfaceArea(node.box);
+            const AxisAlignedBox& left = nodes[node.leftChild()].box;
+            const AxisAlignedBox& right = nodes[node.rightChild()].box;
+            overlap += surfaceArea({ glm::max(left.lower, right.lower), glm::min(left.upper, right.upper) });
+        }
+    }
+    const float rootArea = surfaceArea(nodes.back().box);
+    statistics.sahCost = rootArea > 0.0f ? cost / rootArea : 0.0f;
+    statistics.overlap = rootArea > 0.0f ? overlap / rootArea : 0.0f;
+    return statistics;
+}
+
+namespace {
+// Only the owning thread writes its counters, so relaxed loads and stores suffice; they are atomic only so that
+// collectTraversalStatistics() may read them from another thread.
+struct ThreadCounters {
+    struct Counters {
+        std::atomic<uint64_t> rays, nodesVisited, primitivesTested, earlyOuts;
+    };
+    std::array<Counters, numRayTypes> counters {};
+    RayType rayType = RayType::Camera;
+};
+
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadCounters>> registry;
+}
+
+static ThreadCounters& threadCounters()
+{
+    thread_local ThreadCounters* pCounters = [] {
+        std::scoped_lock lock { registryMutex };
+        registry.push_back(std::make_unique<ThreadCounters>());
+        return registry.back().get();
+    }();
+    return *pCounters;
+}
+
+static void add(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+ScopedTraversalCounting::ScopedTraversalCounting(bool enable)
+    : m_enable(enable)
+{
+    if (m_enable)
+        numTraversalCountingScopes.fetch_add(1, std::memory_order_relaxed);
+}
+
+ScopedTraversalCounting::~ScopedTraversalCounting()
+{
+    if (m_enable)
+        numTraversalCountingScopes.fetch_sub(1, std::memory_order_relaxed);
+}
+
+ScopedRayType::ScopedRayType(RayType rayType)
+    : m_previous(threadCounters().rayType)
+{
+    threadCounters().rayType = rayType;
+}
+
+ScopedRayType::~ScopedRayType()
+{
+    threadCounters().rayType = m_previous;
+}
+
+void countTraversal(uint64_t nodesVisited, uint64_t primitivesTested)
+{
+    ThreadCounters& thread = threadCounters();
+    auto& counters = thread.counters[size_t(thread.rayType)];
+    add(counters.nodesVisited, nodesVisited);
+    add(counters.primitivesTested, primitivesTested);
+}
+
+void countRay(bool earlyOut)
+{
+    ThreadCounters& thread = threadCounters();
+    auto& counters = thread.counters[size_t(thread.rayType)];
+    add(counters.rays, 1);
+    add(counters.earlyOuts, earlyOut ? 1 : 0);
+}
+
+static void accumulate(TraversalStatistics& statistics, const ThreadCounters& thread)
+{
+    for (size_t i = 0; i < numRayTypes; i++) {
+        statistics[i].rays += thread.counters[i].rays.load(std::memory_order_relaxed);
+        statistics[i].nodesVisited += thread.counters[i].nodesVisited.load(std::memory_order_relaxed);
+        statistics[i].primitivesTested += thread.counters[i].primitivesTested.load(std::memory_order_relaxed);
+        statistics[i].earlyOuts += thread.counters[i].earlyOuts.load(std::memory_order_relaxed);
+    }
+}
+
+TraversalStatistics threadTraversalStatistics()
+{
+    TraversalStatistics statistics {};
+    accumulate(statistics, threadCounters());
+    return statistics;
+}
+
+TraversalStatistics collectTraversalStatistics()
+{
+    TraversalStatistics statistics {};
+    std::scoped_lock lock { registryMutex };
+    for (const auto& pThread : registry) {
+        accumulate(statistics, *pThread);
+        for (auto& counters : pThread->counters) {
+            counters.rays.store(0, std::memory_order_relaxed);
+            counters.nodesVisited.store(0, std::memory_order_relaxed);
+            counters.primitivesTested.store(0, std::memory_order_relaxed);
+            counters.earlyOuts.store(0, std::memory_order_relaxed);
+        }
+    }
+    return statistics;
+}
+
+template <typename T>
+static toml::array toTomlArray(const std::vector<T>& values)
+{
+    toml::array array;
+    for (const T value : values)
+        array.push_back(int64_t(value));
+    return array;
+}
+
+bool writeStatisticsJson(const std::filesystem::path& filePath, const std::string& sceneName, double buildTimeMs, const BvhStatistics& bvhStatistics,
+    double renderTimeMs, const TraversalStatistics& traversalStatistics)
+{
+    toml::table bvh {
+        { "build_time_ms", buildTimeMs },
+        { "nodes", int64_t(bvhStatistics.numNodes) },
+        { "leaves", int64_t(bvhStatistics.numLeaves) },
+        { "levels", int64_t(bvhStatistics.numLevels) },
+        { "references", int64_t(bvhStatistics.numReferences) },
+        { "memory_bytes", int64_t(bvhStatistics.memoryBytes) },
+        { "sah_cost", double(bvhStatistics.sahCost) },
+        { "overlap", double(bvhStatistics.overlap) },
+        { "leaf_size_histogram", toTomlArray(bvhStatistics.leafSizeHistogram) },
+        { "leaf_depth_histogram", toTomlArray(bvhStatistics.leafDepthHistogram) },
+    };
+
+    constexpr std::array rayTypeNames { "camera", "secondary", "shadow" };
+    toml::table traversal;
+    for (size_t i = 0; i < numRayTypes; i++) {
+        const TraversalCounters& counters = traversalStatistics[i];
+        const double rays = double(std::max(counters.rays, uint64_t(1)));
+        traversal.insert(rayTypeNames[i], toml::table {
+                                              { "rays", int64_t(counters.rays) },
+                                              { "nodes_visited", int64_t(counters.nodesVisited) },
+                                              { "primitives_tested", int64_t(counters.primitivesTested) },
+                                              { "early_outs", int64_t(counters.earlyOuts) },
+                                              { "nodes_per_ray", double(counters.nodesVisited) / rays },
+                                              { "primitives_per_ray", double(counters.primitivesTested) / rays },
+                                          });
+    }
+
+    const toml::table root {
+        { "scene", sceneName },
+        { "render_time_ms", renderTimeMs },
+        { "bvh", std::move(bvh) },
+        { "traversal", std::move(traversal) },
+    };
+    std::ofstream stream { filePath };
+    stream << toml::json_formatter { root } << std::endl;
+    return bool(stream);
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "bounding_volume_hierarchy.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <vector>
+
+// Quality of a built hierarchy, to compare builders and catch regressions in tree quality.
+struct BvhStatistics {
+    size_t numNodes = 0;
+    size_t numLeaves = 0;
+    int numLevels = 0;
+    size_t numReferences = 0; // Primitives stored in the leaves; more than the scene has if builders duplicate them.
+    size_t memoryBytes = 0; // Nodes and primitive references, including the bottom levels of a two-level hierarchy.
+    // Expected node visits and primitive tests of a ray that hits the root box (see BoundingVolumeHierarchy::sahCost()).
+    float sahCost = 0.0f;
+    // Summed surface area of the overlap between the two children of every inner node, relative to the root. Rays
+    // through overlapping space have to visit both children.
+    float overlap = 0.0f;
+    std::vector<size_t> leafSizeHistogram; // Number of leaves per primitive count.
+    std::vector<size_t> leafDepthHistogram; // Number of leaves per level.
+};
+
+// Statistics of a hierarchy stored as in BoundingVolumeHierarchy: root last, leaves counting primitives. Only
+// numReferences and memoryBytes are left for the caller.
+[[nodiscard]] BvhStatistics computeBvhStatistics(std::span<const Node> nodes);
+
+// The work done by BVH traversals is counted while any ScopedTraversalCounting object that enables it exists, so that
+// renders running at the same time (e.g. cost heatmaps of several cameras) cannot switch it off for each other.
+class ScopedTraversalCounting {
+public:
+    explicit ScopedTraversalCounting(bool enable = true);
+    ~ScopedTraversalCounting();
+    ScopedTraversalCounting(const ScopedTraversalCounting&) = delete;
+    ScopedTraversalCounting& operator=(const ScopedTraversalCounting&) = delete;
+
+private:
+    bool m_enable;
+};
+
+extern std::atomic_int numTraversalCountingScopes;
+inline bool isTraversalCountingEnabled()
+{
+    return numTraversalCountingScopes.load(std::memory_order_relaxed) > 0;
+}
+
+enum class RayType {
+    Camera,
+    Secondary, // Reflected and transmitted rays.
+    Shadow,
+};
+inline constexpr size_t numRayTypes = 3;
+
+struct TraversalCounters {
+    uint64_t rays = 0; // intersect() and intersectAny() queries.
+    uint64_t nodesVisited = 0;
+    uint64_t primitivesTested = 0;
+    uint64_t earlyOuts = 0; // Shadow rays that stopped at the first occluder found (or at a cached occluder).
+};
+using TraversalStatistics = std::array<TraversalCounters, numRayTypes>;
+
+// Rays traced by this thread count as the given type until the object is destroyed.
+class ScopedRayType {
+public:
+    explicit ScopedRayType(RayType rayType);
+    ~ScopedRayType();
+    ScopedRayType(const ScopedRayType&) = delete;
+    ScopedRayType& operator=(const ScopedRayType&) = delete;
+
+private:
+    RayType m_previous;
+};
+
+// Called by the hierarchies when counting is enabled. Every thread counts into its own counters.
+void countTraversal(uint64_t nodesVisited, uint64_t primitivesTested);
+void countRay(bool earlyOut = false);
+
+// Work of a single traversal, passed to countTraversal() (if enabled) when it goes out of scope.
+struct TraversalCount {
+    uint64_t nodesVisited = 0;
+    uint64_t primitivesTested = 0;
+
+    ~TraversalCount()
+    {
+        if (isTraversalCountingEnabled())
+            countTraversal(nodesVisited, primitivesTested);
+    }
+};
+
+// Counters of the calling thread; the difference between two calls is the work done in between (unless
+// collectTraversalStatistics() reset them meanwhile).
+[[nodiscard]] TraversalStatistics threadTraversalStatistics();
+// Sum of the counters of all threads, after which they are reset.
+[[nodiscard]] TraversalStatistics collectTraversalStatistics();
+
+// Write the statistics of a render as JSON. Returns false if the file could not be written.
+bool writeStatisticsJson(const std::filesystem::path& filePath, const std::string& sceneName, double buildTimeMs, const BvhStatistics& bvhStatistics,
+    double renderTimeMs, const TraversalStatistics& traversalStatistics);
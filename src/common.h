@@ -38,11 +38,15 @@ struct Sphere {
 struct PointLight {
     glm::vec3 position;
     glm::vec3 color;
+
+    bool operator==(const PointLight&) const = default;
 };
 
 struct SegmentLight {
     glm::vec3 endpoint0, endpoint1; // Positions of endpoints
     glm::vec3 color0, color1; // Color of endpoints
+
+    bool operator==(const SegmentLight&) const = default;
 };
 
 struct ParallelogramLight {
@@ -50,6 +54,8 @@ struct ParallelogramLight {
     glm::vec3 v0; // v0
     glm::vec3 edge01, edge02; // edges from v0 to v1, and from v0 to v2
     glm::vec3 color0, color1, color2, color3;
+
+    bool operator==(const ParallelogramLight&) const = default;
 };
 
 struct ExtraFeatures {
@@ -63,6 +69,45 @@ struct ExtraFeatures {
     bool enableGlossyReflection = false;
     bool enableTransparency = false;
     bool enableDepthOfField = false;
+    // Light the scene by the environment map, sampling it by importance.
+    bool enableImageBasedLighting = false;
+    int environmentLightSamples = 16; // Shadow rays towards the environment per shaded point.
+    // Evaluate a few lights per shaded point, picked by their estimated contribution, instead of all of them.
+    bool enableLightSampling = false;
+    int lightSamples = 4; // Lights evaluated per shaded point.
+    // Test the triangle that blocked the previous shadow ray towards a light before traversing the BVH.
+    bool enableOccluderCache = false;
+    // Answer shadow rays of point lights from a lazily traced cube map of occluder distances (approximate).
+    bool enableShadowMapCache = false;
+    int shadowMapResolution = 256; // Texels per side of each cube face.
+
+    bool operator==(const ExtraFeatures&) const = default;
+};
+
+enum class BvhBuildQuality {
+    Full, // Recursive splits at the median centroid, or at the best SAH split plane if SAH binning is enabled.
+    Fast, // Linear BVH from Morton codes: builds much faster, traces slower.
+    High, // SAH object splits and spatial splits that clip large triangles: builds slower, traces faster.
+};
+
+// What the per-pixel cost heatmap of renderRayTracing() measures.
+enum class CostMetric {
+    Time, // Timestamp counter ticks spent on the pixel.
+    Nodes, // BVH nodes visited by all rays of the pixel, including shadow and secondary rays.
+    Primitives, // Triangles and spheres tested by all rays of the pixel.
+};
+
+// Parameters of the BVH builders. A stored BVH is only reused if it was built with the same settings.
+struct BvhSettings {
+    BvhBuildQuality buildQuality = BvhBuildQuality::Full;
+    int optimizationPasses = 0; // Passes of tree rotations after a fast build.
+    float spatialSplitMemoryFactor = 1.5f; // A high quality build stores at most this many references per primitive.
+    int binCount = 5; // Number of candidate split planes evaluated per node when SAH binning is enabled.
+    int leafSize = 1; // Nodes with at most this many triangles become leaves.
+    int maxDepth = 16; // Nodes below this level become leaves.
+    float refitRebuildThreshold = 1.5f; // Refitting rebuilds instead once the SAH cost grew by this factor since the last build.
+
+    bool operator==(const BvhSettings&) const = default;
 };
 
 struct Features {
@@ -77,4 +122,7 @@ struct Features {
     bool enableDraw = false;
 
     ExtraFeatures extra;
+    BvhSettings bvh;
+
+    bool operator==(const Features&) const = default;
 };
\ No newline at end of file
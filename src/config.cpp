@@ -5,11 +5,15 @@ DISABLE_WARNINGS_PUSH()
 #define TOML_EXCEPTIONS 0
 
 #include <toml/toml.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/mat4x4.hpp>
 
 DISABLE_WARNINGS_POP()
 
 #include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <cstring>
 #include <iostream>
 
 // Helper function to print SceneType
@@ -60,6 +64,40 @@ static std::ostream& operator<<(std::ostream& os, const SceneType& sceneType)
     return os;
 }
 
+// Helper function to print a BVH build quality, as spelled in the configuration file.
+static std::ostream& operator<<(std::ostream& os, const BvhBuildQuality& buildQuality)
+{
+    switch (buildQuality) {
+    case BvhBuildQuality::Full:
+        os << "full";
+        break;
+    case BvhBuildQuality::Fast:
+        os << "fast";
+        break;
+    case BvhBuildQuality::High:
+        os << "high";
+        break;
+    }
+    return os;
+}
+
+// Helper function to print a cost metric, as spelled in the configuration file.
+static std::ostream& operator<<(std::ostream& os, const CostMetric& costMetric)
+{
+    switch (costMetric) {
+    case CostMetric::Time:
+        os << "time";
+        break;
+    case CostMetric::Nodes:
+        os << "nodes";
+        break;
+    case CostMetric::Primitives:
+        os << "primitives";
+        break;
+    }
+    return os;
+}
+
 // Helper function to print a glm::vec3.
 static std::ostream& operator<<(std::ostream& os, const glm::vec3& vec3)
 {
@@ -84,6 +122,21 @@ std::ostream& operator<<(std::ostream& os, const Config& config)
     }
 
     os << "  + output_filepath: " << config.outputDir << std::endl
+       << "  + cache_dir: " << config.cacheDir << std::endl
+       << "  + write_statistics: " << config.writeStatistics << std::endl
+       << "  + cost_heatmap: ";
+    if (config.costHeatmap) {
+        os << *config.costHeatmap << std::endl;
+    } else {
+        os << "none" << std::endl;
+    }
+    os << "  + trace_file: " << config.traceFile << std::endl
+       << "  + output_file: " << config.outputFile << std::endl
+       << "  + time_budget_ms: " << config.timeBudgetMs << std::endl;
+    os << "  + texture_layout: " << (config.textureLayout == Image::Layout::Tiled ? "tiled" : "row_major") << std::endl
+       << "  + texture_cache_budget_mb: " << (config.textureCacheBudget >> 20) << std::endl
+       << "  + environment_map: " << config.environmentMap << std::endl
+       << "  + environment_map_layout: " << (config.environmentMapLayout == EnvironmentMap::Layout::LatLong ? "lat_long" : "cross") << std::endl
        << "  + features: " << std::endl
        << "    - enable_shading: " << config.features.enableShading << std::endl
        << "    - enable_recursive: " << config.features.enableRecursive << std::endl
@@ -111,6 +164,22 @@ std::ostream& operator<<(std::ostream& os, const Config& config)
     os << "    - enable_environment_mapping: " << config.features.extra.enableEnvironmentMapping << std::endl;
     os << "    - enable_bilinear_texture_filtering: " << config.features.extra.enableBilinearTextureFiltering << std::endl;
     os << "    - enable_mipmap_texture_filtering: " << config.features.extra.enableMipmapTextureFiltering << std::endl;
+    os << "    - enable_image_based_lighting: " << config.features.extra.enableImageBasedLighting << std::endl;
+    os << "    - environment_light_samples: " << config.features.extra.environmentLightSamples << std::endl;
+    os << "    - enable_light_sampling: " << config.features.extra.enableLightSampling << std::endl;
+    os << "    - light_samples: " << config.features.extra.lightSamples << std::endl;
+    os << "    - enable_occluder_cache: " << config.features.extra.enableOccluderCache << std::endl;
+    os << "    - enable_shadow_map_cache: " << config.features.extra.enableShadowMapCache << std::endl;
+    os << "    - shadow_map_resolution: " << config.features.extra.shadowMapResolution << std::endl;
+
+    os << "  + bvh: " << std::endl
+       << "    - build_quality: " << config.features.bvh.buildQuality << std::endl
+       << "    - optimization_passes: " << config.features.bvh.optimizationPasses << std::endl
+       << "    - spatial_split_memory_factor: " << config.features.bvh.spatialSplitMemoryFactor << std::endl
+       << "    - bin_count: " << config.features.bvh.binCount << std::endl
+       << "    - leaf_size: " << config.features.bvh.leafSize << std::endl
+       << "    - max_depth: " << config.features.bvh.maxDepth << std::endl
+       << "    - refit_rebuild_threshold: " << config.features.bvh.refitRebuildThreshold << std::endl;
 
     os << "  + cameras: " << std::endl;
     for (const auto& camera: config.cameras) {
@@ -120,6 +189,14 @@ std::ostream& operator<<(std::ostream& os, const Config& config)
            << "      rotation: " << camera.rotation << std::endl;
     }
 
+    os << "  + instances: " << std::endl;
+    for (const auto& instance : config.instances) {
+        os << "    - mesh: " << instance.mesh << std::endl
+           << "      translation: " << instance.translation << std::endl
+           << "      rotation: " << instance.rotation << std::endl
+           << "      scale: " << instance.scale << std::endl;
+    }
+
     os << "  + lights: " << std::endl;
 
     for (const auto& elem : config.lights) {
@@ -147,22 +224,22 @@ std::ostream& operator<<(std::ostream& os, const Config& config)
 // Helper function to parse a glm::vec3 from a toml::array
 std::optional<glm::vec3> tomlArrayToVec3(const toml::array* array)
 {
+    if (!array)
+        return {};
     glm::vec3 output {};
 
-    if (array) {
-        int i = 0;
-        array->for_each([&](auto&& elem) {
-            if (elem.is_number()) {
-                if (i > 2)
-                    return;
-                output[i] = static_cast<float>(elem.as_floating_point()->get());
-                i += 1;
-            } else {
-                std::cerr << "Error: Expected a number in array, got " << elem.type() << std::endl;
+    int i = 0;
+    array->for_each([&](auto&& elem) {
+        if (elem.is_number()) {
+            if (i > 2)
                 return;
-            }
-        });
-    }
+            output[i] = elem.is_integer() ? static_cast<float>(elem.as_integer()->get()) : static_cast<float>(elem.as_floating_point()->get());
+            i += 1;
+        } else {
+            std::cerr << "Error: Expected a number in array, got " << elem.type() << std::endl;
+            return;
+        }
+    });
 
     return output;
 }
@@ -170,39 +247,32 @@ std::optional<glm::vec3> tomlArrayToVec3(const toml::array* array)
 // Helper function to parse a glm::ivec2 from a toml::array
 std::optional<glm::ivec2> tomlArrayToIVec2(const toml::array* array)
 {
+    if (!array)
+        return {};
     glm::ivec2 output {};
 
-    if (array) {
-        int i = 0;
-        array->for_each([&](auto&& elem) {
-            if (elem.is_integer()) {
-                if (i > 1)
-                    return;
-                output[i] = static_cast<int>(elem.as_integer()->get());
-                i += 1;
-            } else {
-                std::cerr << "Error: Expected an integer in array, got " << elem.type() << std::endl;
+    int i = 0;
+    array->for_each([&](auto&& elem) {
+        if (elem.is_integer()) {
+            if (i > 1)
                 return;
-            }
-        });
-    }
+            output[i] = static_cast<int>(elem.as_integer()->get());
+            i += 1;
+        } else {
+            std::cerr << "Error: Expected an integer in array, got " << elem.type() << std::endl;
+            return;
+        }
+    });
 
     return output;
 }
 
-Config readConfigFile(const std::filesystem::path& config_path)
+// Keys that are left out keep their default. Returns std::nullopt, and sets error, if the scene does not exist.
+static std::optional<Config> parseConfig(const toml::table& table, std::string& error)
 {
     Config config = {};
 
-    toml::parse_result result = toml::parse_file(config_path.string());
-    if (!result) {
-        std::cerr << "Failed parsing " << config_path << ":\n"
-                  << result.error() << "\n";
-    }
-
-    const auto& table = result.table();
-
-    config.cliRenderingEnabled = table["command_line_rendering"].as_boolean()->value_or(true);
+    config.cliRenderingEnabled = table["command_line_rendering"].value_or(true);
 
     config.windowSize = tomlArrayToIVec2(table["window_size"].as_array())
                             .value_or(glm::ivec2(800, 800));
@@ -228,15 +298,14 @@ Config readConfigFile(const std::filesystem::path& config_path)
             if (std::filesystem::exists(path)) {
                 config.scene = path;
             } else {
-                std::cerr << "Error: Scene file " << path << " does not exist." << std::endl;
-                exit(1);
+                error = "Scene file " + path.string() + " does not exist.";
+                return {};
             }
         }
     }
 
     std::string output_dir = table["output_dir"].value<std::string>().value_or("");
     if (output_dir.empty()) {
-        std::cout << "Warning: No output directory specified, using current directory." << std::endl;
         config.outputDir = std::filesystem::current_path();
     } else {
 
@@ -254,24 +323,57 @@ Config readConfigFile(const std::filesystem::path& config_path)
         config.outputDir = std::filesystem::absolute(std::filesystem::path(output_dir));
     }
 
-    config.features.enableShading = table["features"]["enable_shading"]
-                                .as_boolean()
-                                ->value_or(false);
-    config.features.enableRecursive = table["features"]["enable_recursive"]
-                                  .as_boolean()
-                                  ->value_or(false);
-    config.features.enableHardShadow = table["features"]["enable_hard_shadow"]
-                                    .as_boolean()
-                                    ->value_or(false);
-    config.features.enableNormalInterp = table["features"]["enable_normal_interp"]
-                                     .as_boolean()
-                                     ->value_or(false);
-    config.features.enableTextureMapping = table["features"]["enable_texture_mapping"]
-                                       .as_boolean()
-                                       ->value_or(false);
-    config.features.enableAccelStructure = table["features"]["enable_accel_structure"]
-                                       .as_boolean()
-                                       ->value_or(false);
+    std::string cache_dir = table["cache_dir"].value<std::string>().value_or("");
+    if (!cache_dir.empty()) {
+        config.cacheDir = std::filesystem::absolute(std::filesystem::path(cache_dir));
+    }
+    config.writeStatistics = table["write_statistics"].value_or(false);
+
+    const std::string trace_file = table["trace_file"].value<std::string>().value_or("");
+    if (!trace_file.empty()) {
+        config.traceFile = std::filesystem::absolute(std::filesystem::path(trace_file));
+    }
+
+    const std::string output_file = table["output_file"].value<std::string>().value_or("");
+    if (!output_file.empty()) {
+        config.outputFile = std::filesystem::absolute(std::filesystem::path(output_file));
+    }
+    config.timeBudgetMs = std::max(table["time_budget_ms"].value_or(0.0f), 0.0f);
+
+    const std::string cost_heatmap = table["cost_heatmap"].value<std::string>().value_or("none");
+    if (cost_heatmap == "time") {
+        config.costHeatmap = CostMetric::Time;
+    } else if (cost_heatmap == "nodes") {
+        config.costHeatmap = CostMetric::Nodes;
+    } else if (cost_heatmap == "primitives") {
+        config.costHeatmap = CostMetric::Primitives;
+    } else if (cost_heatmap != "none") {
+        std::cerr << "Warning: Unknown cost heatmap \"" << cost_heatmap << "\", using none." << std::endl;
+    }
+
+    const std::string texture_layout = table["texture_layout"].value<std::string>().value_or("row_major");
+    if (texture_layout == "tiled") {
+        config.textureLayout = Image::Layout::Tiled;
+    } else if (texture_layout != "row_major") {
+        std::cerr << "Warning: Unknown texture layout \"" << texture_layout << "\", using row_major." << std::endl;
+    }
+    config.textureCacheBudget = size_t(std::max<int64_t>(table["texture_cache_budget_mb"].value_or(int64_t(config.textureCacheBudget >> 20)), 0)) << 20;
+
+    // Relative paths are relative to the data directory.
+    config.environmentMap = config.dataPath / table["environment_map"].value<std::string>().value_or("cube_map.jpg");
+    const std::string environment_map_layout = table["environment_map_layout"].value<std::string>().value_or("cross");
+    if (environment_map_layout == "lat_long") {
+        config.environmentMapLayout = EnvironmentMap::Layout::LatLong;
+    } else if (environment_map_layout != "cross") {
+        std::cerr << "Warning: Unknown environment map layout \"" << environment_map_layout << "\", using cross." << std::endl;
+    }
+
+    config.features.enableShading = table["features"]["enable_shading"].value_or(false);
+    config.features.enableRecursive = table["features"]["enable_recursive"].value_or(false);
+    config.features.enableHardShadow = table["features"]["enable_hard_shadow"].value_or(false);
+    config.features.enableNormalInterp = table["features"]["enable_normal_interp"].value_or(false);
+    config.features.enableTextureMapping = table["features"]["enable_texture_mapping"].value_or(false);
+    config.features.enableAccelStructure = table["features"]["enable_accel_structure"].value_or(false);
 
     if (table["features"]["extra"]["enable_bloom_effect"]) {
         config.features.extra.enableBloomEffect = table["features"]["extra"]["enable_bloom_effect"]
@@ -313,18 +415,78 @@ Config readConfigFile(const std::filesystem::path& config_path)
                                                                  .as_boolean()
                                                                  ->value_or(false);
     }
+    if (table["features"]["extra"]["enable_image_based_lighting"]) {
+        config.features.extra.enableImageBasedLighting = table["features"]["extra"]["enable_image_based_lighting"]
+                                                             .as_boolean()
+                                                             ->value_or(false);
+    }
+    config.features.extra.environmentLightSamples = static_cast<int>(table["features"]["extra"]["environment_light_samples"].value_or(int64_t(config.features.extra.environmentLightSamples)));
+    if (table["features"]["extra"]["enable_light_sampling"]) {
+        config.features.extra.enableLightSampling = table["features"]["extra"]["enable_light_sampling"]
+                                                        .as_boolean()
+                                                        ->value_or(false);
+    }
+    config.features.extra.lightSamples = static_cast<int>(table["features"]["extra"]["light_samples"].value_or(int64_t(config.features.extra.lightSamples)));
+    if (table["features"]["extra"]["enable_occluder_cache"]) {
+        config.features.extra.enableOccluderCache = table["features"]["extra"]["enable_occluder_cache"]
+                                                        .as_boolean()
+                                                        ->value_or(false);
+    }
+    if (table["features"]["extra"]["enable_shadow_map_cache"]) {
+        config.features.extra.enableShadowMapCache = table["features"]["extra"]["enable_shadow_map_cache"]
+                                                         .as_boolean()
+                                                         ->value_or(false);
+    }
+    config.features.extra.shadowMapResolution = static_cast<int>(table["features"]["extra"]["shadow_map_resolution"].value_or(int64_t(config.features.extra.shadowMapResolution)));
+
+    const std::string build_quality = table["bvh"]["build_quality"].value<std::string>().value_or("full");
+    if (build_quality == "fast") {
+        config.features.bvh.buildQuality = BvhBuildQuality::Fast;
+    } else if (build_quality == "high") {
+        config.features.bvh.buildQuality = BvhBuildQuality::High;
+    } else if (build_quality != "full") {
+        std::cerr << "Warning: Unknown BVH build quality \"" << build_quality << "\", using full." << std::endl;
+    }
+    config.features.bvh.optimizationPasses = static_cast<int>(table["bvh"]["optimization_passes"].value_or(int64_t(config.features.bvh.optimizationPasses)));
+    config.features.bvh.spatialSplitMemoryFactor = static_cast<float>(table["bvh"]["spatial_split_memory_factor"].value<double>().value_or(config.features.bvh.spatialSplitMemoryFactor));
+    config.features.bvh.binCount = static_cast<int>(table["bvh"]["bin_count"].value_or(int64_t(config.features.bvh.binCount)));
+    config.features.bvh.leafSize = static_cast<int>(table["bvh"]["leaf_size"].value_or(int64_t(config.features.bvh.leafSize)));
+    config.features.bvh.maxDepth = static_cast<int>(table["bvh"]["max_depth"].value_or(int64_t(config.features.bvh.maxDepth)));
+    config.features.bvh.refitRebuildThreshold = static_cast<float>(table["bvh"]["refit_rebuild_threshold"].value<double>().value_or(config.features.bvh.refitRebuildThreshold));
 
     const toml::array* cameras = table["cameras"].as_array();
     if (cameras) {
         cameras->for_each([&](auto&& camera) {
-            float fieldOfView = camera.at_path("field_of_view").as_floating_point()->value_or(50.0f);
-            float distanceFromLookAt = camera.at_path("distance_from_look_at").as_floating_point()->value_or(3.0f);
+            float fieldOfView = camera.at_path("field_of_view").value_or(50.0f);
+            float distanceFromLookAt = camera.at_path("distance_from_look_at").value_or(3.0f);
             glm::vec3 look_at = tomlArrayToVec3(camera.at_path("look_at").as_array()).value_or(glm::vec3(0.0f));
             glm::vec3 rotation = tomlArrayToVec3(camera.at_path("rotation").as_array()).value_or(glm::vec3(20.0f, 20.0f, 0.0f));
             config.cameras.emplace_back(CameraConfig { fieldOfView, distanceFromLookAt, look_at, rotation });
         });
     }
 
+    // Mesh paths are relative to the data directory.
+    const toml::array* instances = table["instances"].as_array();
+    if (instances) {
+        instances->for_each([&](auto&& instance) {
+            const std::string mesh = instance.at_path("mesh").value_or(std::string {});
+            if (mesh.empty()) {
+                std::cerr << "Instance without mesh -- Skip" << std::endl;
+                return;
+            }
+            InstanceConfig instanceConfig { .mesh = config.dataPath / mesh };
+            // Keys that are left out keep their default.
+            const auto readVec3 = [&](const char* key, glm::vec3& value) {
+                if (const toml::array* array = instance.at_path(key).as_array())
+                    value = tomlArrayToVec3(array).value_or(value);
+            };
+            readVec3("translation", instanceConfig.translation);
+            readVec3("rotation", instanceConfig.rotation);
+            readVec3("scale", instanceConfig.scale);
+            config.instances.push_back(instanceConfig);
+        });
+    }
+
     const toml::array* lights = table["lights"].as_array();
     if (lights) {
         lights->for_each([&](auto&& light) {
@@ -365,14 +527,277 @@ Config readConfigFile(const std::filesystem::path& config_path)
                 std::cerr << "Unknown light type: " << type << " -- Skip" << std::endl;
             }
         });
-    } else {
-        std::cerr << "WARN: No lights found in config file.\n";
-        config.lights = {};
     }
 
     return std::move(config);
 }
 
+Config readConfigFile(const std::filesystem::path& config_path)
+{
+    toml::parse_result result = toml::parse_file(config_path.string());
+    if (!result) {
+        std::cerr << "Failed parsing " << config_path << ":\n"
+                  << result.error() << "\n";
+    }
+
+    const auto& table = result.table();
+    if (table["output_dir"].value_or(std::string {}).empty())
+        std::cout << "Warning: No output directory specified, using current directory." << std::endl;
+    if (!table["lights"].is_array())
+        std::cerr << "WARN: No lights found in config file.\n";
+
+    std::string error;
+    std::optional<Config> config = parseConfig(table, error);
+    if (!config) {
+        std::cerr << "Error: " << error << std::endl;
+        exit(1);
+    }
+    return std::move(*config);
+}
+
+namespace {
+// Reads JSON into the equivalent TOML nodes, so that JSON configurations share the parsing of TOML files. Nulls
+// are left out, so that they read as defaults.
+class JsonParser {
+public:
+    explicit JsonParser(std::string_view text)
+        : m_text(text)
+    {
+    }
+
+    std::optional<toml::table> parse(std::string& error)
+    {
+        toml::table table;
+        skipWhitespace();
+        if (!parseObject(table, 0) || (skipWhitespace(), m_position != m_text.size())) {
+            error = m_error.empty() ? "Unexpected character" : m_error;
+            error += " at offset " + std::to_string(m_position) + " of the JSON.";
+            return {};
+        }
+        return table;
+    }
+
+private:
+    static constexpr int maxDepth = 64;
+
+    void skipWhitespace()
+    {
+        while (m_position < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_position])))
+            m_position++;
+    }
+
+    bool consume(char c)
+    {
+        skipWhitespace();
+        if (m_position >= m_text.size() || m_text[m_position] != c)
+            return false;
+        m_position++;
+        return true;
+    }
+
+    bool consume(std::string_view literal)
+    {
+        if (!m_text.substr(m_position).starts_with(literal))
+            return false;
+        m_position += literal.size();
+        return true;
+    }
+
+    // Calls insert with the value, or not at all for null.
+    template <typename Insert>
+    bool parseValue(Insert&& insert, int depth)
+    {
+        skipWhitespace();
+        if (depth > maxDepth || m_position >= m_text.size()) {
+            m_error = depth > maxDepth ? "Nested too deeply" : "Unexpected end";
+            return false;
+        }
+        const char c = m_text[m_position];
+        if (c == '{') {
+            toml::table table;
+            if (!parseObject(table, depth + 1))
+                return false;
+            insert(std::move(table));
+        } else if (c == '[') {
+            toml::array array;
+            if (!parseArray(array, depth + 1))
+                return false;
+            insert(std::move(array));
+        } else if (c == '"') {
+            std::string string;
+            if (!parseString(string))
+                return false;
+            insert(std::move(string));
+        } else if (consume("true")) {
+            insert(true);
+        } else if (consume("false")) {
+            insert(false);
+        } else if (!consume("null")) {
+            return parseNumber(insert);
+        }
+        return true;
+    }
+
+    bool parseObject(toml::table& table, int depth)
+    {
+        if (!consume('{'))
+            return false;
+        if (consume('}'))
+            return true;
+        do {
+            std::string key;
+            skipWhitespace();
+            if (!parseString(key) || !consume(':'))
+                return false;
+            if (!parseValue([&](auto&& value) { table.insert_or_assign(key, std::forward<decltype(value)>(value)); }, depth))
+                return false;
+        } while (consume(','));
+        return consume('}');
+    }
+
+    bool parseArray(toml::array& array, int depth)
+    {
+        if (!consume('['))
+            return false;
+        if (consume(']'))
+            return true;
+        do {
+            if (!parseValue([&](auto&& value) { array.push_back(std::forward<decltype(value)>(value)); }, depth))
+                return false;
+        } while (consume(','));
+        return consume(']');
+    }
+
+    bool parseString(std::string& string)
+    {
+        if (m_position >= m_text.size() || m_text[m_position] != '"')
+            return false;
+        for (m_position++; m_position < m_text.size(); m_position++) {
+            const char c = m_text[m_position];
+            if (c == '"') {
+                m_position++;
+                return true;
+            } else if (c != '\\') {
+                string += c;
+                continue;
+            }
+            if (++m_position >= m_text.size())
+                break;
+            switch (m_text[m_position]) {
+            case 'b':
+                string += '\b';
+                break;
+            case 'f':
+                string += '\f';
+                break;
+            case 'n':
+                string += '\n';
+                break;
+            case 'r':
+                string += '\r';
+                break;
+            case 't':
+                string += '\t';
+                break;
+            case 'u': {
+                uint32_t codePoint;
+                if (!parseHex(codePoint))
+                    return false;
+                // Characters outside the basic multilingual plane are written as a pair of surrogates.
+                if (codePoint >= 0xD800 && codePoint < 0xDC00 && m_text.substr(m_position + 1).starts_with("\\u")) {
+                    uint32_t low;
+                    m_position += 2;
+                    if (!parseHex(low) || low < 0xDC00 || low >= 0xE000)
+                        return false;
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                appendUtf8(string, codePoint);
+                break;
+            }
+            default:
+                string += m_text[m_position];
+            }
+        }
+        m_error = "Unterminated string";
+        return false;
+    }
+
+    // Reads the four hexadecimal digits after the current position, leaving the position at the last one.
+    bool parseHex(uint32_t& value)
+    {
+        const std::string_view digits = m_text.substr(m_position + 1, 4);
+        if (digits.size() != 4 || std::from_chars(digits.data(), digits.data() + 4, value, 16).ptr != digits.data() + 4) {
+            m_error = "Invalid escape";
+            return false;
+        }
+        m_position += 4;
+        return true;
+    }
+
+    static void appendUtf8(std::string& string, uint32_t codePoint)
+    {
+        if (codePoint < 0x80) {
+            string += char(codePoint);
+        } else if (codePoint < 0x800) {
+            string += char(0xC0 | (codePoint >> 6));
+            string += char(0x80 | (codePoint & 0x3F));
+        } else if (codePoint < 0x10000) {
+            string += char(0xE0 | (codePoint >> 12));
+            string += char(0x80 | ((codePoint >> 6) & 0x3F));
+            string += char(0x80 | (codePoint & 0x3F));
+        } else {
+            string += char(0xF0 | (codePoint >> 18));
+            string += char(0x80 | ((codePoint >> 12) & 0x3F));
+            string += char(0x80 | ((codePoint >> 6) & 0x3F));
+            string += char(0x80 | (codePoint & 0x3F));
+        }
+    }
+
+    // Numbers without a fraction or exponent become integers, like in TOML.
+    template <typename Insert>
+    bool parseNumber(Insert&& insert)
+    {
+        const char* first = m_text.data() + m_position;
+        const char* last = m_text.data() + m_text.size();
+        int64_t integer;
+        double floatingPoint;
+        if (const auto [ptr, ec] = std::from_chars(first, last, integer); ec == std::errc() && (ptr == last || !std::strchr(".eE", *ptr))) {
+            m_position += size_t(ptr - first);
+            insert(integer);
+        } else if (const auto [ptr, ec] = std::from_chars(first, last, floatingPoint); ec == std::errc()) {
+            m_position += size_t(ptr - first);
+            insert(floatingPoint);
+        } else {
+            m_error = "Invalid value";
+            return false;
+        }
+        return true;
+    }
+
+    std::string_view m_text;
+    size_t m_position = 0;
+    std::string m_error;
+};
+}
+
+std::optional<Config> readConfigJson(std::string_view json, std::string& error)
+{
+    std::optional<toml::table> table = JsonParser { json }.parse(error);
+    if (!table)
+        return {};
+    return parseConfig(*table, error);
+}
+
+InstanceDescription describeInstance(const InstanceConfig& instance)
+{
+    glm::mat4 transform = glm::translate(glm::mat4(1.0f), instance.translation);
+    transform = glm::rotate(transform, glm::radians(instance.rotation.z), glm::vec3(0, 0, 1));
+    transform = glm::rotate(transform, glm::radians(instance.rotation.y), glm::vec3(0, 1, 0));
+    transform = glm::rotate(transform, glm::radians(instance.rotation.x), glm::vec3(1, 0, 0));
+    transform = glm::scale(transform, instance.scale);
+    return { instance.mesh, glm::mat4x3(transform) };
+}
+
 std::string serialize(const SceneType& sceneType)
 {
     switch (sceneType) {
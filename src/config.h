@@ -1,4 +1,5 @@
 #pragma once
+#include "environment_map.h"
 #include "scene.h"
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
@@ -8,6 +9,8 @@ DISABLE_WARNINGS_POP()
 #include <filesystem>
 #include <iosfwd>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -20,6 +23,14 @@ struct CameraConfig {
     glm::vec3 rotation = { 20.0f, 20.0f, 0.0f }; // in degrees
 };
 
+// Instances of the meshes in a file, placed by scaling, then rotating and then translating them.
+struct InstanceConfig {
+    std::filesystem::path mesh;
+    glm::vec3 translation = { 0.0f, 0.0f, 0.0f };
+    glm::vec3 rotation = { 0.0f, 0.0f, 0.0f }; // in degrees, about x, then y, then z
+    glm::vec3 scale = { 1.0f, 1.0f, 1.0f };
+};
+
 struct Config {
     Features features = {};
 
@@ -28,13 +39,40 @@ struct Config {
     std::filesystem::path dataPath = DATA_DIR;
     std::variant<SceneType, std::filesystem::path> scene = SceneType::SingleTriangle;
     std::filesystem::path outputDir = "";
+    // Directory for binary copies of loaded meshes; caching is disabled when empty.
+    std::filesystem::path cacheDir = "";
+    // Write BVH and traversal statistics of the render to a JSON file next to the images (CLI only).
+    bool writeStatistics = false;
+    // Also write a false-color image of the cost of every pixel next to each rendered image (CLI only).
+    std::optional<CostMetric> costHeatmap;
+    // Record how long the stages of the renderer take and write them to this file as a Chrome trace; off when empty.
+    std::filesystem::path traceFile = "";
+    // Image written by a request to the render server (see render_server.h); ignored by the other modes.
+    std::filesystem::path outputFile = "";
+    // Keep refining rendered images with more samples per pixel until this many milliseconds have passed; off when 0.
+    float timeBudgetMs = 0.0f;
+    // Memory layout of textures loaded by the scene.
+    Image::Layout textureLayout = Image::Layout::RowMajor;
+    // Memory that decoded textures may occupy before the least recently used ones are evicted (see texture_cache.h).
+    size_t textureCacheBudget = size_t(512) << 20;
+    // Image seen by rays that miss the scene, and how its faces are arranged.
+    std::filesystem::path environmentMap = std::filesystem::path(DATA_DIR) / "cube_map.jpg";
+    EnvironmentMap::Layout environmentMapLayout = EnvironmentMap::Layout::Cross;
     std::vector<CameraConfig> cameras;
     std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>> lights;
+    // Added to the scene on top of its own meshes.
+    std::vector<InstanceConfig> instances;
 };
 
 std::ostream& operator<<(std::ostream& arg, const Config& config);
 
 Config readConfigFile(const std::filesystem::path& config_path);
+// Read a configuration from a JSON object with the same keys as the TOML file. Returns std::nullopt, and sets
+// error, if it is not valid JSON or names a scene file that does not exist.
+std::optional<Config> readConfigJson(std::string_view json, std::string& error);
+
+// Object to world transform of the instance, as used by addInstances().
+InstanceDescription describeInstance(const InstanceConfig& instance);
 
 std::string serialize(const SceneType& sceneType);
 std::optional<SceneType> deserialize(const std::string& lowered);
\ No newline at end of file
@@ -181,8 +181,17 @@ void drawAABB(const AxisAlignedBox& box, DrawMode drawMode, const glm::vec3& col
 
 void drawScene(const Scene& scene)
 {
-    for (const auto& mesh : scene.meshes)
-        drawMesh(mesh);
+    if (scene.instances.empty()) {
+        for (const auto& mesh : scene.meshes)
+            drawMesh(mesh);
+    }
+    for (const auto& instance : scene.instances) {
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glMultMatrixf(glm::value_ptr(glm::mat4(instance.transform)));
+        drawMesh(scene.meshes[instance.meshIndex]);
+        glPopMatrix();
+    }
     for (const auto& sphere : scene.spheres)
         drawSphere(sphere);
 }
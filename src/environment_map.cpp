@@ -0,0 +1,271 @@
+#include "environment_map.h"
+#include <framework/image.h>
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <optional>
+
+// Position of each face in the horizontal cross, as (column, row) counted from the bottom left cell.
+static constexpr std::array<glm::ivec2, 6> crossCells { glm::ivec2 { 2, 1 }, { 0, 1 }, { 1, 2 }, { 1, 0 }, { 1, 1 }, { 3, 1 } };
+
+glm::vec3 faceDirection(int face, float a, float b)
+{
+    switch (face) {
+    case 0:
+        return { 1, b, -a };
+    case 1:
+        return { -1, b, a };
+    case 2:
+        return { a, 1, -b };
+    case 3:
+        return { a, -1, b };
+    case 4:
+        return { a, b, 1 };
+    default:
+        return { -a, b, -1 };
+    }
+}
+
+bool projectOnCube(const glm::vec3& direction, int& face, glm::vec2& faceCoords)
+{
+    const glm::vec3 absDirection = glm::abs(direction);
+    float major;
+    if (absDirection.z >= absDirection.x && absDirection.z >= absDirection.y) {
+        face = direction.z > 0 ? 4 : 5;
+        faceCoords = { direction.z > 0 ? direction.x : -direction.x, direction.y };
+        major = absDirection.z;
+    } else if (absDirection.y >= absDirection.x) {
+        face = direction.y > 0 ? 2 : 3;
+        faceCoords = { direction.x, direction.y > 0 ? -direction.z : direction.z };
+        major = absDirection.y;
+    } else {
+        face = direction.x > 0 ? 0 : 1;
+        faceCoords = { direction.x > 0 ? -direction.z : direction.z, direction.y };
+        major = absDirection.x;
+    }
+    if (major == 0.0f)
+        return false;
+    faceCoords /= major;
+    return true;
+}
+
+// Importance sampling cells per side of a face; finer grids hardly improve the sampling of smooth maps.
+static constexpr int maxCellsPerSide = 64;
+static constexpr glm::vec3 luminanceWeights { 0.2126f, 0.7152f, 0.0722f };
+
+// Width of a cell in face coordinates, which run from -1 to 1.
+static float cellSize(int cellsPerSide)
+{
+    return 2.0f / static_cast<float>(cellsPerSide);
+}
+
+// Face coordinates of the center of cell (x, y), where y counts rows from the top of the face like texels do.
+static glm::vec2 cellCenter(int x, int y, int cellsPerSide)
+{
+    return { -1.0f + (static_cast<float>(x) + 0.5f) * cellSize(cellsPerSide), 1.0f - (static_cast<float>(y) + 0.5f) * cellSize(cellsPerSide) };
+}
+
+// Ratio between an area on a face (at distance 1 from the center of the cube) and the solid angle it covers.
+static float solidAngleToArea(const glm::vec2& faceCoords)
+{
+    const float distanceSquared = 1.0f + glm::dot(faceCoords, faceCoords);
+    return distanceSquared * std::sqrt(distanceSquared);
+}
+
+EnvironmentMap::EnvironmentMap(const std::filesystem::path& filePath, Layout layout)
+    : m_filePath(filePath)
+    , m_layout(layout)
+{
+}
+
+void EnvironmentMap::load() const
+{
+    std::optional<Image> optImage;
+    try {
+        optImage.emplace(m_filePath, Image::Layout::RowMajor, false);
+    } catch (const std::exception&) {
+        // Image already printed the reason; misses stay black rather than aborting the render.
+        return;
+    }
+    const Image& image = *optImage;
+
+    if (m_layout == Layout::Cross) {
+        const glm::ivec2 cellSize { image.width / 4, image.height / 3 };
+        m_faceSize = cellSize.x;
+        for (int face = 0; face < 6; face++) {
+            std::vector<glm::vec3>& texels = m_faces[face];
+            texels.resize(size_t(m_faceSize) * size_t(m_faceSize));
+            // Image rows run from top to bottom, cross rows from bottom to top.
+            const glm::ivec2 cellOrigin { crossCells[face].x * cellSize.x, (2 - crossCells[face].y) * cellSize.y };
+            for (int y = 0; y < m_faceSize; y++) {
+                const int sourceY = cellOrigin.y + y * cellSize.y / m_faceSize;
+                for (int x = 0; x < m_faceSize; x++)
+                    texels[size_t(y) * size_t(m_faceSize) + size_t(x)] = image.getTexel(cellOrigin.x + x, sourceY);
+            }
+        }
+    } else {
+        // A face spans a quarter of the panorama horizontally.
+        m_faceSize = std::max(image.width / 4, 1);
+        // Latitude-longitude coordinates of every texel center of a face, sampled bilinearly for each face.
+        std::vector<glm::vec2> lookupTable(size_t(m_faceSize) * size_t(m_faceSize));
+        for (int face = 0; face < 6; face++) {
+#pragma omp parallel for
+            for (int y = 0; y < m_faceSize; y++) {
+                for (int x = 0; x < m_faceSize; x++) {
+                    const float a = 2.0f * (static_cast<float>(x) + 0.5f) / static_cast<float>(m_faceSize) - 1.0f;
+                    const float b = 1.0f - 2.0f * (static_cast<float>(y) + 0.5f) / static_cast<float>(m_faceSize);
+                    const glm::vec3 direction = glm::normalize(faceDirection(face, a, b));
+                    const float u = 0.5f + std::atan2(direction.x, -direction.z) / glm::two_pi<float>();
+                    const float v = std::acos(std::clamp(direction.y, -1.0f, 1.0f)) / glm::pi<float>();
+                    lookupTable[size_t(y) * size_t(m_faceSize) + size_t(x)] = { u, v };
+                }
+            }
+
+            std::vector<glm::vec3>& texels = m_faces[face];
+            texels.resize(lookupTable.size());
+#pragma omp parallel for
+            for (int i = 0; i < static_cast<int>(lookupTable.size()); i++) {
+                // Texel coordinates with the texel centers at whole numbers; wraps around horizontally.
+                const float x = lookupTable[size_t(i)].x * static_cast<float>(image.width) - 0.5f;
+                const float y = lookupTable[size_t(i)].y * static_cast<float>(image.height) - 0.5f;
+                const float floorX = std::floor(x), floorY = std::floor(y);
+                const int x0 = (static_cast<int>(floorX) + image.width) % image.width;
+                const int x1 = (x0 + 1) % image.width;
+                const int y0 = std::clamp(static_cast<int>(floorY), 0, image.height - 1);
+                const int y1 = std::clamp(static_cast<int>(floorY) + 1, 0, image.height - 1);
+                const glm::vec3 top = glm::mix(image.getTexel(x0, y0), image.getTexel(x1, y0), x - floorX);
+                const glm::vec3 bottom = glm::mix(image.getTexel(x0, y1), image.getTexel(x1, y1), x - floorX);
+                texels[size_t(i)] = glm::mix(top, bottom, y - floorY);
+            }
+        }
+    }
+}
+
+void EnvironmentMap::ensureLoaded() const
+{
+    std::call_once(m_loadFlag, [this]() {
+        load();
+        buildSamplingTables();
+        m_isLoaded = true;
+    });
+}
+
+glm::vec3 EnvironmentMap::lookup(const glm::vec3& direction, const Features& features) const
+{
+    ensureLoaded();
+    int face;
+    glm::vec2 faceCoords;
+    if (m_faceSize == 0 || !projectOnCube(direction, face, faceCoords))
+        return glm::vec3(0.0f);
+
+    // Coordinates within the face, (0, 0) being its bottom left corner.
+    const float size = static_cast<float>(m_faceSize);
+    const float s = 0.5f + 0.5f * faceCoords.x;
+    const float t = 0.5f + 0.5f * faceCoords.y;
+    const std::vector<glm::vec3>& texels = m_faces[face];
+    const auto texel = [&](int x, int y) { return texels[size_t(y) * size_t(m_faceSize) + size_t(x)]; };
+
+    if (features.extra.enableBilinearTextureFiltering || features.extra.enableMipmapTextureFiltering) {
+        const float x = s * size - 0.5f;
+        const float y = size - t * size - 0.5f;
+        const float floorX = std::floor(x), floorY = std::floor(y);
+        const int x0 = std::clamp(static_cast<int>(floorX), 0, m_faceSize - 1);
+        const int x1 = std::clamp(static_cast<int>(floorX) + 1, 0, m_faceSize - 1);
+        const int y0 = std::clamp(static_cast<int>(floorY), 0, m_faceSize - 1);
+        const int y1 = std::clamp(static_cast<int>(floorY) + 1, 0, m_faceSize - 1);
+        const glm::vec3 top = glm::mix(texel(x0, y0), texel(x1, y0), x - floorX);
+        const glm::vec3 bottom = glm::mix(texel(x0, y1), texel(x1, y1), x - floorX);
+        return glm::mix(top, bottom, y - floorY);
+    }
+    const int x = std::clamp(static_cast<int>(s * size), 0, m_faceSize - 1);
+    const int y = std::clamp(static_cast<int>(size - t * size), 0, m_faceSize - 1);
+    return texel(x, y);
+}
+
+void EnvironmentMap::buildSamplingTables() const
+{
+    if (m_faceSize == 0)
+        return;
+
+    m_cellsPerSide = std::min(m_faceSize, maxCellsPerSide);
+    const float cellArea = cellSize(m_cellsPerSide) * cellSize(m_cellsPerSide);
+    std::vector<float> rowWeights(6 * size_t(m_cellsPerSide));
+    m_cellTables.resize(rowWeights.size());
+#pragma omp parallel for
+    for (int row = 0; row < static_cast<int>(rowWeights.size()); row++) {
+        const int face = row / m_cellsPerSide, y = row % m_cellsPerSide;
+        const int beginY = y * m_faceSize / m_cellsPerSide, endY = (y + 1) * m_faceSize / m_cellsPerSide;
+        std::vector<float> cellWeights(static_cast<size_t>(m_cellsPerSide));
+        for (int x = 0; x < m_cellsPerSide; x++) {
+            const int beginX = x * m_faceSize / m_cellsPerSide, endX = (x + 1) * m_faceSize / m_cellsPerSide;
+            float luminance = 0.0f;
+            for (int texelY = beginY; texelY < endY; texelY++) {
+                for (int texelX = beginX; texelX < endX; texelX++)
+                    luminance += glm::dot(m_faces[face][size_t(texelY) * size_t(m_faceSize) + size_t(texelX)], luminanceWeights);
+            }
+            luminance /= static_cast<float>((endY - beginY) * (endX - beginX));
+
+            // Cells near the edges of a face cover a smaller solid angle.
+            const glm::vec2 center = cellCenter(x, y, m_cellsPerSide);
+            cellWeights[size_t(x)] = luminance * cellArea / solidAngleToArea(center);
+        }
+        m_cellTables[size_t(row)] = AliasTable(cellWeights);
+        rowWeights[size_t(row)] = m_cellTables[size_t(row)].totalWeight();
+    }
+    m_rowTable = AliasTable(rowWeights);
+}
+
+EnvironmentMap::Sample EnvironmentMap::sample(const glm::vec2& cellRandom, const glm::vec2& positionRandom) const
+{
+    ensureLoaded();
+    if (m_cellsPerSide == 0 || m_rowTable.totalWeight() <= 0.0f)
+        return { glm::vec3(0.0f, 0.0f, 1.0f), 0.0f };
+
+    const uint32_t row = m_rowTable.sample(cellRandom.x);
+    const uint32_t x = m_cellTables[row].sample(cellRandom.y);
+    const int face = static_cast<int>(row) / m_cellsPerSide, y = static_cast<int>(row) % m_cellsPerSide;
+    const glm::vec2 faceCoords = cellCenter(static_cast<int>(x), y, m_cellsPerSide) + (positionRandom - 0.5f) * glm::vec2(1, -1) * cellSize(m_cellsPerSide);
+
+    const float cellProbability = m_rowTable.probability(row) * m_cellTables[row].probability(x);
+    const float cellArea = cellSize(m_cellsPerSide) * cellSize(m_cellsPerSide);
+    return { glm::normalize(faceDirection(face, faceCoords.x, faceCoords.y)), cellProbability / cellArea * solidAngleToArea(faceCoords) };
+}
+
+float EnvironmentMap::pdf(const glm::vec3& direction) const
+{
+    ensureLoaded();
+    int face;
+    glm::vec2 faceCoords;
+    if (m_cellsPerSide == 0 || m_rowTable.totalWeight() <= 0.0f || !projectOnCube(direction, face, faceCoords))
+        return 0.0f;
+
+    const int x = std::clamp(static_cast<int>((faceCoords.x + 1.0f) * 0.5f * static_cast<float>(m_cellsPerSide)), 0, m_cellsPerSide - 1);
+    const int y = std::clamp(static_cast<int>((1.0f - faceCoords.y) * 0.5f * static_cast<float>(m_cellsPerSide)), 0, m_cellsPerSide - 1);
+    const uint32_t row = static_cast<uint32_t>(face * m_cellsPerSide + y);
+    const float cellProbability = m_rowTable.probability(row) * m_cellTables[row].probability(static_cast<uint32_t>(x));
+    const float cellArea = cellSize(m_cellsPerSide) * cellSize(m_cellsPerSide);
+    return cellProbability / cellArea * solidAngleToArea(faceCoords);
+}
+
+const std::filesystem::path& EnvironmentMap::filePath() const
+{
+    return m_filePath;
+}
+
+EnvironmentMap::Layout EnvironmentMap::layout() const
+{
+    return m_layout;
+}
+
+bool EnvironmentMap::isLoaded() const
+{
+    return m_isLoaded;
+}
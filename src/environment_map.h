@@ -0,0 +1,76 @@
+#pragma once
+#include "alias_table.h"
+#include "common.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+// Environment seen by rays that leave the scene. The image is only decoded on the first lookup and is then
+// split into six square cube faces, so that a lookup only has to select a face by the major axis of the
+// direction and index into that face.
+class EnvironmentMap {
+public:
+    enum class Layout {
+        // Horizontal cross: a 4x3 grid with -x, +z, +x, -z in the middle row and +y/-y above/below +z.
+        Cross,
+        // Equirectangular (latitude-longitude) panorama; resampled into cube faces when it is loaded.
+        LatLong,
+    };
+
+    EnvironmentMap(const std::filesystem::path& filePath, Layout layout);
+
+    struct Sample {
+        glm::vec3 direction; // Normalized.
+        float pdf; // With respect to solid angle; 0 if the map is black everywhere.
+    };
+
+    // Radiance arriving from the given direction (does not need to be normalized). Decodes the image on
+    // first use; safe to call from multiple threads at once.
+    [[nodiscard]] glm::vec3 lookup(const glm::vec3& direction, const Features& features) const;
+
+    // Draw a direction with a probability proportional to the luminance arriving from it (averaged over
+    // blocks of texels), given four uniform random numbers in [0, 1).
+    [[nodiscard]] Sample sample(const glm::vec2& cellRandom, const glm::vec2& positionRandom) const;
+    // Probability density with which sample() returns the given (normalized) direction.
+    [[nodiscard]] float pdf(const glm::vec3& direction) const;
+
+    [[nodiscard]] const std::filesystem::path& filePath() const;
+    [[nodiscard]] Layout layout() const;
+    [[nodiscard]] bool isLoaded() const;
+
+private:
+    void ensureLoaded() const;
+    void load() const;
+    void buildSamplingTables() const;
+
+private:
+    std::filesystem::path m_filePath;
+    Layout m_layout;
+
+    mutable std::once_flag m_loadFlag;
+    mutable int m_faceSize = 0;
+    // Faces in the order +x, -x, +y, -y, +z, -z; texels of each face stored in row major order.
+    mutable std::array<std::vector<glm::vec3>, 6> m_faces;
+    mutable std::atomic_bool m_isLoaded { false };
+
+    // Importance sampling operates on a coarser grid of cells per face. A cell is selected by first
+    // drawing one of the 6 * m_cellsPerSide rows of cells (marginal) and then a cell within that row
+    // (conditional), after which the direction is uniformly distributed over the cell on the cube face.
+    mutable int m_cellsPerSide = 0;
+    mutable AliasTable m_rowTable;
+    mutable std::vector<AliasTable> m_cellTables;
+};
+
+// Cube faces are numbered +x, -x, +y, -y, +z, -z, as in EnvironmentMap.
+// Direction through the point (a, b) in [-1, 1]^2 of a face; a points right and b points up in the face image.
+[[nodiscard]] glm::vec3 faceDirection(int face, float a, float b);
+// Face hit by the direction and the point (a, b) in [-1, 1]^2 where it pierces that face (see faceDirection()).
+// Ties go to z, then y, as the original box based lookup did. Returns false for the zero vector.
+bool projectOnCube(const glm::vec3& direction, int& face, glm::vec2& faceCoords);
@@ -0,0 +1,267 @@
+#include "instance_hierarchy.h"
+#include "bvh_statistics.h"
+#include "draw.h"
+#include "intersect.h"
+#include "scene.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/matrix.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+InstanceHierarchy::InstanceHierarchy(Scene* pScene, const Features& features)
+    : m_pScene(pScene)
+{
+    m_meshHierarchies.resize(m_pScene->meshes.size());
+    for (const auto& instance : m_pScene->instances) {
+        if (!m_meshHierarchies[instance.meshIndex])
+            m_meshHierarchies[instance.meshIndex] = std::make_unique<BoundingVolumeHierarchy>(m_pScene, instance.meshIndex, instance.meshIndex + 1, false, features);
+    }
+    if (!m_pScene->spheres.empty())
+        m_pSphereHierarchy = std::make_unique<BoundingVolumeHierarchy>(m_pScene, 0, 0, true, features);
+    m_instances.resize(m_pScene->instances.size());
+    for (uint32_t i = 0; i < m_instances.size(); i++)
+        updateInstance(i);
+    buildTopLevel();
+}
+
+void InstanceHierarchy::setTransform(uint32_t instanceIndex, const glm::mat4x3& transform)
+{
+    m_pScene->instances[instanceIndex].transform = transform;
+    updateInstance(instanceIndex);
+    buildTopLevel();
+}
+
+bool InstanceHierarchy::refit(const Features& features)
+{
+    bool rebuilt = false;
+    for (const auto& pMeshHierarchy : m_meshHierarchies) {
+        if (pMeshHierarchy)
+            rebuilt |= pMeshHierarchy->refit(features);
+    }
+    if (m_pSphereHierarchy)
+        rebuilt |= m_pSphereHierarchy->refit(features);
+    for (uint32_t i = 0; i < m_instances.size(); i++)
+        updateInstance(i);
+    buildTopLevel();
+    return rebuilt;
+}
+
+void InstanceHierarchy::updateInstance(uint32_t instanceIndex)
+{
+    const MeshInstance& meshInstance = m_pScene->instances[instanceIndex];
+    const glm::mat4 objectToWorld { meshInstance.transform };
+    Instance& instance = m_instances[instanceIndex];
+    instance.worldToObject = glm::mat4x3(glm::inverse(objectToWorld));
+    instance.normalToWorld = glm::transpose(glm::inverse(glm::mat3(objectToWorld)));
+
+    // World space box around the transformed corners of the box of the mesh.
+    const AxisAlignedBox& meshBox = m_meshHierarchies[meshInstance.meshIndex]->bounds();
+    if (glm::any(glm::greaterThan(meshBox.lower, meshBox.upper))) {
+        instance.box = meshBox; // Empty mesh.
+        return;
+    }
+    instance.box = { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest()) };
+    for (int corner = 0; corner < 8; corner++) {
+        const glm::vec3 point { (corner & 1) ? meshBox.upper.x : meshBox.lower.x, (corner & 2) ? meshBox.upper.y : meshBox.lower.y, (corner & 4) ? meshBox.upper.z : meshBox.lower.z };
+        const glm::vec3 worldPoint = meshInstance.transform * glm::vec4(point, 1.0f);
+        instance.box.lower = glm::min(instance.box.lower, worldPoint);
+        instance.box.upper = glm::max(instance.box.upper, worldPoint);
+    }
+}
+
+void InstanceHierarchy::buildTopLevel()
+{
+    m_nodes.clear();
+    m_numLevels = 0;
+    m_instanceOrder.resize(m_instances.size());
+    std::iota(std::begin(m_instanceOrder), std::end(m_instanceOrder), 0u);
+    if (!m_instanceOrder.empty())
+        buildTopLevelNode(m_instanceOrder, 0, 0);
+    m_generation = nextBvhGeneration();
+}
+
+// Split the instances at the median of their box centers along the axis in which the centers are spread most.
+uint32_t InstanceHierarchy::buildTopLevelNode(std::span<uint32_t> instanceIndices, uint32_t offset, int level)
+{
+    m_numLevels = std::max(m_numLevels, level + 1);
+    AxisAlignedBox box { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest()) };
+    AxisAlignedBox centers = box;
+    for (const uint32_t instanceIndex : instanceIndices) {
+        const AxisAlignedBox& instanceBox = m_instances[instanceIndex].box;
+        box.lower = glm::min(box.lower, instanceBox.lower);
+        box.upper = glm::max(box.upper, instanceBox.upper);
+        const glm::vec3 center = (instanceBox.lower + instanceBox.upper) * 0.5f;
+        centers.lower = glm::min(centers.lower, center);
+        centers.upper = glm::max(centers.upper, center);
+    }
+    if (instanceIndices.size() == 1) {
+        m_nodes.push_back(Node { .box = box, .level = level, .isLeaf = true, .first = offset, .second = 1 });
+        return uint32_t(m_nodes.size() - 1);
+    }
+
+    const glm::vec3 extent = centers.upper - centers.lower;
+    const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    const size_t median = instanceIndices.size() / 2;
+    std::nth_element(std::begin(instanceIndices), std::begin(instanceIndices) + median, std::end(instanceIndices), [&](uint32_t lhs, uint32_t rhs) {
+        const AxisAlignedBox& lhsBox = m_instances[lhs].box;
+        const AxisAlignedBox& rhsBox = m_instances[rhs].box;
+        return lhsBox.lower[axis] + lhsBox.upper[axis] < rhsBox.lower[axis] + rhsBox.upper[axis];
+    });
+    const uint32_t leftChild = buildTopLevelNode(instanceIndices.subspan(0, median), offset, level + 1);
+    const uint32_t rightChild = buildTopLevelNode(instanceIndices.subspan(median), offset + uint32_t(median), level + 1);
+    m_nodes.push_back(Node { .box = box, .level = level, .isLeaf = false, .first = leftChild, .second = rightChild });
+    return uint32_t(m_nodes.size() - 1);
+}
+
+bool InstanceHierarchy::intersectInstance(uint32_t instanceIndex, Ray& ray, HitInfo& hitInfo, const Features& features) const
+{
+    const Instance& instance = m_instances[instanceIndex];
+    // The direction is not normalized, so that distances along the ray (t) are the same in both spaces.
+    Ray objectRay { instance.worldToObject * glm::vec4(ray.origin, 1.0f), instance.worldToObject * glm::vec4(ray.direction, 0.0f), ray.t };
+    if (!m_meshHierarchies[m_pScene->instances[instanceIndex].meshIndex]->intersect(objectRay, hitInfo, features))
+        return false;
+    ray.t = objectRay.t;
+    hitInfo.normal = glm::normalize(instance.normalToWorld * hitInfo.normal);
+    return true;
+}
+
+bool InstanceHierarchy::intersectInstanceAny(uint32_t instanceIndex, Ray& ray, const Features& features) const
+{
+    const Instance& instance = m_instances[instanceIndex];
+    Ray objectRay { instance.worldToObject * glm::vec4(ray.origin, 1.0f), instance.worldToObject * glm::vec4(ray.direction, 0.0f), ray.t };
+    if (!m_meshHierarchies[m_pScene->instances[instanceIndex].meshIndex]->intersectAny(objectRay, features))
+        return false;
+    ray.t = objectRay.t;
+    return true;
+}
+
+bool InstanceHierarchy::intersect(Ray& ray, HitInfo& hitInfo, const Features& features) const
+{
+    // The spheres are not instanced; they have a hierarchy of their own in world space.
+    bool hit = m_pSphereHierarchy && m_pSphereHierarchy->intersect(ray, hitInfo, features);
+    if (!features.enableAccelStructure) {
+        for (uint32_t i = 0; i < m_instances.size(); i++)
+            hit |= intersectInstance(i, ray, hitInfo, features);
+        return hit;
+    }
+
+    if (m_nodes.empty())
+        return hit;
+    // Only the top level nodes; the bottom levels count their own.
+    TraversalCount count;
+    thread_local std::vector<uint32_t> stack;
+    stack.clear();
+    stack.push_back(uint32_t(m_nodes.size() - 1));
+    while (!stack.empty()) {
+        const Node& node = m_nodes[stack.back()];
+        stack.pop_back();
+        if (boxEntryDistance(node.box, ray) > ray.t)
+            continue;
+        count.nodesVisited++;
+        if (enableDebugDraw)
+            drawAABB(node.box, DrawMode::Wireframe, glm::vec3(1.0f), 1.0f);
+
+        if (node.isLeaf) {
+            for (uint32_t i = 0; i < node.primitiveCount(); i++)
+                hit |= intersectInstance(m_instanceOrder[node.primitiveOffset() + i], ray, hitInfo, features);
+        } else {
+            // Visit the nearer child first, so that its hits can cull the other one.
+            uint32_t nearChild = node.leftChild(), farChild = node.rightChild();
+            if (boxEntryDistance(m_nodes[farChild].box, ray) < boxEntryDistance(m_nodes[nearChild].box, ray))
+                std::swap(nearChild, farChild);
+            stack.push_back(farChild);
+            stack.push_back(nearChild);
+        }
+    }
+    return hit;
+}
+
+bool InstanceHierarchy::intersectAny(Ray& ray, const Features& features) const
+{
+    if (m_pSphereHierarchy && m_pSphereHierarchy->intersectAny(ray, features))
+        return true;
+    if (!features.enableAccelStructure) {
+        for (uint32_t i = 0; i < m_instances.size(); i++) {
+            if (intersectInstanceAny(i, ray, features))
+                return true;
+        }
+        return false;
+    }
+
+    if (m_nodes.empty())
+        return false;
+    TraversalCount count;
+    thread_local std::vector<uint32_t> stack;
+    stack.clear();
+    stack.push_back(uint32_t(m_nodes.size() - 1));
+    while (!stack.empty()) {
+        const Node& node = m_nodes[stack.back()];
+        stack.pop_back();
+        if (boxEntryDistance(node.box, ray) > ray.t)
+            continue;
+        count.nodesVisited++;
+
+        if (node.isLeaf) {
+            for (uint32_t i = 0; i < node.primitiveCount(); i++) {
+                if (intersectInstanceAny(m_instanceOrder[node.primitiveOffset() + i], ray, features))
+                    return true;
+            }
+        } else {
+            stack.push_back(node.leftChild());
+            stack.push_back(node.rightChild());
+        }
+    }
+    return false;
+}
+
+int InstanceHierarchy::numLevels() const
+{
+    return m_numLevels;
+}
+
+int InstanceHierarchy::numLeaves() const
+{
+    return int(m_instances.size());
+}
+
+void InstanceHierarchy::debugDrawLevel(int level) const
+{
+    for (const auto& node : m_nodes) {
+        if (node.level == level)
+            drawAABB(node.box, DrawMode::Wireframe, glm::vec3(1.0f), 1.0f);
+    }
+}
+
+void InstanceHierarchy::debugDrawLeaf(int leafIdx) const
+{
+    // Leaves are counted from 1, as in BoundingVolumeHierarchy::debugDrawLeaf().
+    if (leafIdx < 1 || size_t(leafIdx) > m_instances.size())
+        return;
+    drawAABB(m_instances[m_instanceOrder[size_t(leafIdx) - 1]].box, DrawMode::Wireframe, glm::vec3(0.0f, 1.05f, 1.05f), 1.0f);
+}
+
+BvhStatistics InstanceHierarchy::statistics() const
+{
+    BvhStatistics statistics = computeBvhStatistics(m_nodes);
+    statistics.numReferences = m_instanceOrder.size();
+    statistics.memoryBytes = m_nodes.size() * sizeof(Node) + m_instanceOrder.size() * sizeof(uint32_t) + m_instances.size() * sizeof(Instance);
+    for (const auto& pHierarchy : m_meshHierarchies) {
+        if (pHierarchy)
+            statistics.memoryBytes += pHierarchy->statistics().memoryBytes;
+    }
+    if (m_pSphereHierarchy)
+        statistics.memoryBytes += m_pSphereHierarchy->statistics().memoryBytes;
+    return statistics;
+}
+
+uint64_t InstanceHierarchy::generation() const
+{
+    return m_generation;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "bounding_volume_hierarchy.h"
+#include "common.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Forward declaration.
+struct BvhStatistics;
+struct Scene;
+
+// Two-level hierarchy for scenes with mesh instances (Scene::instances). Every instanced mesh gets a
+// BoundingVolumeHierarchy of its own in the coordinates of the mesh (the bottom level); the top level is a small
+// hierarchy over the world space boxes of the instances. A ray reaching an instance is transformed into the space
+// of its mesh, so a mesh placed many times is stored only once, and moving an instance only rebuilds the top level.
+class InstanceHierarchy {
+public:
+    InstanceHierarchy(Scene* pScene, const Features& features);
+
+    // Same contract as BoundingVolumeHierarchy::intersect(); the normal is returned in world space.
+    bool intersect(Ray& ray, HitInfo& hitInfo, const Features& features) const;
+    // Same contract as BoundingVolumeHierarchy::intersectAny(); occluders are not reported since a triangle
+    // does not identify the instance it was hit through.
+    bool intersectAny(Ray& ray, const Features& features) const;
+
+    // Move an instance (updating Scene::instances) and rebuild the top level.
+    void setTransform(uint32_t instanceIndex, const glm::mat4x3& transform);
+    // Refit the bottom levels to the current vertices of their meshes (see BoundingVolumeHierarchy::refit()) and
+    // rebuild the top level over the new instance boxes. Returns true if any bottom level had to be rebuilt.
+    bool refit(const Features& features);
+
+    // Levels and leaves (one per instance) of the top level.
+    [[nodiscard]] int numLevels() const;
+    [[nodiscard]] int numLeaves() const;
+    void debugDrawLevel(int level) const;
+    void debugDrawLeaf(int leafIdx) const;
+    // Statistics of the top level; the memory footprint includes the bottom levels.
+    [[nodiscard]] BvhStatistics statistics() const;
+
+    // Changes whenever the hierarchy is built or an instance is moved.
+    [[nodiscard]] uint64_t generation() const;
+
+private:
+    struct Instance {
+        glm::mat4x3 worldToObject;
+        glm::mat3 normalToWorld;
+        AxisAlignedBox box; // World space.
+    };
+
+    void updateInstance(uint32_t instanceIndex);
+    void buildTopLevel();
+    uint32_t buildTopLevelNode(std::span<uint32_t> instanceIndices, uint32_t offset, int level);
+    // Intersect the ray with one instance; ray.t and hitInfo are only changed if it is hit.
+    bool intersectInstance(uint32_t instanceIndex, Ray& ray, HitInfo& hitInfo, const Features& features) const;
+    bool intersectInstanceAny(uint32_t instanceIndex, Ray& ray, const Features& features) const;
+
+private:
+    Scene* m_pScene;
+    // Bottom level per scene mesh; null for meshes without instances.
+    std::vector<std::unique_ptr<BoundingVolumeHierarchy>> m_meshHierarchies;
+    // The spheres of the scene, in world space; null if there are none.
+    std::unique_ptr<BoundingVolumeHierarchy> m_pSphereHierarchy;
+    std::vector<Instance> m_instances;
+
+    // Top level; the leaves index ranges of m_instanceOrder and the root is the last node.
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_instanceOrder;
+    int m_numLevels = 0;
+    uint64_t m_generation = 0;
+};
@@ -80,48 +80,28 @@ bool intersectRayWithTriangle(const glm::vec3& v0, const glm::vec3& v1, const gl
 /// Output: if intersects then modify the hit parameter ray.t and return true, otherwise return false
 bool intersectRayWithShape(const Sphere& sphere, Ray& ray, HitInfo& hitInfo)
 {
-    // auto A = glm::dot(ray.direction, ray.direction);
-    // auto B = 2 * (ray.direction.x * (ray.origin.x - sphere.center.x) + ray.direction.y * (ray.origin.y - sphere.center.y) + ray.direction.z * (ray.origin.z - sphere.center.z));
-    // auto C = glm::pow((ray.origin.x - sphere.center.x), 2) + glm::pow((ray.origin.y - sphere.center.y), 2) + glm::pow((ray.origin.z - sphere.center.z), 2) - glm::pow(sphere.radius, 2);
-
-    // auto delta = B * B - 4 * A * C;
-    // auto prev_t = ray.t;
-    // float new_t;
-
-    // if (delta < 0.0f) {  // negative delta
-    //     //std::cerr << "negative\n";
-    //     return false;
-    // } else if (delta == 0.0f) {
-    //     //std::cerr << "zero\n";
-
-    //     new_t = -B / (2 * A);
-    //     if (new_t > 0 && new_t <= prev_t) { // delta = 0
-    //         ray.t = new_t;
-    //         return true;
-    //     }
-    //     return false;
-    // } else { // delta greater than 0
-    //     //std::cerr << "positive\n";
-
-    //     auto t_0 = (-B - glm::pow(delta, 0.5f)) / (2 * A);
-    //     auto t_1 = (-B + glm::pow(delta, 0.5f)) / (2 * A);
-
-    //     if (t_0 <= 0 && t_1 <= 0) {
-    //         return false;
-    //     } else if (t_0 <= 0) {
-    //         if (t_1 <= prev_t) {
-    //             ray.t = t_1;
-    //             return true;
-    //         }
-    //     }
-    //     auto new_t = t_0;
-    //     if (new_t <= prev_t) {
-    //         ray.t = new_t;
-    //         return true;
-    //     }
-    //     return false;
-    // }
-    return false;
+    // Solve a*t^2 - 2*b*t + c = 0 without the cancellation of the textbook formula: the discriminant is computed
+    // from the distance between the center and the line of the ray (which stays accurate for small spheres far
+    // away), and the root nearest to zero is derived from the other one instead of subtracting two large numbers.
+    const glm::vec3 f = ray.origin - sphere.center;
+    const float a = glm::dot(ray.direction, ray.direction);
+    const float b = -glm::dot(f, ray.direction);
+    const float c = glm::dot(f, f) - sphere.radius * sphere.radius;
+    const glm::vec3 perpendicular = f + (b / a) * ray.direction;
+    const float discriminant = sphere.radius * sphere.radius - glm::dot(perpendicular, perpendicular);
+    if (discriminant < 0.0f)
+        return false;
+
+    const float q = b + std::copysign(std::sqrt(a * discriminant), b);
+    const float t0 = c / q;
+    const float t1 = q / a;
+    // The nearest root in front of the origin; the far one if the origin lies inside the sphere.
+    const float tNear = std::min(t0, t1), tFar = std::max(t0, t1);
+    const float t = tNear > 0.0f ? tNear : tFar;
+    if (!(t > 0.0f) || t > ray.t)
+        return false;
+    ray.t = t;
+    return true;
 }
 
 // bool intersectRayWithFace(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3, Ray& ray)
@@ -158,3 +138,15 @@ bool intersectRayWithShape(const AxisAlignedBox& box, Ray& ray)
     }
     return true;
 }
+
+float boxEntryDistance(const AxisAlignedBox& box, const Ray& ray)
+{
+    const glm::vec3 inverseDirection = 1.0f / ray.direction;
+    const glm::vec3 t0 = (box.lower - ray.origin) * inverseDirection;
+    const glm::vec3 t1 = (box.upper - ray.origin) * inverseDirection;
+    const float tIn = glm::compMax(glm::min(t0, t1));
+    const float tOut = glm::compMin(glm::max(t0, t1));
+    if (tIn > tOut || tOut < 0)
+        return std::numeric_limits<float>::infinity();
+    return std::max(tIn, 0.0f);
+}
@@ -14,3 +14,7 @@ bool intersectRayWithTriangle(const glm::vec3& v0, const glm::vec3& v1, const gl
 bool intersectRayWithShape(const Sphere& sphere, Ray& ray, HitInfo& hitInfo);
 
 bool intersectRayWithShape(const AxisAlignedBox& box, Ray& ray);
+
+// Distance along the ray at which it enters the box: 0 if the origin lies inside the box, infinity if the ray misses
+// it. Unlike intersectRayWithShape() this ignores ray.t, and the origin being inside does not count as a hit at the exit.
+float boxEntryDistance(const AxisAlignedBox& box, const Ray& ray);
@@ -1,12 +1,24 @@
 #include "light.h"
+#include "bvh_statistics.h"
 #include "config.h"
+#include "environment_map.h"
+#include "light_set.h"
+#include "light_tree.h"
+#include "shadow_cache.h"
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <limits>
+#include <optional>
+#include <span>
+#include <variant>
+#include <vector>
 #include <time.h>
 
 // samples a segment light source
@@ -38,15 +50,49 @@ void sampleParallelogramLight(const ParallelogramLight& parallelogramLight, glm:
     color = p.color0 * (1 - x) * (1 - y) + p.color1 * x * (1 - y) + p.color2 * y * (1 - x) + p.color3 * x * y;
 }
 
+// Trace a shadow ray and return whether anything blocks it. With the occluder cache enabled, the triangle that
+// blocked the previous shadow ray of this thread towards the same light (identified by occluderSlot) is tested
+// before traversing the BVH. That triangle is only a guess, so the answer is the same with or without the cache.
+static bool isOccluded(Ray& shadowRay, const BvhInterface& bvh, const Features& features, std::optional<uint32_t> occluderSlot)
+{
+    if (!features.extra.enableOccluderCache || !occluderSlot)
+        return bvh.intersectAny(shadowRay, features);
+
+    thread_local OccluderCache occluderCache;
+    const uint64_t generation = bvh.generation();
+    if (const auto cachedOccluder = occluderCache.find(*occluderSlot, generation); cachedOccluder && bvh.intersectPrimitive(shadowRay, *cachedOccluder))
+        return true;
+    std::optional<Primitive> occluder;
+    if (!bvh.intersectAny(shadowRay, features, &occluder))
+        return false;
+    if (occluder)
+        occluderCache.store(*occluderSlot, *occluder, generation);
+    return true;
+}
+
+// Slot of a light in the occluder cache (see isOccluded()).
+static uint32_t occluderSlot(const LightSet& lightSet, LightSet::Type type, uint32_t index)
+{
+    switch (type) {
+    case LightSet::Type::Point:
+        return index;
+    case LightSet::Type::Segment:
+        return static_cast<uint32_t>(lightSet.pointLights.size()) + index;
+    default:
+        return static_cast<uint32_t>(lightSet.pointLights.size() + lightSet.segmentLights.size()) + index;
+    }
+}
+
 // test the visibility at a given light sample
 // returns 1.0 if sample is visible, 0.0 otherwise
-float testVisibilityLightSample(
+static float testVisibilityLightSample(
     const glm::vec3& samplePos,
     const glm::vec3& debugColor,
     const BvhInterface& bvh,
     const Features& features,
     Ray ray,
-    HitInfo hitInfo)
+    HitInfo hitInfo,
+    std::optional<uint32_t> occluderSlot)
 {
     if (!features.enableHardShadow && !features.enableSoftShadow) {
         return 1;
@@ -57,8 +103,14 @@ float testVisibilityLightSample(
     }
     auto lightRayColor = debugColor;
     float ans = 1;
+    const ScopedRayType rayType { RayType::Shadow };
     Ray newRay = { intersectionPoint, samplePos - intersectionPoint, 1 };
     newRay.origin += glm::normalize(newRay.direction) * 0.001f;
+    if (!enableDebugDraw) {
+        // Only whether the ray is blocked matters, not by what.
+        newRay.t = 1 - 0.01f;
+        return isOccluded(newRay, bvh, features, occluderSlot) ? 0.0f : 1.0f;
+    }
     if (bvh.intersect(newRay, hitInfo, features) && newRay.t < 1 - 0.01) {
         lightRayColor = { 1, 0, 0 };
         ans = 0.0;
@@ -73,6 +125,264 @@ float testVisibilityLightSample(
     return ans;
 }
 
+float testVisibilityLightSample(
+    const glm::vec3& samplePos,
+    const glm::vec3& debugColor,
+    const BvhInterface& bvh,
+    const Features& features,
+    Ray ray,
+    HitInfo hitInfo)
+{
+    return testVisibilityLightSample(samplePos, debugColor, bvh, features, ray, hitInfo, std::nullopt);
+}
+
+// Visibility of a point light, answered by its shadow map if it has one (unless shadow rays are being drawn).
+static float testPointLightVisibility(const LightSet& lightSet, uint32_t i, const BvhInterface& bvh, const Features& features, const Ray& ray, const HitInfo& hitInfo)
+{
+    const LightSet::PointLights& pointLights = lightSet.pointLights;
+    const glm::vec3 position { pointLights.positionX[i], pointLights.positionY[i], pointLights.positionZ[i] };
+    if (features.enableHardShadow && !enableDebugDraw && i < pointLights.shadowMaps.size()) {
+        if (const auto visible = pointLights.shadowMaps[i]->isVisible(ray.origin + ray.direction * ray.t, hitInfo.normal, bvh, features))
+            return *visible ? 1.0f : 0.0f;
+    }
+    const glm::vec3 color { pointLights.colorR[i], pointLights.colorG[i], pointLights.colorB[i] };
+    return testVisibilityLightSample(position, color, bvh, features, ray, hitInfo, occluderSlot(lightSet, LightSet::Type::Point, i));
+}
+
+// Light arriving from the environment map, estimated with shadow rays towards directions drawn by importance.
+static glm::vec3 computeEnvironmentContribution(const EnvironmentMap& environmentMap, const BvhInterface& bvh, const Features& features, Ray ray, HitInfo hitInfo)
+{
+    const auto random = []() { return static_cast<float>(rand()) / (static_cast<float>(RAND_MAX) + 1.0f); };
+    const glm::vec3 intersectionPoint = ray.origin + ray.direction * ray.t;
+    // Only directions on the side of the surface facing the camera can contribute.
+    const glm::vec3 normal = glm::dot(hitInfo.normal, ray.direction) > 0 ? -hitInfo.normal : hitInfo.normal;
+
+    glm::vec3 res { 0.0f };
+    const int N = std::max(features.extra.environmentLightSamples, 1);
+    for (int i = 0; i < N; i++) {
+        const EnvironmentMap::Sample sample = environmentMap.sample({ random(), random() }, { random(), random() });
+        if (sample.pdf <= 0.0f || glm::dot(sample.direction, normal) <= 0.0f)
+            continue;
+
+        Ray shadowRay { intersectionPoint + sample.direction * 0.001f, sample.direction, std::numeric_limits<float>::max() };
+        const ScopedRayType rayType { RayType::Shadow };
+        // Only whether the ray is blocked matters, not by what.
+        const bool occluded = bvh.intersectAny(shadowRay, features);
+        const glm::vec3 radiance = environmentMap.lookup(sample.direction, features);
+        if (enableDebugDraw) {
+            shadowRay.t = std::min(shadowRay.t, 1.0f);
+            drawRay(shadowRay, occluded ? glm::vec3(1, 0, 0) : radiance);
+        }
+        if (occluded)
+            continue;
+
+        // computeShading() treats light colors as irradiance (no 1/pi in the diffuse term); dividing by pi turns
+        // it into an integral of the environment radiance over the hemisphere.
+        res += computeShading(intersectionPoint + sample.direction, radiance, features, ray, hitInfo) / (glm::pi<float>() * sample.pdf);
+    }
+    return res / static_cast<float>(N);
+}
+
+// Position and color of the point at parameter t along a segment light (see sampleSegmentLight()).
+static void sampleSegmentLight(const LightSet::SegmentLights& segmentLights, uint32_t i, float t, glm::vec3& position, glm::vec3& color)
+{
+    position = segmentLights.endpoint0[i] * t + segmentLights.endpoint1[i] * (1 - t);
+    color = segmentLights.color0[i] * t + segmentLights.color1[i] * (1 - t);
+}
+
+// Position and color of the point (x, y) on a parallelogram light (see sampleParallelogramLight()).
+static void sampleParallelogramLight(const LightSet::ParallelogramLights& parallelogramLights, uint32_t i, float x, float y, glm::vec3& position, glm::vec3& color)
+{
+    position = parallelogramLights.v0[i] + x * parallelogramLights.edge01[i] + y * parallelogramLights.edge02[i];
+    color = parallelogramLights.color0[i] * (1 - x) * (1 - y) + parallelogramLights.color1[i] * x * (1 - y)
+        + parallelogramLights.color2[i] * y * (1 - x) + parallelogramLights.color3[i] * x * y;
+}
+
+// Contribution of a single light estimated with one sample on it, as used by many-light sampling.
+static glm::vec3 sampleLightContribution(const LightSet& lightSet, uint32_t lightIndex, const BvhInterface& bvh, const Features& features, Ray ray, HitInfo hitInfo)
+{
+    const uint32_t i = lightSet.lights[lightIndex].index;
+    auto position = glm::vec3(0.0);
+    auto color = glm::vec3(0.0);
+    switch (lightSet.lights[lightIndex].type) {
+    case LightSet::Type::Point: {
+        const LightSet::PointLights& pointLights = lightSet.pointLights;
+        position = { pointLights.positionX[i], pointLights.positionY[i], pointLights.positionZ[i] };
+        color = { pointLights.colorR[i], pointLights.colorG[i], pointLights.colorB[i] };
+        if (!features.enableHardShadow)
+            return computeShading(position, color, features, ray, hitInfo);
+        return computeShading(position, color, features, ray, hitInfo) * testPointLightVisibility(lightSet, i, bvh, features, ray, hitInfo);
+    }
+    case LightSet::Type::Segment: {
+        sampleSegmentLight(lightSet.segmentLights, i, static_cast<float>(rand()) / static_cast<float>(RAND_MAX), position, color);
+    } break;
+    case LightSet::Type::Parallelogram: {
+        const float r1 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+        const float r2 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+        sampleParallelogramLight(lightSet.parallelogramLights, i, r1, r2, position, color);
+    } break;
+    }
+    const uint32_t slot = occluderSlot(lightSet, lightSet.lights[lightIndex].type, i);
+    return computeShading(position, color, features, ray, hitInfo) * testVisibilityLightSample(position, color, bvh, features, ray, hitInfo, slot);
+}
+
+// Add the contribution of the shaded light samples, multiplied by their visibility (visibility(i) for the i-th
+// sample) when shadows are enabled. Samples that do not reach the point (e.g. because they are behind the surface)
+// need no shadow ray, unless the shadow rays are being drawn.
+template <typename Visibility>
+static glm::vec3 accumulateVisibleSamples(const LightSampleBatch& samples, std::span<const float> red, std::span<const float> green, std::span<const float> blue, bool testVisibility, float weight, Visibility&& visibility)
+{
+    glm::vec3 res { 0.0f };
+    for (size_t i = 0; i < samples.size(); i++) {
+        const glm::vec3 shading { red[i], green[i], blue[i] };
+        if (testVisibility && (shading != glm::vec3(0.0f) || enableDebugDraw)) {
+            res += weight * shading * visibility(i);
+        } else {
+            res += weight * shading;
+        }
+    }
+    return res;
+}
+
+// Contribution of all lights, each evaluated in full. All samples of a light (or all point lights) are shaded in
+// one batch before their shadow rays are traced.
+static glm::vec3 computeAllLightsContribution(const LightSet& lightSet, const BvhInterface& bvh, const Features& features, Ray ray, HitInfo hitInfo)
+{
+    glm::vec3 res = { 0.0, 0.0, 0.0 };
+    const ShadingFrame frame = computeShadingFrame(ray, hitInfo);
+    thread_local LightSampleBatch samples;
+    thread_local std::vector<float> red, green, blue;
+    const auto shadeSamples = [&](const LightSampleBatch& batch) {
+        red.resize(batch.size());
+        green.resize(batch.size());
+        blue.resize(batch.size());
+        computeShadingBatch(frame, batch, red, green, blue);
+    };
+    // Visibility of the samples of one area light, whose shadow rays share a slot in the occluder cache.
+    const auto sampleVisibility = [&](uint32_t slot) {
+        return [&, slot](size_t i) {
+            const glm::vec3 position { samples.positionX[i], samples.positionY[i], samples.positionZ[i] };
+            const glm::vec3 color { samples.colorR[i], samples.colorG[i], samples.colorB[i] };
+            return testVisibilityLightSample(position, color, bvh, features, ray, hitInfo, slot);
+        };
+    };
+
+    const LightSet::PointLights& pointLights = lightSet.pointLights;
+    samples.clear();
+    for (size_t i = 0; i < pointLights.size(); i++) {
+        samples.push_back({ pointLights.positionX[i], pointLights.positionY[i], pointLights.positionZ[i] },
+            { pointLights.colorR[i], pointLights.colorG[i], pointLights.colorB[i] });
+    }
+    shadeSamples(samples);
+    res += accumulateVisibleSamples(samples, red, green, blue, features.enableHardShadow, 1.0f, [&](size_t i) {
+        return testPointLightVisibility(lightSet, static_cast<uint32_t>(i), bvh, features, ray, hitInfo);
+    });
+
+    if (!features.enableSoftShadow)
+        return res;
+    // Stratified samples along each segment light.
+    const LightSet::SegmentLights& segmentLights = lightSet.segmentLights;
+    for (uint32_t i = 0; i < segmentLights.size(); i++) {
+        const size_t N = 100;
+        samples.clear();
+        for (size_t t = 0; t < N; t++) {
+            float r = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+            auto trand = (float)t + r;
+            auto position = glm::vec3(0.0);
+            auto color = glm::vec3(0.0);
+            sampleSegmentLight(segmentLights, i, trand / (float)N, position, color);
+            samples.push_back(position, color);
+        }
+        shadeSamples(samples);
+        res += accumulateVisibleSamples(samples, red, green, blue, true, 1.0f / (float)N, sampleVisibility(occluderSlot(lightSet, LightSet::Type::Segment, i)));
+    }
+    // Stratified samples on a grid over each parallelogram light.
+    const LightSet::ParallelogramLights& parallelogramLights = lightSet.parallelogramLights;
+    for (uint32_t l = 0; l < parallelogramLights.size(); l++) {
+        const size_t N = 10;
+        samples.clear();
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = 0; j < N; j++) {
+                float r1 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+                float r2 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+                auto xrand = (float)i + r1;
+                auto yrand = (float)j + r2;
+                auto position = glm::vec3(0.0);
+                auto color = glm::vec3(0.0);
+                sampleParallelogramLight(parallelogramLights, l, xrand / (float)N, yrand / (float)N, position, color);
+                samples.push_back(position, color);
+            }
+        }
+        shadeSamples(samples);
+        res += accumulateVisibleSamples(samples, red, green, blue, true, 1.0f / (float)(N * N), sampleVisibility(occluderSlot(lightSet, LightSet::Type::Parallelogram, l)));
+    }
+    return res;
+}
+
+// Contribution of the lights of a scene that were not compiled by compileSceneLights() (e.g. of a scene built by hand),
+// read straight from scene.lights. Area lights get the same stratified samples as in computeAllLightsContribution(),
+// shaded one at a time and without the shadow caches.
+static glm::vec3 computeUncompiledLightsContribution(const Scene& scene, const BvhInterface& bvh, const Features& features, Ray ray, HitInfo hitInfo)
+{
+    const auto shadeSample = [&](const glm::vec3& position, const glm::vec3& color, bool testVisibility) {
+        const glm::vec3 shading = computeShading(position, color, features, ray, hitInfo);
+        return testVisibility ? shading * testVisibilityLightSample(position, color, bvh, features, ray, hitInfo) : shading;
+    };
+    glm::vec3 res { 0.0f };
+    for (const auto& light : scene.lights) {
+        if (const auto* pPointLight = std::get_if<PointLight>(&light)) {
+            res += shadeSample(pPointLight->position, pPointLight->color, features.enableHardShadow);
+        } else if (!features.enableSoftShadow) {
+            continue;
+        } else if (const auto* pSegmentLight = std::get_if<SegmentLight>(&light)) {
+            const size_t N = 100;
+            for (size_t t = 0; t < N; t++) {
+                const float r = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+                auto position = glm::vec3(0.0);
+                auto color = glm::vec3(0.0);
+                sampleSegmentLight(*pSegmentLight, position, color, ((float)t + r) / (float)N);
+                res += shadeSample(position, color, true) / (float)N;
+            }
+        } else if (const auto* pParallelogramLight = std::get_if<ParallelogramLight>(&light)) {
+            const size_t N = 10;
+            for (size_t i = 0; i < N; i++) {
+                for (size_t j = 0; j < N; j++) {
+                    const float r1 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+                    const float r2 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+                    auto position = glm::vec3(0.0);
+                    auto color = glm::vec3(0.0);
+                    sampleParallelogramLight(*pParallelogramLight, position, color, ((float)i + r1) / (float)N, ((float)j + r2) / (float)N);
+                    res += shadeSample(position, color, true) / (float)(N * N);
+                }
+            }
+        }
+    }
+    return res;
+}
+
+void compileSceneLights(Scene& scene, const Features& features)
+{
+    LightSet lightSet = compileLights(scene.lights);
+    if (features.extra.enableShadowMapCache && features.enableHardShadow) {
+        LightSet::PointLights& pointLights = lightSet.pointLights;
+        // Lights that did not move keep the texels traced so far; the maps only depend on the position.
+        const auto& previousShadowMaps = scene.lightSet ? scene.lightSet->pointLights.shadowMaps : decltype(pointLights.shadowMaps) {};
+        for (size_t i = 0; i < pointLights.size(); i++) {
+            const glm::vec3 position { pointLights.positionX[i], pointLights.positionY[i], pointLights.positionZ[i] };
+            const auto iter = std::find_if(std::begin(previousShadowMaps), std::end(previousShadowMaps), [&](const auto& pShadowMap) {
+                return pShadowMap->lightPosition() == position && pShadowMap->resolution() == features.extra.shadowMapResolution;
+            });
+            pointLights.shadowMaps.push_back(iter != std::end(previousShadowMaps) ? *iter : std::make_shared<const ShadowMap>(position, features.extra.shadowMapResolution));
+        }
+    }
+    const auto pLightSet = std::make_shared<const LightSet>(std::move(lightSet));
+    scene.lightSet = pLightSet;
+    if (features.extra.enableLightSampling)
+        scene.lightTree = std::make_shared<const LightTree>(*pLightSet, features);
+    else
+        scene.lightTree.reset();
+}
+
 // given an intersection, computes the contribution from all light sources at the intersection point
 // in this method you should cycle the light sources and for each one compute their contribution
 // don't forget to check for visibility (shadows!)
@@ -112,51 +422,24 @@ glm::vec3 computeLightContribution(const Scene& scene, const BvhInterface& bvh,
         // If shading is enabled, compute the contribution from all lights.
         // Creating a nul vector which will be the result of all computation of all light sources
         glm::vec3 res = { 0.0, 0.0, 0.0 };
-        // Iterating through all the light sources
-        for (const auto& light : scene.lights) {
-            if (std::holds_alternative<PointLight>(light)) {
-                // If the light is a PointLight, add the result of the computeShading method to the res vector
-                const PointLight pointLight = std::get<PointLight>(light);
-                if(features.enableHardShadow) {
-                    res += computeShading(pointLight.position, pointLight.color, features, ray, hitInfo)
-                        * testVisibilityLightSample(pointLight.position, pointLight.color, bvh, features, ray, hitInfo);
-                } else{
-                    res += computeShading(pointLight.position, pointLight.color, features, ray, hitInfo);
-                }
-            } else if (std::holds_alternative<SegmentLight>(light)) {
-                const SegmentLight segmentLight = std::get<SegmentLight>(light);
-                if (features.enableSoftShadow) {
-                    const size_t N = 100;
-                    for (size_t t = 0; t < N; t++) {
-                        float r = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-                        auto trand = (float)t + r;
-                        auto position = glm::vec3(0.0);
-                        auto color = glm::vec3(0.0);
-                        sampleSegmentLight(segmentLight, position, color, trand / (float)N);
-
-                        res += computeShading(position, color, features, ray, hitInfo) / (float)N
-                            * testVisibilityLightSample(position, color, bvh, features, ray, hitInfo);
-                    }
-                }
-            } else if (std::holds_alternative<ParallelogramLight>(light)) {
-                const ParallelogramLight parallelogramLight = std::get<ParallelogramLight>(light);
-                if (features.enableSoftShadow) {
-                    const size_t N = 10;
-                    for (size_t i = 0; i < N; i++) {
-                        for (size_t j = 0; j < N; j++) {
-                            float r1 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-                            float r2 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-                            auto xrand = (float)i + r1;
-                            auto yrand = (float)j + r2;
-                            auto position = glm::vec3(0.0);
-                            auto color = glm::vec3(0.0);
-                            sampleParallelogramLight(parallelogramLight, position, color, xrand / (float)N, yrand / (float)N);
-                            res += computeShading(position, color, features, ray, hitInfo) / (float)(N * N)
-                                * testVisibilityLightSample(position, color, bvh, features, ray, hitInfo);
-                        }
-                    }
-                }
+
+        if (!scene.lightSet) {
+            res += computeUncompiledLightsContribution(scene, bvh, features, ray, hitInfo);
+        } else if (features.extra.enableLightSampling && scene.lightTree) {
+            // Only evaluate a fixed number of lights, picked by their estimated contribution to this point.
+            const glm::vec3 intersectionPoint = ray.origin + ray.direction * ray.t;
+            const int N = std::max(features.extra.lightSamples, 1);
+            for (int i = 0; i < N; i++) {
+                const float r = static_cast<float>(rand()) / (static_cast<float>(RAND_MAX) + 1.0f);
+                const LightTree::Sample sample = scene.lightTree->sample(intersectionPoint, r);
+                if (sample.probability > 0.0f)
+                    res += sampleLightContribution(*scene.lightSet, sample.lightIndex, bvh, features, ray, hitInfo) / (sample.probability * static_cast<float>(N));
             }
+        } else {
+            res += computeAllLightsContribution(*scene.lightSet, bvh, features, ray, hitInfo);
+        }
+        if (features.extra.enableImageBasedLighting && scene.environmentMap) {
+            res += computeEnvironmentContribution(*scene.environmentMap, bvh, features, ray, hitInfo);
         }
         return res;
     } else {
@@ -12,5 +12,11 @@ void sampleParallelogramLight (const ParallelogramLight& parallelogramLight, glm
 
 float testVisibilityLightSample(const glm::vec3& samplePos, const glm::vec3& debugColor, const BvhInterface& bvh, const Features& features, Ray ray, HitInfo hitInfo);
 
+// Compile the lights of the scene into scene.lightSet (and scene.lightTree for many-light sampling); call
+// whenever the lights or features changed before rendering.
+void compileSceneLights(Scene& scene, const Features& features);
+
+// Lights compiled by compileSceneLights() are shaded in batches and use the light tree and shadow caches. Otherwise
+// every light is evaluated straight from scene.lights, which is slower but gives the same result up to sampling noise.
 glm::vec3 computeLightContribution(const Scene& scene, const BvhInterface& bvh, const Features& features, Ray ray, HitInfo hitInfo);
 
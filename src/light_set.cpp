@@ -0,0 +1,59 @@
+#include "light_set.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+
+float lightPower(const glm::vec3& color)
+{
+    // Luminance of the color.
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+LightSet compileLights(std::span<const std::variant<PointLight, SegmentLight, ParallelogramLight>> lights)
+{
+    LightSet lightSet;
+    lightSet.lights.reserve(lights.size());
+    for (const auto& light : lights) {
+        if (std::holds_alternative<PointLight>(light)) {
+            const PointLight& pointLight = std::get<PointLight>(light);
+            LightSet::PointLights& pointLights = lightSet.pointLights;
+            lightSet.lights.push_back({ LightSet::Type::Point, static_cast<uint32_t>(pointLights.size()) });
+            pointLights.positionX.push_back(pointLight.position.x);
+            pointLights.positionY.push_back(pointLight.position.y);
+            pointLights.positionZ.push_back(pointLight.position.z);
+            pointLights.colorR.push_back(pointLight.color.r);
+            pointLights.colorG.push_back(pointLight.color.g);
+            pointLights.colorB.push_back(pointLight.color.b);
+            pointLights.power.push_back(lightPower(pointLight.color));
+        } else if (std::holds_alternative<SegmentLight>(light)) {
+            const SegmentLight& segmentLight = std::get<SegmentLight>(light);
+            LightSet::SegmentLights& segmentLights = lightSet.segmentLights;
+            lightSet.lights.push_back({ LightSet::Type::Segment, static_cast<uint32_t>(segmentLights.size()) });
+            segmentLights.endpoint0.push_back(segmentLight.endpoint0);
+            segmentLights.endpoint1.push_back(segmentLight.endpoint1);
+            segmentLights.color0.push_back(segmentLight.color0);
+            segmentLights.color1.push_back(segmentLight.color1);
+            segmentLights.length.push_back(glm::length(segmentLight.endpoint1 - segmentLight.endpoint0));
+            segmentLights.power.push_back(lightPower((segmentLight.color0 + segmentLight.color1) / 2.0f));
+        } else {
+            const ParallelogramLight& parallelogramLight = std::get<ParallelogramLight>(light);
+            LightSet::ParallelogramLights& parallelogramLights = lightSet.parallelogramLights;
+            lightSet.lights.push_back({ LightSet::Type::Parallelogram, static_cast<uint32_t>(parallelogramLights.size()) });
+            parallelogramLights.v0.push_back(parallelogramLight.v0);
+            parallelogramLights.edge01.push_back(parallelogramLight.edge01);
+            parallelogramLights.edge02.push_back(parallelogramLight.edge02);
+            parallelogramLights.color0.push_back(parallelogramLight.color0);
+            parallelogramLights.color1.push_back(parallelogramLight.color1);
+            parallelogramLights.color2.push_back(parallelogramLight.color2);
+            parallelogramLights.color3.push_back(parallelogramLight.color3);
+            const glm::vec3 cross = glm::cross(parallelogramLight.edge01, parallelogramLight.edge02);
+            const float area = glm::length(cross);
+            parallelogramLights.normal.push_back(area > 0.0f ? cross / area : glm::vec3(0.0f));
+            parallelogramLights.area.push_back(area);
+            parallelogramLights.power.push_back(lightPower((parallelogramLight.color0 + parallelogramLight.color1 + parallelogramLight.color2 + parallelogramLight.color3) / 4.0f));
+        }
+    }
+    return lightSet;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "common.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <variant>
+#include <vector>
+
+class ShadowMap;
+
+// The lights of a scene compiled into one structure of arrays per light type, so that shading can loop over
+// all lights of a type without visiting (and copying out of) a std::variant per light. Compile the lights with
+// compileLights() before rendering; the result does not follow later changes to the scene.
+struct LightSet {
+    enum class Type : uint32_t {
+        Point,
+        Segment,
+        Parallelogram,
+    };
+    // Where a light of the scene ended up.
+    struct Reference {
+        Type type;
+        uint32_t index; // Index within the arrays of its type.
+    };
+
+    // Point lights are stored per component so that the shading loop over them can be vectorized.
+    struct PointLights {
+        std::vector<float> positionX, positionY, positionZ;
+        std::vector<float> colorR, colorG, colorB;
+        std::vector<float> power;
+        // Visibility cache per light; empty unless shadow map caching is enabled (see compileSceneLights()).
+        std::vector<std::shared_ptr<const ShadowMap>> shadowMaps;
+
+        [[nodiscard]] size_t size() const { return positionX.size(); }
+    };
+    struct SegmentLights {
+        std::vector<glm::vec3> endpoint0, endpoint1;
+        std::vector<glm::vec3> color0, color1;
+        std::vector<float> length;
+        std::vector<float> power;
+
+        [[nodiscard]] size_t size() const { return endpoint0.size(); }
+    };
+    struct ParallelogramLights {
+        std::vector<glm::vec3> v0, edge01, edge02;
+        std::vector<glm::vec3> color0, color1, color2, color3;
+        std::vector<glm::vec3> normal;
+        std::vector<float> area;
+        std::vector<float> power;
+
+        [[nodiscard]] size_t size() const { return v0.size(); }
+    };
+
+    PointLights pointLights;
+    SegmentLights segmentLights;
+    ParallelogramLights parallelogramLights;
+    // Every light of the scene, in the order of Scene::lights.
+    std::vector<Reference> lights;
+};
+
+// Power of a light with the given (average) color, as used to decide which lights matter most.
+[[nodiscard]] float lightPower(const glm::vec3& color);
+
+[[nodiscard]] LightSet compileLights(std::span<const std::variant<PointLight, SegmentLight, ParallelogramLight>> lights);
@@ -0,0 +1,158 @@
+#include "light_tree.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <limits>
+
+static constexpr uint32_t invalidIndex = std::numeric_limits<uint32_t>::max();
+
+static AxisAlignedBox merge(const AxisAlignedBox& lhs, const AxisAlignedBox& rhs)
+{
+    return { glm::min(lhs.lower, rhs.lower), glm::max(lhs.upper, rhs.upper) };
+}
+
+LightTree::LightTree(const LightSet& lightSet, const Features& features)
+    : m_leafOfLight(lightSet.lights.size(), invalidIndex)
+{
+    std::vector<Entry> entries;
+    for (uint32_t i = 0; i < lightSet.lights.size(); i++) {
+        const uint32_t index = lightSet.lights[i].index;
+        Entry entry;
+        if (lightSet.lights[i].type == LightSet::Type::Point) {
+            const LightSet::PointLights& pointLights = lightSet.pointLights;
+            const glm::vec3 position { pointLights.positionX[index], pointLights.positionY[index], pointLights.positionZ[index] };
+            entry.box = { position, position };
+            entry.power = pointLights.power[index];
+        } else if (lightSet.lights[i].type == LightSet::Type::Segment) {
+            if (!features.enableSoftShadow)
+                continue;
+            const LightSet::SegmentLights& segmentLights = lightSet.segmentLights;
+            entry.box = { glm::min(segmentLights.endpoint0[index], segmentLights.endpoint1[index]), glm::max(segmentLights.endpoint0[index], segmentLights.endpoint1[index]) };
+            entry.power = segmentLights.power[index];
+        } else {
+            if (!features.enableSoftShadow)
+                continue;
+            const LightSet::ParallelogramLights& parallelogramLights = lightSet.parallelogramLights;
+            const glm::vec3 v0 = parallelogramLights.v0[index];
+            const glm::vec3 v1 = v0 + parallelogramLights.edge01[index];
+            const glm::vec3 v2 = v0 + parallelogramLights.edge02[index];
+            const glm::vec3 v3 = v1 + parallelogramLights.edge02[index];
+            entry.box = { glm::min(glm::min(v0, v1), glm::min(v2, v3)), glm::max(glm::max(v0, v1), glm::max(v2, v3)) };
+            entry.power = parallelogramLights.power[index];
+        }
+        // Lights that do not emit anything are never selected.
+        if (entry.power <= 0.0f)
+            continue;
+        entry.centroid = (entry.box.lower + entry.box.upper) / 2.0f;
+        entry.lightIndex = i;
+        entries.push_back(entry);
+    }
+
+    m_numLights = entries.size();
+    if (entries.empty())
+        return;
+    m_nodes.reserve(2 * entries.size() - 1);
+    m_parents.reserve(2 * entries.size() - 1);
+    m_nodes.emplace_back();
+    m_parents.push_back(invalidIndex);
+    build(0, entries);
+}
+
+void LightTree::build(uint32_t nodeIndex, std::span<Entry> entries)
+{
+    AxisAlignedBox box = entries.front().box;
+    float power = 0.0f;
+    for (const Entry& entry : entries) {
+        box = merge(box, entry.box);
+        power += entry.power;
+    }
+    m_nodes[nodeIndex].box = box;
+    m_nodes[nodeIndex].power = power;
+
+    if (entries.size() == 1) {
+        m_nodes[nodeIndex].isLeaf = true;
+        m_nodes[nodeIndex].index = entries.front().lightIndex;
+        m_leafOfLight[entries.front().lightIndex] = nodeIndex;
+        return;
+    }
+
+    // Split at the median centroid along the axis in which the centroids are spread the most.
+    AxisAlignedBox centroidBox { entries.front().centroid, entries.front().centroid };
+    for (const Entry& entry : entries)
+        centroidBox = merge(centroidBox, { entry.centroid, entry.centroid });
+    const glm::vec3 extent = centroidBox.upper - centroidBox.lower;
+    const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    const size_t middle = entries.size() / 2;
+    std::nth_element(entries.begin(), entries.begin() + static_cast<std::ptrdiff_t>(middle), entries.end(),
+        [axis](const Entry& lhs, const Entry& rhs) { return lhs.centroid[axis] < rhs.centroid[axis]; });
+
+    const uint32_t leftChild = static_cast<uint32_t>(m_nodes.size());
+    m_nodes[nodeIndex].index = leftChild;
+    m_nodes.resize(m_nodes.size() + 2);
+    m_parents.resize(m_parents.size() + 2, nodeIndex);
+    build(leftChild, entries.first(middle));
+    build(leftChild + 1, entries.subspan(middle));
+}
+
+float LightTree::probabilityLeft(const Node& node, const glm::vec3& position) const
+{
+    // The distance to the center of a node is clamped to the radius of the node, so that a shading point inside
+    // (or close to) a cluster of lights does not favor one half of it based on distance alone.
+    const auto importance = [&](const Node& child) {
+        const glm::vec3 center = (child.box.lower + child.box.upper) / 2.0f;
+        const glm::vec3 halfDiagonal = (child.box.upper - child.box.lower) / 2.0f;
+        const glm::vec3 toCenter = center - position;
+        const float distanceSquared = std::max({ glm::dot(toCenter, toCenter), glm::dot(halfDiagonal, halfDiagonal), 1e-4f });
+        return child.power / distanceSquared;
+    };
+    const float left = importance(m_nodes[node.index]);
+    const float right = importance(m_nodes[node.index + 1]);
+    return left + right > 0.0f ? left / (left + right) : 0.5f;
+}
+
+LightTree::Sample LightTree::sample(const glm::vec3& position, float random) const
+{
+    if (m_nodes.empty())
+        return { 0, 0.0f };
+
+    float probability = 1.0f;
+    uint32_t nodeIndex = 0;
+    while (!m_nodes[nodeIndex].isLeaf) {
+        const Node& node = m_nodes[nodeIndex];
+        const float left = probabilityLeft(node, position);
+        // Rescale the random number to [0, 1) so it can be reused by the next level.
+        if (random < left) {
+            random = std::min(random / left, 1.0f - std::numeric_limits<float>::epsilon());
+            probability *= left;
+            nodeIndex = node.index;
+        } else {
+            random = std::min((random - left) / (1.0f - left), 1.0f - std::numeric_limits<float>::epsilon());
+            probability *= 1.0f - left;
+            nodeIndex = node.index + 1;
+        }
+    }
+    return { m_nodes[nodeIndex].index, probability };
+}
+
+float LightTree::probability(const glm::vec3& position, uint32_t lightIndex) const
+{
+    if (lightIndex >= m_leafOfLight.size() || m_leafOfLight[lightIndex] == invalidIndex)
+        return 0.0f;
+
+    float probability = 1.0f;
+    for (uint32_t nodeIndex = m_leafOfLight[lightIndex]; m_parents[nodeIndex] != invalidIndex; nodeIndex = m_parents[nodeIndex]) {
+        const Node& parent = m_nodes[m_parents[nodeIndex]];
+        const float left = probabilityLeft(parent, position);
+        probability *= parent.index == nodeIndex ? left : 1.0f - left;
+    }
+    return probability;
+}
+
+size_t LightTree::numLights() const
+{
+    return m_numLights;
+}
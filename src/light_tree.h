@@ -0,0 +1,58 @@
+#pragma once
+#include "common.h"
+#include "light_set.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over the lights of a scene, used to pick a few lights per shading point instead of
+// evaluating all of them. Each node stores the bounds and the total power (luminance of the average color) of the
+// lights below it (see lightPower()). A light is selected by walking down from the root and choosing a child with a probability
+// proportional to its power divided by its squared distance to the shading point, so nearby bright lights are
+// picked most often and the cost per shading point grows with the depth of the tree instead of the light count.
+class LightTree {
+public:
+    struct Sample {
+        uint32_t lightIndex; // Index into LightSet::lights.
+        float probability; // Probability of having selected this light; 0 if there is nothing to sample.
+    };
+
+    // Area lights (segment and parallelogram) only emit light with soft shadows enabled; without they are skipped.
+    LightTree(const LightSet& lightSet, const Features& features);
+
+    // Select a light for the given shading point using a uniform random number in [0, 1).
+    [[nodiscard]] Sample sample(const glm::vec3& position, float random) const;
+    // Probability with which sample() selects the given light at the given shading point.
+    [[nodiscard]] float probability(const glm::vec3& position, uint32_t lightIndex) const;
+
+    [[nodiscard]] size_t numLights() const;
+
+private:
+    struct Node {
+        AxisAlignedBox box;
+        float power = 0.0f;
+        uint32_t isLeaf = false;
+        // Leaf: index of the light. Otherwise: index of the left child; the right child follows it directly.
+        uint32_t index = 0;
+    };
+    struct Entry {
+        AxisAlignedBox box;
+        glm::vec3 centroid;
+        float power;
+        uint32_t lightIndex;
+    };
+
+    void build(uint32_t nodeIndex, std::span<Entry> entries);
+    // Probability of descending into the left child of the node.
+    [[nodiscard]] float probabilityLeft(const Node& node, const glm::vec3& position) const;
+
+private:
+    std::vector<Node> m_nodes;
+    // Leaf node of every light and parent of every node, to walk up the tree when computing the probability of a light.
+    std::vector<uint32_t> m_leafOfLight;
+    std::vector<uint32_t> m_parents;
+    size_t m_numLights = 0;
+};
@@ -0,0 +1,310 @@
+#include "linear_bvh.h"
+#include "scene.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <limits>
+#include <numeric>
+
+void radixSort(std::span<uint64_t> keys, std::span<uint32_t> values)
+{
+    constexpr size_t blockSize = 1 << 14;
+    const size_t numBlocks = (keys.size() + blockSize - 1) / blockSize;
+    std::vector<uint64_t> keyBuffer(keys.size());
+    std::vector<uint32_t> valueBuffer(values.size());
+    std::vector<std::array<uint32_t, 256>> offsets(numBlocks);
+
+    std::span<uint64_t> srcKeys = keys, dstKeys = keyBuffer;
+    std::span<uint32_t> srcValues = values, dstValues = valueBuffer;
+    for (int shift = 0; shift < 64; shift += 8) {
+#pragma omp parallel for
+        for (int block = 0; block < static_cast<int>(numBlocks); block++) {
+            auto& histogram = offsets[size_t(block)];
+            histogram.fill(0);
+            const size_t end = std::min(size_t(block + 1) * blockSize, keys.size());
+            for (size_t i = size_t(block) * blockSize; i < end; i++)
+                histogram[(srcKeys[i] >> shift) & 0xFF]++;
+        }
+
+        // Turn the counts into the position of the first key of every digit in every block. Blocks are laid out
+        // one after another within a digit so that the sort is stable.
+        bool sorted = false;
+        uint32_t position = 0;
+        for (size_t digit = 0; digit < 256; digit++) {
+            const uint32_t digitStart = position;
+            for (auto& histogram : offsets) {
+                const uint32_t count = histogram[digit];
+                histogram[digit] = position;
+                position += count;
+            }
+            sorted |= position - digitStart == keys.size();
+        }
+        if (sorted)
+            continue;
+
+#pragma omp parallel for
+        for (int block = 0; block < static_cast<int>(numBlocks); block++) {
+            auto& positions = offsets[size_t(block)];
+            const size_t end = std::min(size_t(block + 1) * blockSize, keys.size());
+            for (size_t i = size_t(block) * blockSize; i < end; i++) {
+                const uint32_t target = positions[(srcKeys[i] >> shift) & 0xFF]++;
+                dstKeys[target] = srcKeys[i];
+                dstValues[target] = srcValues[i];
+            }
+        }
+        std::swap(srcKeys, dstKeys);
+        std::swap(srcValues, dstValues);
+    }
+    if (srcKeys.data() != keys.data()) {
+        std::copy(std::begin(srcKeys), std::end(srcKeys), std::begin(keys));
+        std::copy(std::begin(srcValues), std::end(srcValues), std::begin(values));
+    }
+}
+
+// Spread the lowest 21 bits of x out such that there are two zero bits between every pair of them.
+static uint64_t expandBits(uint64_t x)
+{
+    x &= 0x1FFFFF;
+    x = (x | x << 32) & 0x1F00000000FFFF;
+    x = (x | x << 16) & 0x1F0000FF0000FF;
+    x = (x | x << 8) & 0x100F00F00F00F00F;
+    x = (x | x << 4) & 0x10C30C30C30C30C3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+uint64_t mortonCode(const glm::vec3& point, const AxisAlignedBox& bounds)
+{
+    constexpr float scale = float((1 << 21) - 1);
+    uint64_t code = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        const float extent = bounds.upper[axis] - bounds.lower[axis];
+        const float relative = extent > 0.0f ? std::clamp((point[axis] - bounds.lower[axis]) / extent, 0.0f, 1.0f) : 0.0f;
+        code |= expandBits(uint64_t(relative * scale)) << (2 - axis);
+    }
+    return code;
+}
+
+namespace {
+// Binary radix tree over the sorted primitives: inner nodes [0, n - 1) with the root at 0, followed by one leaf
+// per primitive (leaf k holds the k-th primitive along the Morton curve).
+struct RadixTree {
+    struct TreeNode {
+        AxisAlignedBox box;
+        std::array<uint32_t, 2> children;
+        uint32_t count; // Number of primitives below the node.
+    };
+
+    std::vector<TreeNode> nodes;
+    std::vector<uint32_t> order; // Primitive of every leaf.
+    uint32_t numInner;
+
+    [[nodiscard]] bool isLeaf(uint32_t node) const { return node >= numInner; }
+};
+}
+
+static AxisAlignedBox merge(const AxisAlignedBox& lhs, const AxisAlignedBox& rhs)
+{
+    return { glm::min(lhs.lower, rhs.lower), glm::max(lhs.upper, rhs.upper) };
+}
+
+static float surfaceArea(const AxisAlignedBox& box)
+{
+    const glm::vec3 extent = box.upper - box.lower;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+// Find the children of every inner node (Karras 2012, figure 4) and compute the boxes from the leaves up.
+static void buildRadixTree(RadixTree& tree, std::span<const uint64_t> codes, std::span<const AxisAlignedBox> primitiveBoxes)
+{
+    const int64_t n = int64_t(codes.size());
+    tree.numInner = uint32_t(n - 1);
+    tree.nodes.resize(size_t(2 * n - 1));
+    std::vector<uint32_t> parents(tree.nodes.size(), 0);
+
+    // Length of the common prefix of the keys i and j; equal codes are told apart by their index.
+    const auto delta = [&](int64_t i, int64_t j) -> int {
+        if (j < 0 || j >= n)
+            return -1;
+        if (codes[size_t(i)] == codes[size_t(j)])
+            return 64 + std::countl_zero(uint64_t(i ^ j));
+        return std::countl_zero(codes[size_t(i)] ^ codes[size_t(j)]);
+    };
+#pragma omp parallel for
+    for (int64_t i = 0; i < n - 1; i++) {
+        // The node covers a range of keys starting (or ending) at i, extending in the direction of the longer prefix.
+        const int64_t d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+        const int deltaMin = delta(i, i - d);
+        int64_t maxLength = 2;
+        while (delta(i, i + maxLength * d) > deltaMin)
+            maxLength *= 2;
+        int64_t length = 0;
+        for (int64_t step = maxLength / 2; step >= 1; step /= 2) {
+            if (delta(i, i + (length + step) * d) > deltaMin)
+                length += step;
+        }
+        const int64_t j = i + length * d;
+
+        // Split where the common prefix of the range ends.
+        const int deltaNode = delta(i, j);
+        int64_t split = 0, step = length;
+        do {
+            step = (step + 1) / 2;
+            if (delta(i, i + (split + step) * d) > deltaNode)
+                split += step;
+        } while (step > 1);
+        const int64_t gamma = i + split * d + std::min<int64_t>(d, 0);
+
+        const uint32_t left = uint32_t(std::min(i, j) == gamma ? n - 1 + gamma : gamma);
+        const uint32_t right = uint32_t(std::max(i, j) == gamma + 1 ? n + gamma : gamma + 1);
+        tree.nodes[size_t(i)].children = { left, right };
+        parents[left] = uint32_t(i);
+        parents[right] = uint32_t(i);
+    }
+
+    // Walk up from every leaf; the second thread to arrive at a node computes its box.
+    std::vector<std::atomic<uint32_t>> arrivals(size_t(tree.numInner));
+#pragma omp parallel for
+    for (int64_t k = 0; k < n; k++) {
+        auto& leaf = tree.nodes[size_t(tree.numInner + k)];
+        leaf.box = primitiveBoxes[tree.order[size_t(k)]];
+        leaf.count = 1;
+        leaf.children = { 0, 0 };
+        uint32_t node = tree.numInner + uint32_t(k);
+        while (node != 0) {
+            node = parents[node];
+            if (arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+                break;
+            auto& inner = tree.nodes[node];
+            const auto& left = tree.nodes[inner.children[0]];
+            const auto& right = tree.nodes[inner.children[1]];
+            inner.box = merge(left.box, right.box);
+            inner.count = left.count + right.count;
+        }
+    }
+}
+
+// One pass of tree rotations (Kensler 2008), bottom up: swap a child of the node with a grandchild on the other
+// side if that shrinks the surface area of the child that receives it. The box of the node itself does not change.
+static void rotateSubtree(RadixTree& tree, uint32_t nodeIndex)
+{
+    if (tree.isLeaf(nodeIndex))
+        return;
+    auto& node = tree.nodes[nodeIndex];
+    rotateSubtree(tree, node.children[0]);
+    rotateSubtree(tree, node.children[1]);
+
+    float bestGain = 0.0f;
+    int bestSide = -1, bestGrandchild = -1;
+    for (int side = 0; side < 2; side++) {
+        // Move the child at 1 - side into the other child, in place of one of its children.
+        const uint32_t other = node.children[size_t(side)];
+        if (tree.isLeaf(other))
+            continue;
+        const auto& otherNode = tree.nodes[other];
+        const auto& moved = tree.nodes[node.children[size_t(1 - side)]];
+        for (int grandchild = 0; grandchild < 2; grandchild++) {
+            const auto& kept = tree.nodes[otherNode.children[size_t(1 - grandchild)]];
+            const float gain = surfaceArea(otherNode.box) - surfaceArea(merge(moved.box, kept.box));
+            if (gain > bestGain) {
+                bestGain = gain;
+                bestSide = side;
+                bestGrandchild = grandchild;
+            }
+        }
+    }
+    if (bestSide < 0)
+        return;
+
+    auto& otherNode = tree.nodes[node.children[size_t(bestSide)]];
+    std::swap(node.children[size_t(1 - bestSide)], otherNode.children[size_t(bestGrandchild)]);
+    const auto& left = tree.nodes[otherNode.children[0]];
+    const auto& right = tree.nodes[otherNode.children[1]];
+    otherNode.box = merge(left.box, right.box);
+    otherNode.count = left.count + right.count;
+}
+
+namespace {
+struct Emitter {
+    const RadixTree& tree;
+    const std::vector<Primitive>& inputPrimitives;
+    const BvhSettings& settings;
+    std::vector<Node> nodes;
+    std::vector<Primitive> primitives;
+
+    void gatherPrimitives(uint32_t treeNode)
+    {
+        if (tree.isLeaf(treeNode)) {
+            primitives.push_back(inputPrimitives[tree.order[treeNode - tree.numInner]]);
+            return;
+        }
+        gatherPrimitives(tree.nodes[treeNode].children[0]);
+        gatherPrimitives(tree.nodes[treeNode].children[1]);
+    }
+
+    uint32_t emit(uint32_t treeNode, int level)
+    {
+        const auto& node = tree.nodes[treeNode];
+        if (tree.isLeaf(treeNode) || node.count <= uint32_t(settings.leafSize) || level > settings.maxDepth) {
+            const uint32_t offset = uint32_t(primitives.size());
+            gatherPrimitives(treeNode);
+            nodes.push_back(Node { .box = node.box, .level = level, .isLeaf = true, .first = offset, .second = uint32_t(primitives.size()) - offset });
+            return uint32_t(nodes.size() - 1);
+        }
+        const uint32_t leftIndex = emit(node.children[0], level + 1);
+        const uint32_t rightIndex = emit(node.children[1], level + 1);
+        nodes.push_back(Node { .box = node.box, .level = level, .isLeaf = false, .first = leftIndex, .second = rightIndex });
+        return uint32_t(nodes.size() - 1);
+    }
+};
+}
+
+std::vector<Node> buildLinearBvh(std::vector<Primitive>& primitives, const Scene& scene, const BvhSettings& settings)
+{
+    const size_t n = primitives.size();
+    if (n == 0)
+        return {};
+
+    std::vector<glm::vec3> centroids(n);
+    std::vector<AxisAlignedBox> primitiveBoxes(n);
+#pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(n); i++) {
+        const auto it = std::begin(primitives) + i;
+        centroids[size_t(i)] = getMedian(*it, scene);
+        primitiveBoxes[size_t(i)] = getBox(it, it + 1, scene);
+    }
+    AxisAlignedBox centroidBounds { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest()) };
+    for (const auto& centroid : centroids)
+        centroidBounds = merge(centroidBounds, { centroid, centroid });
+
+    RadixTree tree;
+    std::vector<uint64_t> codes(n);
+    tree.order.resize(n);
+    std::iota(std::begin(tree.order), std::end(tree.order), 0u);
+#pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(n); i++)
+        codes[size_t(i)] = mortonCode(centroids[size_t(i)], centroidBounds);
+    radixSort(codes, tree.order);
+
+    if (n == 1) {
+        tree.numInner = 0;
+        tree.nodes = { { .box = primitiveBoxes[0], .children = { 0, 0 }, .count = 1 } };
+    } else {
+        buildRadixTree(tree, codes, primitiveBoxes);
+        for (int pass = 0; pass < settings.optimizationPasses; pass++)
+            rotateSubtree(tree, 0);
+    }
+
+    Emitter emitter { .tree = tree, .inputPrimitives = primitives, .settings = settings, .nodes = {}, .primitives = {} };
+    emitter.nodes.reserve(tree.nodes.size());
+    emitter.primitives.reserve(n);
+    emitter.emit(0, 0);
+    primitives = std::move(emitter.primitives);
+    return std::move(emitter.nodes);
+}
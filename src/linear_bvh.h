@@ -0,0 +1,28 @@
+#pragma once
+#include "bounding_volume_hierarchy.h"
+#include "common.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Forward declaration.
+struct Scene;
+
+// Sort (key, value) pairs by key with a least significant digit radix sort, eight bits per pass. Every pass
+// counts and scatters blocks of the input in parallel; passes in which all keys share the same digit are skipped.
+void radixSort(std::span<uint64_t> keys, std::span<uint32_t> values);
+
+// 63-bit Morton code (21 bits per axis) of a point, quantized within the given box.
+[[nodiscard]] uint64_t mortonCode(const glm::vec3& point, const AxisAlignedBox& bounds);
+
+// Linear BVH builder (Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees", 2012).
+// The primitives are sorted along a Morton curve through their centroids, after which every inner node of a binary
+// radix tree over the sorted codes can be found independently of the others. That takes linear time and runs in
+// parallel, in exchange for trees that are slower to trace than those of the recursive builders.
+// settings.optimizationPasses passes of tree rotations (Kensler, "Tree Rotations for Improving Bounding Volume
+// Hierarchies", 2008) win back part of the difference. Subtrees that satisfy settings.leafSize or settings.maxDepth
+// are collapsed into leaves like in the other builders.
+//
+// Returns the nodes in the layout of BoundingVolumeHierarchy (children before parents, root last) and reorders
+// primitives such that every leaf covers a contiguous range.
+[[nodiscard]] std::vector<Node> buildLinearBvh(std::vector<Primitive>& primitives, const Scene& scene, const BvhSettings& settings);
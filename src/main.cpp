@@ -1,8 +1,12 @@
+#include "bvh_statistics.h"
 #include "config.h"
 #include "draw.h"
+#include "environment_map.h"
 #include "light.h"
 #include "render.h"
+#include "render_server.h"
 #include "screen.h"
+#include "trace.h"
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
@@ -16,9 +20,12 @@ DISABLE_WARNINGS_PUSH()
 #include <nativefiledialog/nfd.h>
 DISABLE_WARNINGS_POP()
 #include <chrono>
+#include <csignal>
 #include <cstdlib>
 #include <filesystem>
 #include <framework/imguizmo.h>
+#include <framework/mesh_cache.h>
+#include <framework/texture_cache.h>
 #include <framework/trackball.h>
 #include <framework/variant_helper.h>
 #include <framework/window.h>
@@ -26,6 +33,7 @@ DISABLE_WARNINGS_POP()
 #include <optional>
 #include <random>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <variant>
 #include <bounding_volume_hierarchy.h>
@@ -33,7 +41,8 @@ DISABLE_WARNINGS_POP()
 // This is the main application. The code in here does not need to be modified.
 enum class ViewMode {
     Rasterization = 0,
-    RayTracing = 1
+    RayTracing = 1,
+    CostHeatmap = 2
 };
 // threshold above which the values are boxfiltered
 float threshold = 0.5f;
@@ -46,6 +55,8 @@ int numRays = 1;
 
 int debugBVHLeafId = 0;
 
+static BvhInterface buildBvh(Scene& scene, const Config& config, const std::string& sceneName);
+static void rotateMeshVertically(Mesh& mesh, float degrees);
 static void setOpenGLMatrices(const Trackball& camera);
 static void drawLightsOpenGL(const Scene& scene, const Trackball& camera, int selectedLight);
 static void drawSceneOpenGL(const Scene& scene);
@@ -53,15 +64,57 @@ bool sliderIntSquarePower(const char* label, int* v, int v_min, int v_max);
 
 int main(int argc, char** argv)
 {
+    // Usage: FinalProject [config.toml] [--trace trace.json] [--serve | --socket path]
+    std::optional<std::filesystem::path> configFile, traceFile, socketFile;
+    bool serve = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string_view(argv[i]) == "--trace" && i + 1 < argc)
+            traceFile = std::filesystem::absolute(argv[++i]);
+        else if (std::string_view(argv[i]) == "--serve")
+            serve = true;
+        else if (std::string_view(argv[i]) == "--socket" && i + 1 < argc)
+            socketFile = argv[++i];
+        else
+            configFile = argv[i];
+    }
+
     Config config = {};
-    if (argc > 1) {
-        config = readConfigFile(argv[1]);
+    if (configFile) {
+        config = readConfigFile(*configFile);
     } else {
         // Add a default camera if no config file is given.
         config.cameras.emplace_back(CameraConfig {});
     }
-
-    if (!config.cliRenderingEnabled) {
+    if (traceFile)
+        config.traceFile = *traceFile;
+    enableTracing = !config.traceFile.empty();
+    setMeshCacheDirectory(config.cacheDir);
+    std::vector<InstanceDescription> instances;
+    std::transform(std::begin(config.instances), std::end(config.instances), std::back_inserter(instances), describeInstance);
+    setDefaultImageLayout(config.textureLayout);
+    setTextureCacheBudget(config.textureCacheBudget);
+    // Not decoded until the first ray misses with environment mapping enabled.
+    const auto pEnvironmentMap = std::make_shared<const EnvironmentMap>(config.environmentMap, config.environmentMapLayout);
+
+    if (serve || socketFile) {
+        // Render server: requests are read from stdin (responses go to stdout, so log to stderr) or a socket.
+        std::cerr << config;
+        enableDebugDraw = false;
+        RenderServer server { config.outputDir };
+        if (socketFile) {
+            // Answer the queued requests and remove the socket when interrupted or terminated.
+            static RenderServer* pSocketServer = &server;
+            for (const int signalNumber : { SIGINT, SIGTERM })
+                std::signal(signalNumber, [](int) { pSocketServer->stop(); });
+            const bool served = server.serveSocket(*socketFile);
+            for (const int signalNumber : { SIGINT, SIGTERM })
+                std::signal(signalNumber, SIG_DFL);
+            if (!served)
+                return 1;
+        } else {
+            server.serve(std::cin, std::cout);
+        }
+    } else if (!config.cliRenderingEnabled) {
         Trackball::printHelp();
         std::cout << "\n Press the [R] key on your keyboard to create a ray towards the mouse cursor" << std::endl
                   << std::endl;
@@ -74,7 +127,9 @@ int main(int argc, char** argv)
         SceneType sceneType { SceneType::SingleTriangle };
         std::optional<Ray> optDebugRay;
         Scene scene = loadScenePrebuilt(sceneType, config.dataPath);
-        BvhInterface bvh { &scene, config.features };
+        addInstances(scene, instances);
+        scene.environmentMap = pEnvironmentMap;
+        BvhInterface bvh = buildBvh(scene, config, serialize(sceneType));
 
         int bvhDebugLevel = 0;
         int bvhDebugLeaf = 0;
@@ -83,6 +138,7 @@ int main(int argc, char** argv)
         bool debugBVHLeaf { false };
         bool debugSahLevel { false };
         ViewMode viewMode { ViewMode::Rasterization };
+        CostMetric costMetric { CostMetric::Nodes };
 
         window.registerKeyCallback([&](int key, int /* scancode */, int action, int /* mods */) {
             if (action == GLFW_PRESS) {
@@ -107,6 +163,27 @@ int main(int argc, char** argv)
         });
 
         int selectedLightIdx = scene.lights.empty() ? -1 : 0;
+        // Lights and features that scene.lightSet was compiled from.
+        decltype(scene.lights) compiledLights;
+        Features compiledFeatures;
+        int selectedInstanceIdx = 0;
+        int selectedMeshIdx = 0;
+        float selectedMeshAngle = 0.0f;
+        // Called after switching scenes or changing the BVH build settings.
+        const auto rebuildBvh = [&]() {
+            using clock = std::chrono::high_resolution_clock;
+            const auto start = clock::now();
+            bvh = buildBvh(scene, config, serialize(sceneType));
+            const auto end = clock::now();
+            std::cout << "Time to generate BVH "
+                      << (config.features.extra.enableBvhSahBinning ? "+ SAH: " : ": ")
+                      << std::chrono::duration<float, std::milli>(end - start).count() << " milliseconds" << std::endl;
+
+            if (optDebugRay) {
+                HitInfo dummy {};
+                bvh.intersect(*optDebugRay, dummy, config.features);
+            }
+        };
         while (!window.shouldClose()) {
             window.updateInput();
 
@@ -128,26 +205,23 @@ int main(int argc, char** argv)
                 if (ImGui::Combo("Scenes", reinterpret_cast<int*>(&sceneType), items.data(), int(items.size()))) {
                     optDebugRay.reset();
                     scene = loadScenePrebuilt(sceneType, config.dataPath);
+                    addInstances(scene, instances);
+                    scene.environmentMap = pEnvironmentMap;
                     selectedLightIdx = scene.lights.empty() ? -1 : 0;
-
-                    using clock = std::chrono::high_resolution_clock;
-                    const auto start = clock::now();
-                    bvh = BvhInterface(&scene, config.features);
-                    const auto end = clock::now();
-                    std::cout << "Time to generate BVH "
-                              << (config.features.extra.enableBvhSahBinning ? "+ SAH: " : ": ")
-                              << std::chrono::duration<float, std::milli>(end - start).count() << " milliseconds" << std::endl;
-
-                    if (optDebugRay) {
-                        HitInfo dummy {};
-                        bvh.intersect(*optDebugRay, dummy, config.features);
-                    }
+                    selectedInstanceIdx = 0;
+                    selectedMeshIdx = 0;
+                    selectedMeshAngle = 0.0f;
+                    rebuildBvh();
                 }
             }
             {
-                constexpr std::array items { "Rasterization", "Ray Traced" };
+                constexpr std::array items { "Rasterization", "Ray Traced", "Cost heatmap" };
                 ImGui::Combo("View mode", reinterpret_cast<int*>(&viewMode), items.data(), int(items.size()));
             }
+            if (viewMode == ViewMode::CostHeatmap) {
+                constexpr std::array items { "Time", "BVH nodes visited", "Primitives tested" };
+                ImGui::Combo("Heatmap metric", reinterpret_cast<int*>(&costMetric), items.data(), int(items.size()));
+            }
 
             ImGui::Separator();
             if (ImGui::CollapsingHeader("Features", ImGuiTreeNodeFlags_DefaultOpen)) {
@@ -163,7 +237,35 @@ int main(int argc, char** argv)
 
             if (ImGui::CollapsingHeader("Extra Features")) {
                 ImGui::Checkbox("Environment mapping", &config.features.extra.enableEnvironmentMapping);
+                ImGui::Checkbox("Image based lighting", &config.features.extra.enableImageBasedLighting);
+                if (config.features.extra.enableImageBasedLighting) {
+                    ImGui::SliderInt("Environment light samples", &config.features.extra.environmentLightSamples, 1, 256);
+                }
+                ImGui::Checkbox("Many-light sampling", &config.features.extra.enableLightSampling);
+                if (config.features.extra.enableLightSampling) {
+                    ImGui::SliderInt("Lights per shaded point", &config.features.extra.lightSamples, 1, 64);
+                }
+                ImGui::Checkbox("Occluder cache", &config.features.extra.enableOccluderCache);
+                ImGui::Checkbox("Shadow map cache", &config.features.extra.enableShadowMapCache);
+                if (config.features.extra.enableShadowMapCache) {
+                    ImGui::SliderInt("Shadow map resolution", &config.features.extra.shadowMapResolution, 16, 2048);
+                }
                 ImGui::Checkbox("BVH SAH binning", &config.features.extra.enableBvhSahBinning);
+                {
+                    constexpr std::array qualities { "Full", "Fast (Morton codes)", "High (spatial splits)" };
+                    if (ImGui::Combo("BVH build quality", reinterpret_cast<int*>(&config.features.bvh.buildQuality), qualities.data(), int(qualities.size())))
+                        rebuildBvh();
+                    if (config.features.bvh.buildQuality == BvhBuildQuality::Fast) {
+                        ImGui::SliderInt("BVH rotation passes", &config.features.bvh.optimizationPasses, 0, 8);
+                        // Rebuild once the slider is released rather than for every value it passes.
+                        if (ImGui::IsItemDeactivatedAfterEdit())
+                            rebuildBvh();
+                    } else if (config.features.bvh.buildQuality == BvhBuildQuality::High) {
+                        ImGui::SliderFloat("BVH spatial split memory", &config.features.bvh.spatialSplitMemoryFactor, 1.0f, 4.0f);
+                        if (ImGui::IsItemDeactivatedAfterEdit())
+                            rebuildBvh();
+                    }
+                }
                 ImGui::Checkbox("Bloom effect", &config.features.extra.enableBloomEffect);
                 if (config.features.extra.enableBloomEffect) {
                     ImGui::SliderFloat("Threshold", &threshold, 0.0f, 1.0f);
@@ -221,9 +323,11 @@ int main(int argc, char** argv)
                     // Perform a new render and measure the time it took to generate the image.
                     using clock = std::chrono::high_resolution_clock;
                     const auto start = clock::now();
-                    renderRayTracing(scene, camera, bvh, screen, config.features, threshold, 2 * boxSize + 1, numRays);
+                    const int samples = renderRayTracing(scene, camera, bvh, screen, config.features, threshold, 2 * boxSize + 1, numRays,
+                        nullptr, CostMetric::Time, config.timeBudgetMs);
                     const auto end = clock::now();
-                    std::cout << "Time to render image: " << std::chrono::duration<float, std::milli>(end - start).count() << " milliseconds" << std::endl;
+                    std::cout << "Time to render image: " << std::chrono::duration<float, std::milli>(end - start).count() << " milliseconds, "
+                              << samples << " samples per pixel" << std::endl;
                     // Store the new image.
                     screen.writeBitmapToFile(outPath);
                 }
@@ -359,6 +463,38 @@ int main(int argc, char** argv)
                 scene.lights.erase(std::begin(scene.lights) + selectedLightIdx);
                 selectedLightIdx = -1;
             }
+            // Recompile the lights only once they or the features were edited (above or by switching scenes), so
+            // that the light BVH and the lazily traced shadow maps are reused by the following frames.
+            if (!scene.lightSet || scene.lights != compiledLights || config.features != compiledFeatures) {
+                compileSceneLights(scene, config.features);
+                compiledLights = scene.lights;
+                compiledFeatures = config.features;
+            }
+
+            if (!scene.instances.empty()) {
+                ImGui::Spacing();
+                ImGui::Separator();
+                ImGui::Text("Instances");
+                ImGui::SliderInt("Selected instance", &selectedInstanceIdx, 0, int(scene.instances.size()) - 1);
+                // Moving an instance only rebuilds the top level of the BVH.
+                glm::mat4x3 transform = scene.instances[size_t(selectedInstanceIdx)].transform;
+                if (ImGui::DragFloat3("Translation", glm::value_ptr(transform[3]), 0.01f))
+                    bvh.setInstanceTransform(uint32_t(selectedInstanceIdx), transform);
+            } else if (!scene.meshes.empty()) {
+                ImGui::Spacing();
+                ImGui::Separator();
+                ImGui::Text("Meshes");
+                if (ImGui::SliderInt("Selected mesh", &selectedMeshIdx, 0, int(scene.meshes.size()) - 1))
+                    selectedMeshAngle = 0.0f;
+                // Turning a mesh moves its vertices; the BVH is refitted rather than rebuilt.
+                float angle = selectedMeshAngle;
+                if (ImGui::SliderFloat("Turntable angle", &angle, -180.0f, 180.0f)) {
+                    rotateMeshVertically(scene.meshes[size_t(selectedMeshIdx)], angle - selectedMeshAngle);
+                    selectedMeshAngle = angle;
+                    if (bvh.refit(config.features))
+                        std::cout << "BVH quality degraded too much by refitting; rebuilt it" << std::endl;
+                }
+            }
 
             // Clear screen.
             glViewport(0, 0, window.getFrameBufferSize().x, window.getFrameBufferSize().y);
@@ -424,6 +560,12 @@ int main(int argc, char** argv)
                 screen.setPixel(0, 0, glm::vec3(1.0f));
                 screen.draw(); // Takes the image generated using ray tracing and outputs it to the screen using OpenGL.
             } break;
+            case ViewMode::CostHeatmap: {
+                // The image itself is rendered off screen; only what each of its pixels cost is shown.
+                Screen imageScreen { screen.resolution(), false };
+                renderRayTracing(scene, camera, bvh, imageScreen, config.features, threshold, 2 * boxSize + 1, numRays, &screen, costMetric);
+                screen.draw();
+            } break;
             default:
                 break;
             }
@@ -454,10 +596,17 @@ int main(int argc, char** argv)
                            sceneName = serialize(type);
                        }),
             config.scene);
-
-        BvhInterface bvh { &scene, config.features };
+        addInstances(scene, instances);
+        scene.environmentMap = pEnvironmentMap;
+        compileSceneLights(scene, config.features);
 
         using clock = std::chrono::high_resolution_clock;
+        const auto buildStart = clock::now();
+        BvhInterface bvh = buildBvh(scene, config, sceneName);
+        const auto buildEnd = clock::now();
+        // The statistics count the traversals of all cameras.
+        const ScopedTraversalCounting traversalCounting { config.writeStatistics };
+
         // Create output directory if it does not exist.
         if (!std::filesystem::exists(config.outputDir)) {
             std::filesystem::create_directories(config.outputDir);
@@ -469,15 +618,26 @@ int main(int argc, char** argv)
 
         for (int i = 0; auto const& cameraConfig : config.cameras) {
             workers.emplace_back(std::thread([&](int index) {
+                const TraceScope traceScope { "Camera", index };
                 Screen screen { config.windowSize, false };
                 screen.clear(glm::vec3(0.0f));
                 Trackball camera { &window, glm::radians(cameraConfig.fieldOfView), cameraConfig.distanceFromLookAt };
                 camera.setCamera(cameraConfig.lookAt, glm::radians(cameraConfig.rotation), cameraConfig.distanceFromLookAt);
-                renderRayTracing(scene, camera, bvh, screen, config.features, threshold, 2 * boxSize + 1, numRays);
+                std::optional<Screen> costScreen;
+                if (config.costHeatmap)
+                    costScreen.emplace(config.windowSize, false);
+                const int samples = renderRayTracing(scene, camera, bvh, screen, config.features, threshold, 2 * boxSize + 1, numRays,
+                    costScreen ? &*costScreen : nullptr, config.costHeatmap.value_or(CostMetric::Time), config.timeBudgetMs);
                 const auto filename_base = fmt::format("{}_{}_cam_{}", sceneName, start_time_string, index);
                 const auto filepath = config.outputDir / (filename_base + ".bmp");
-                fmt::print("Image {} saved to {}\n", index, filepath.string());
+                const TraceScope writeTraceScope { "Write image", index };
+                fmt::print("Image {} saved to {} ({} samples per pixel)\n", index, filepath.string(), samples);
                 screen.writeBitmapToFile(filepath);
+                if (costScreen) {
+                    const auto costFilepath = config.outputDir / (filename_base + "_cost.bmp");
+                    fmt::print("Cost heatmap {} saved to {}\n", index, costFilepath.string());
+                    costScreen->writeBitmapToFile(costFilepath);
+                }
             },
                 i));
             ++i;
@@ -488,11 +648,56 @@ int main(int argc, char** argv)
         const auto end = clock::now();
         const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
         fmt::print("Rendering took {} ms, {} images rendered.\n", duration, config.cameras.size());
+        if (config.writeStatistics) {
+            const auto filepath = config.outputDir / fmt::format("{}_{}_statistics.json", sceneName, start_time_string);
+            if (writeStatisticsJson(filepath, sceneName, std::chrono::duration<double, std::milli>(buildEnd - buildStart).count(), bvh.statistics(),
+                    std::chrono::duration<double, std::milli>(end - start).count(), collectTraversalStatistics()))
+                fmt::print("Statistics saved to {}\n", filepath.string());
+            else
+                std::cerr << "Error: Could not write statistics to " << filepath << std::endl;
+        }
+        const auto textureStatistics = textureCacheStatistics();
+        fmt::print("Textures: {} decoded of {} ({:.1f} MB), {} requests shared an existing texture.\n",
+            textureStatistics.numLoaded, textureStatistics.numTextures, static_cast<double>(textureStatistics.memoryUsage) / 1048576.0, textureStatistics.hits);
     }
 
+    if (enableTracing) {
+        if (writeTrace(config.traceFile))
+            fmt::print("Trace saved to {}\n", config.traceFile.string());
+        else
+            std::cerr << "Error: Could not write trace to " << config.traceFile << std::endl;
+    }
     return 0;
 }
 
+// Build the BVH, or load it from the cache directory if it was built before for the same scene and settings.
+static BvhInterface buildBvh(Scene& scene, const Config& config, const std::string& sceneName)
+{
+    if (config.cacheDir.empty())
+        return BvhInterface { &scene, config.features };
+    const char* builder = config.features.extra.enableBvhSahBinning ? "sah" : "median";
+    if (config.features.bvh.buildQuality == BvhBuildQuality::Fast)
+        builder = "lbvh";
+    else if (config.features.bvh.buildQuality == BvhBuildQuality::High)
+        builder = "sbvh";
+    const auto cacheFile = config.cacheDir / fmt::format("{}_{}.bvh", sceneName, builder);
+    return BvhInterface { &scene, config.features, cacheFile };
+}
+
+// Rotate the mesh around the vertical axis through the average of its vertices.
+static void rotateMeshVertically(Mesh& mesh, float degrees)
+{
+    glm::vec3 center { 0.0f };
+    for (const auto& vertex : mesh.vertices)
+        center += vertex.position;
+    center /= float(std::max(mesh.vertices.size(), size_t(1)));
+    const glm::mat3 rotation { glm::rotate(glm::mat4(1.0f), glm::radians(degrees), glm::vec3(0, 1, 0)) };
+    for (auto& vertex : mesh.vertices) {
+        vertex.position = center + rotation * (vertex.position - center);
+        vertex.normal = rotation * vertex.normal;
+    }
+}
+
 static void setOpenGLMatrices(const Trackball& camera)
 {
     // Load view matrix.
@@ -1,14 +1,28 @@
 #include "render.h"
+#include "bvh_statistics.h"
+#include "environment_map.h"
 #include "intersect.h"
 #include "light.h"
 #include "screen.h"
 #include "texture.h"
+#include "trace.h"
 #include <framework/trackball.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <iostream>
+#include <optional>
 #include <random>
+#include <tuple>
+#include <vector>
 #ifdef NDEBUG
 #include <omp.h>
 #endif
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 #include "cmath"
 
 void motionBlurDebug(Ray ray, const Scene& scene, const BvhInterface& bvh, const Features& features){
@@ -35,51 +49,6 @@ void DOF_debug (const Scene& scene, const BvhInterface& bvh, const Features& fea
     }
 }
 
-Image envImage(std::filesystem::path { DATA_DIR } / "cube_map.jpg");
-
-glm::vec2 getEnvironmentTexelCoords(glm::vec3 p)
-{
-    auto absX = std::fabs(p.x);
-    auto absY = std::fabs(p.y);
-    auto absZ = std::fabs(p.z);
-
-    glm::vec2 sideCoords;
-
-    glm::vec2 center { -1, -1 }, shift { -1, -1 };
-    if (absX >= absY && absX >= absZ) {
-        if (p.x > 0) { // face 0
-            center = { 2.5f / 4, 1.5f / 3 };
-            shift = { -p.z / 8, p.y / 6 };
-        } else { // face 1
-            center = { 0.5f / 4, 1.5f / 3 };
-            shift = { p.z / 8, p.y / 6 };
-        }
-    }
-
-    if (absY >= absX && absY >= absZ) {
-        if (p.y > 0) { // face 2
-            center = { 1.5f / 4, 2.5f / 3 };
-            shift = { p.x / 8, -p.z / 6 };
-        } else { // face 3
-            center = { 1.5f / 4, 0.5f / 3 };
-            shift = { p.x / 8, p.z / 6 };
-        }
-    }
-
-    if (absZ >= absX && absZ >= absY) {
-        if (p.z > 0) { // face 4
-            center = { 1.5f / 4, 1.5f / 3 };
-            shift = { p.x / 8, p.y / 6 };
-        } else { // face 5
-            center = { 3.5f / 4, 1.5f / 3 };
-            shift = { -p.x / 8, p.y / 6 };
-        }
-    }
-    auto ans = center + shift;
-    if (!(0 <= ans.x && ans.x <= 1 && 0 <= ans.y && ans.y <= 1)) return {0, 0};
-    return ans;
-}
-
 glm::vec3 getFinalColor(const Scene& scene, const BvhInterface& bvh, Ray ray, const Features& features, int rayDepth)
 {
     // Visual debug for motion blur.
@@ -93,6 +62,8 @@ glm::vec3 getFinalColor(const Scene& scene, const BvhInterface& bvh, Ray ray, co
         DOF_debug(scene, bvh, features, ray);
     }
 
+    // Shadow rays traced while shading the hit count as such (see light.cpp).
+    const ScopedRayType rayType { rayDepth == 0 ? RayType::Camera : RayType::Secondary };
     HitInfo hitInfo;
     hitInfo.depthOfRecursion = rayDepth;
     if (bvh.intersect(ray, hitInfo, features)) {
@@ -111,6 +82,9 @@ glm::vec3 getFinalColor(const Scene& scene, const BvhInterface& bvh, Ray ray, co
         if (features.extra.enableTransparency) {
             isTransparencyEnabled = true;
             Ray transparentRay = { ray.origin + ray.direction * (0.000001f + ray.t), ray.direction, std::numeric_limits<float>::max() };
+            std::tie(transparentRay.dOriginDx, transparentRay.dOriginDy) = computeHitDifferentials(ray, hitInfo.normal);
+            transparentRay.dDirectionDx = ray.dDirectionDx;
+            transparentRay.dDirectionDy = ray.dDirectionDy;
             // Verifying if the ray intersects a surface with lower transparency and if the rayDepth is less than 5
             if (rayDepth < 5 && hitInfo.material.transparency < 1.0f) {
                 finalColor += hitInfo.material.transparency * (Lo) + (1 - hitInfo.material.transparency) * (getFinalColor(scene, bvh, transparentRay, features, rayDepth + 1));
@@ -138,12 +112,8 @@ glm::vec3 getFinalColor(const Scene& scene, const BvhInterface& bvh, Ray ray, co
         drawRay(ray, glm::vec3(1.0f, 0.0f, 0.0f));
         // Set the color of the pixel to black if the ray misses.
 
-        if (features.extra.enableEnvironmentMapping) {
-            AxisAlignedBox envBox = { { -64, -64, -64 }, { 64, 64, 64 } };
-            if (intersectRayWithShape(envBox, ray)) {
-                auto texelCoords = getEnvironmentTexelCoords((ray.origin + ray.direction * ray.t) / 64.0f);
-                return acquireTexel(envImage, texelCoords, features);
-            }
+        if (features.extra.enableEnvironmentMapping && scene.environmentMap) {
+            return scene.environmentMap->lookup(ray.direction, features);
         }
         return glm::vec3(0.0f);
     }
@@ -177,58 +147,158 @@ glm::vec3 DOF (const Scene& scene, const BvhInterface& bvh, const Features& feat
     return Lo;
 }
 
-void renderRayTracing(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features, const float& threshold, const int& boxSize, const int& numRays)
+// Running count of the work done by the calling thread, in the unit of the metric.
+static uint64_t costCounter(CostMetric costMetric)
+{
+    if (costMetric == CostMetric::Time) {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+    uint64_t count = 0;
+    for (const auto& counters : threadTraversalStatistics())
+        count += costMetric == CostMetric::Nodes ? counters.nodesVisited : counters.primitivesTested;
+    return count;
+}
+
+// Map a cost in [0, 1] to black, blue, cyan, green, yellow and red.
+static glm::vec3 falseColor(float value)
+{
+    static constexpr std::array colors {
+        glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 1.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f)
+    };
+    const float position = std::clamp(value, 0.0f, 1.0f) * float(colors.size() - 1);
+    const size_t index = std::min(size_t(position), colors.size() - 2);
+    return glm::mix(colors[index], colors[index + 1], position - float(index));
+}
+
+static void drawCostHeatmap(const std::vector<float>& costs, Screen& costScreen)
+{
+    if (costs.empty())
+        return;
+    // Scale to the 99th percentile, so that a few outliers do not leave all other pixels dark.
+    std::vector<float> sorted = costs;
+    const auto percentile = sorted.begin() + std::ptrdiff_t(float(sorted.size() - 1) * 0.99f);
+    std::nth_element(sorted.begin(), percentile, sorted.end());
+    const float scale = std::max(*percentile, 1.0f);
+    auto& pixels = costScreen.pixels();
+    for (size_t i = 0; i < costs.size(); i++)
+        pixels[i] = falseColor(costs[i] / scale);
+}
+
+// Color of pixel (x, y), seen through the given position within the pixel ((0, 0) is its bottom left corner).
+static glm::vec3 renderPixel(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, const Features& features, const glm::ivec2& windowResolution, int x, int y,
+    const glm::vec2& jitter, int numRays)
 {
+    // Size of a pixel in normalized screen coordinates, used to compute the ray differentials.
+    const glm::vec2 pixelSize = 2.0f / glm::vec2(windowResolution);
+    // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+    const glm::vec2 normalizedPixelPos {
+        (float(x) + jitter.x) / float(windowResolution.x) * 2.0f - 1.0f,
+        (float(y) + jitter.y) / float(windowResolution.y) * 2.0f - 1.0f
+    };
+
+    if(features.extra.enableMultipleRaysPerPixel){
+        glm::vec3 colour(0.0f);
+        std::random_device rd;
+        std::mt19937 mt(rd());
+        std::uniform_real_distribution<float> dist(0.0, 1.0);
+        for(int i = 0; i < numRays; i++){
+            for(int j = 0; j < numRays; j++){
+                float randX = static_cast<float>(dist(mt)) / RAND_MAX;
+                float randY = static_cast<float>(dist(mt)) / RAND_MAX;
+                // The jitter moves the sample within its cell of the numRays x numRays grid.
+                float a = (float(i) + randX + jitter.x)/float(numRays) + float(x);
+                float b = (float(j) + randY + jitter.y)/float(numRays) + float(y);
+                const glm::vec2 normalizedPixelPos2 {
+                    float(a) / float(windowResolution.x) * 2.0f - 1.0f,
+                    float(b) / float(windowResolution.y) * 2.0f - 1.0f
+                };
+
+                const Ray cameraRay2 = camera.generateRay(normalizedPixelPos2, pixelSize / float(numRays));
+
+                colour += getFinalColor(scene, bvh, cameraRay2, features);
+            }
+        }
+        return colour / float(numRays * numRays);
+    } else if (features.extra.enableMotionBlur) {
+        const Ray cameraRay = camera.generateRay(normalizedPixelPos, pixelSize);
+        return motionBlur(cameraRay, scene, bvh, features);
+    } else if (features.extra.enableDepthOfField) {
+        const Ray cameraRay = camera.generateRay(normalizedPixelPos, pixelSize);
+        return DOF(scene, bvh, features, cameraRay);
+    } else {
+        const Ray cameraRay = camera.generateRay(normalizedPixelPos, pixelSize);
+        return getFinalColor(scene, bvh, cameraRay, features);
+    }
+}
+
+int renderRayTracing(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features, const float& threshold, const int& boxSize, const int& numRays,
+    Screen* pCostScreen, CostMetric costMetric, float timeBudgetMs)
+{
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    const TraceScope traceScope { "renderRayTracing" };
     glm::ivec2 windowResolution = screen.resolution();
+    std::vector<float> costs;
+    if (pCostScreen)
+        costs.resize(screen.pixels().size());
+    std::optional<ScopedTraversalCounting> traversalCounting;
+    traversalCounting.emplace(pCostScreen && costMetric != CostMetric::Time);
     // Enable multi threading in Release mode
 #ifdef NDEBUG
 #pragma omp parallel for schedule(guided)
 #endif
     for (int y = 0; y < windowResolution.y; y++) {
+        const TraceScope rowTraceScope { "Render row", y };
         for (int x = 0; x != windowResolution.x; x++) {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos {
-                float(x) / float(windowResolution.x) * 2.0f - 1.0f,
-                float(y) / float(windowResolution.y) * 2.0f - 1.0f
-            };
-
-            glm::vec3 colour(0.0f);
-            if(features.extra.enableMultipleRaysPerPixel){
-                std::random_device rd;
-                std::mt19937 mt(rd());
-                std::uniform_real_distribution<float> dist(0.0, 1.0);
-                for(int i = 0; i < numRays; i++){
-                    for(int j = 0; j < numRays; j++){
-                        float randX = static_cast<float>(dist(mt)) / RAND_MAX;
-                        float randY = static_cast<float>(dist(mt)) / RAND_MAX;
-                        float a = (float(i) + randX)/float(numRays) + float(x);
-                        float b = (float(j) + randY)/float(numRays) + float(y);
-                        const glm::vec2 normalizedPixelPos2 {
-                            float(a) / float(windowResolution.x) * 2.0f - 1.0f,
-                            float(b) / float(windowResolution.y) * 2.0f - 1.0f
-                        };
-
-                        const Ray cameraRay2 = camera.generateRay(normalizedPixelPos2);
-
-                        colour += getFinalColor(scene, bvh, cameraRay2, features);
-                    }
+            const uint64_t costStart = pCostScreen ? costCounter(costMetric) : 0;
+            screen.setPixel(x, y, renderPixel(scene, camera, bvh, features, windowResolution, x, y, glm::vec2(0.0f), numRays));
+            if (pCostScreen)
+                costs[size_t(screen.indexAt(x, y))] = float(costCounter(costMetric) - costStart);
+        }
+    }
+
+    traversalCounting.reset();
+    if (pCostScreen)
+        drawCostHeatmap(costs, *pCostScreen);
+
+    // With a time budget, keep adding passes of one sample per pixel (at a random position within the pixel) for
+    // as long as the next pass is expected to finish before the deadline, and average them.
+    int numPasses = 1;
+    if (timeBudgetMs > 0.0f) {
+        const auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<float, std::milli>(timeBudgetMs));
+        std::vector<glm::vec3> sum = screen.pixels();
+        auto passStart = start;
+        for (auto now = clock::now(); now + (now - passStart) <= deadline; now = clock::now()) {
+            passStart = now;
+            const TraceScope passTraceScope { "Progressive pass", numPasses };
+#ifdef NDEBUG
+#pragma omp parallel for schedule(guided)
+#endif
+            for (int y = 0; y < windowResolution.y; y++) {
+                // One generator per pass and row, so that threads do not share one. This only makes the jitter reproducible:
+                // light sampling and multiple rays per pixel draw from their own random sources.
+                std::mt19937 rng { uint32_t(numPasses * windowResolution.y + y) };
+                std::uniform_real_distribution<float> uniform { 0.0f, 1.0f };
+                for (int x = 0; x != windowResolution.x; x++) {
+                    const glm::vec2 jitter { uniform(rng), uniform(rng) };
+                    sum[size_t(screen.indexAt(x, y))] += renderPixel(scene, camera, bvh, features, windowResolution, x, y, jitter, numRays);
                 }
-                colour /= (numRays * numRays);
-                screen.setPixel(x, y, colour);
-            } else if (features.extra.enableMotionBlur) {
-                const Ray cameraRay = camera.generateRay(normalizedPixelPos);
-                screen.setPixel(x, y, motionBlur(cameraRay, scene, bvh, features));
-            } else if (features.extra.enableDepthOfField) {
-                const Ray cameraRay = camera.generateRay(normalizedPixelPos);
-                screen.setPixel(x, y, DOF(scene, bvh, features, cameraRay));
-            } else { 
-                const Ray cameraRay = camera.generateRay(normalizedPixelPos);
-                screen.setPixel(x, y, getFinalColor(scene, bvh, cameraRay, features));
             }
+            numPasses++;
         }
+        auto& pixels = screen.pixels();
+        for (size_t i = 0; i < pixels.size(); i++)
+            pixels[i] = sum[i] / float(numPasses);
     }
 
     if(features.extra.enableBloomEffect){
+        const TraceScope bloomTraceScope { "Bloom" };
         screen.applyBloomFilter(threshold, 2 * boxSize + 1);
     }
+    return features.extra.enableMultipleRaysPerPixel ? numPasses * numRays * numRays : numPasses;
 }
@@ -5,6 +5,7 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
 #include <framework/ray.h>
+#include "common.h"
 
 // Forward declarations.
 struct Scene;
@@ -13,8 +14,14 @@ class Trackball;
 class BvhInterface;
 struct Features;
 
-// Main rendering function.
-void renderRayTracing(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features, const float& threshold = 0.0f, const int& boxSize = 0, const int& numRays = 5);
+// Main rendering function. Returns the number of samples traced per pixel.
+// If pCostScreen is given (with the resolution of screen), it receives a false-color image of what every pixel cost
+// according to costMetric: black for nothing, then blue, cyan, green, yellow and red for the most expensive pixels.
+// Counting nodes or primitives needs traversal counting (bvh_statistics.h), which is enabled for the first pass.
+// If timeBudgetMs is positive, the image is refined progressively by more samples per pixel until the budget (counted
+// from the call) is about to run out. The first pass is always completed, and is the only one in the cost image.
+int renderRayTracing(const Scene& scene, const Trackball& camera, const BvhInterface& bvh, Screen& screen, const Features& features, const float& threshold = 0.0f, const int& boxSize = 0, const int& numRays = 5,
+    Screen* pCostScreen = nullptr, CostMetric costMetric = CostMetric::Time, float timeBudgetMs = 0.0f);
 
 // Get the color of a ray.
 glm::vec3 getFinalColor(const Scene& scene, const BvhInterface& bvh, Ray ray, const Features& features, int rayDepth = 0);
\ No newline at end of file
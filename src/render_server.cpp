@@ -0,0 +1,361 @@
+#include "render_server.h"
+#include "light.h"
+#include "render.h"
+#include "screen.h"
+#include "trace.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+#include <glm/trigonometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/trackball.h>
+#include <framework/variant_helper.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <list>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <variant>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Bloom and multi-sampling settings of the command-line renderer.
+static constexpr float bloomThreshold = 0.5f;
+static constexpr int bloomBoxSize = 1;
+static constexpr int numRaysPerDimension = 1;
+
+static std::string jsonString(std::string_view string)
+{
+    std::string result = "\"";
+    for (const char c : string) {
+        if (c == '"' || c == '\\')
+            result += fmt::format("\\{}", c);
+        else if (static_cast<unsigned char>(c) < 0x20)
+            result += fmt::format("\\u{:04x}", int(c));
+        else
+            result += c;
+    }
+    return result + "\"";
+}
+
+static std::string errorResponse(std::string_view message)
+{
+    return fmt::format(R"({{"status":"error","message":{}}})", jsonString(message));
+}
+
+// The part of the configuration that the loaded scene and its BVH depend on.
+static std::string sceneKey(Config config)
+{
+    config.cameras.clear();
+    config.windowSize = glm::ivec2(0);
+    config.outputDir.clear();
+    config.outputFile.clear();
+    config.timeBudgetMs = 0.0f;
+    std::ostringstream stream;
+    stream << config;
+    return stream.str();
+}
+
+SceneCache::CachedScene::CachedScene(std::string key, Scene&& scene, const Features& features)
+    : key(std::move(key))
+    , scene(std::move(scene))
+    , bvh(&this->scene, features)
+{
+}
+
+SceneCache::SceneCache(size_t maxScenes)
+    : m_maxScenes(std::max(maxScenes, size_t(1)))
+{
+}
+
+SceneCache::CachedScene& SceneCache::get(const Config& config, bool& cached)
+{
+    const std::string key = sceneKey(config);
+    const auto iter = std::find_if(std::begin(m_scenes), std::end(m_scenes), [&](const auto& pScene) { return pScene->key == key; });
+    cached = iter != std::end(m_scenes);
+    if (cached) {
+        m_scenes.splice(std::begin(m_scenes), m_scenes, iter);
+        return *m_scenes.front();
+    }
+
+    Scene scene;
+    std::visit(make_visitor(
+                   [&](const std::filesystem::path& path) { scene = loadSceneFromFile(path, config.lights); },
+                   [&](const SceneType& type) { scene = loadScenePrebuilt(type, config.dataPath); }),
+        config.scene);
+    std::vector<InstanceDescription> instances;
+    std::transform(std::begin(config.instances), std::end(config.instances), std::back_inserter(instances), describeInstance);
+    addInstances(scene, instances);
+    scene.environmentMap = std::make_shared<const EnvironmentMap>(config.environmentMap, config.environmentMapLayout);
+    compileSceneLights(scene, config.features);
+
+    if (m_scenes.size() >= m_maxScenes)
+        m_scenes.pop_back();
+    m_scenes.push_front(std::make_unique<CachedScene>(key, std::move(scene), config.features));
+    return *m_scenes.front();
+}
+
+RenderServer::RenderServer(const std::filesystem::path& outputDir, size_t maxCachedScenes)
+    : m_outputDir(std::filesystem::weakly_canonical(std::filesystem::absolute(outputDir.empty() ? std::filesystem::current_path() : outputDir)))
+    , m_scenes(maxCachedScenes)
+{
+}
+
+std::string RenderServer::handleRequest(std::string_view request)
+{
+    const TraceScope traceScope { "Render request" };
+    // Loaders report malformed files by throwing, after printing the reason. One bad request must not take the server
+    // down together with the requests queued behind it.
+    try {
+        return render(request);
+    } catch (const std::exception& exception) {
+        return errorResponse(fmt::format("Rendering failed ({}); see the server output for details.", exception.what()));
+    }
+}
+
+std::string RenderServer::render(std::string_view request)
+{
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+
+    std::string error;
+    std::optional<Config> config = readConfigJson(request, error);
+    if (!config)
+        return errorResponse(error);
+    if (config->outputFile.empty())
+        return errorResponse("No output_file given.");
+    // Clients may only write images to the output directory (following symbolic links and ..).
+    config->outputFile = std::filesystem::weakly_canonical(config->outputFile);
+    const std::filesystem::path relativeOutputFile = config->outputFile.lexically_relative(m_outputDir);
+    if (relativeOutputFile.empty() || *std::begin(relativeOutputFile) == ".." || *std::begin(relativeOutputFile) == ".")
+        return errorResponse(fmt::format("output_file must be inside {}.", m_outputDir.string()));
+    if (config->windowSize.x <= 0 || config->windowSize.y <= 0)
+        return errorResponse("window_size must be positive.");
+    if (config->cameras.empty())
+        config->cameras.emplace_back(CameraConfig {});
+    std::error_code errorCode;
+    std::filesystem::create_directories(config->outputFile.parent_path(), errorCode);
+    if (errorCode)
+        return errorResponse(fmt::format("Could not create {}: {}", config->outputFile.parent_path().string(), errorCode.message()));
+
+    bool cached;
+    SceneCache::CachedScene& cachedScene = m_scenes.get(*config, cached);
+    const float aspectRatio = float(config->windowSize.x) / float(config->windowSize.y);
+
+    std::vector<std::string> images;
+    int samples = 0;
+    for (size_t i = 0; i < config->cameras.size(); i++) {
+        const CameraConfig& cameraConfig = config->cameras[i];
+        Trackball camera { aspectRatio, glm::radians(cameraConfig.fieldOfView), cameraConfig.distanceFromLookAt };
+        camera.setCamera(cameraConfig.lookAt, glm::radians(cameraConfig.rotation), cameraConfig.distanceFromLookAt);
+        Screen screen { config->windowSize, false };
+        screen.clear(glm::vec3(0.0f));
+        samples = renderRayTracing(cachedScene.scene, camera, cachedScene.bvh, screen, config->features, bloomThreshold, bloomBoxSize, numRaysPerDimension,
+            nullptr, CostMetric::Time, config->timeBudgetMs);
+
+        std::filesystem::path filePath = config->outputFile;
+        if (config->cameras.size() > 1)
+            filePath.replace_filename(fmt::format("{}_cam_{}{}", filePath.stem().string(), i, filePath.extension().string()));
+        screen.writeBitmapToFile(filePath);
+        images.push_back(jsonString(filePath.string()));
+    }
+
+    const double timeMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    return fmt::format(R"({{"status":"ok","images":[{}],"samples":{},"time_ms":{:.3f},"cached":{}}})", fmt::join(images, ","), samples, timeMs, cached);
+}
+
+void RenderServer::push(Job job)
+{
+    {
+        std::scoped_lock lock { m_queueMutex };
+        m_queue.push_back(std::move(job));
+    }
+    m_queueCondition.notify_one();
+}
+
+void RenderServer::run()
+{
+    while (true) {
+        Job job;
+        {
+            std::unique_lock lock { m_queueMutex };
+            m_queueCondition.wait(lock, [&] { return !m_queue.empty(); });
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        if (!job.respond)
+            return;
+        job.respond(handleRequest(job.request));
+    }
+}
+
+void RenderServer::serve(std::istream& input, std::ostream& output)
+{
+    // Requests are read while earlier ones render.
+    std::thread reader { [&]() {
+        for (std::string line; std::getline(input, line);) {
+            if (!line.empty())
+                push({ std::move(line), [&](std::string_view response) { output << response << std::endl; } });
+        }
+        push({});
+    } };
+    run();
+    reader.join();
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+namespace {
+// Closed when the last response for it was sent.
+struct Connection {
+    explicit Connection(int socket)
+        : socket(socket)
+    {
+    }
+    ~Connection() { close(socket); }
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    void send(std::string_view response) const
+    {
+        std::string line { response };
+        line += '\n';
+        // Stop at the first error, e.g. when the client has gone.
+        for (size_t written = 0; written < line.size();) {
+            const ssize_t result = write(socket, line.data() + written, line.size() - written);
+            if (result <= 0)
+                return;
+            written += size_t(result);
+        }
+    }
+
+    int socket;
+};
+}
+
+bool RenderServer::serveSocket(const std::filesystem::path& socketPath)
+{
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    const std::string pathString = socketPath.string();
+    if (pathString.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: Socket path " << socketPath << " is too long." << std::endl;
+        return false;
+    }
+    std::copy(std::begin(pathString), std::end(pathString), address.sun_path);
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    // A socket file left behind by a previous server would make bind() fail.
+    std::error_code errorCode;
+    std::filesystem::remove(socketPath, errorCode);
+    // Clients can write files and use all cores, so only the user running the server may connect. Nobody can connect
+    // before listen(), so restricting the socket file in between leaves no window.
+    if (listener < 0 || bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+        || chmod(pathString.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(listener, 16) != 0) {
+        std::cerr << "Error: Could not listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        if (listener >= 0)
+            close(listener);
+        return false;
+    }
+    // Writing to a client that disconnected must not end the server.
+    std::signal(SIGPIPE, SIG_IGN);
+    std::cerr << "Listening on " << socketPath << std::endl;
+
+    m_listener = listener;
+    std::thread acceptor { [this, listener]() { acceptConnections(listener); } };
+    run();
+    acceptor.join();
+    m_listener = -1;
+    close(listener);
+    std::filesystem::remove(socketPath, errorCode);
+    return true;
+}
+
+void RenderServer::acceptConnections(int listener)
+{
+    struct Client {
+        std::shared_ptr<const Connection> pConnection;
+        std::thread reader;
+        std::atomic_bool finished { false };
+    };
+    // Clients whose connection is still being read; finished ones are joined when the next client connects.
+    std::list<Client> clients;
+    const auto joinFinished = [&]() {
+        clients.remove_if([](Client& client) {
+            if (!client.finished)
+                return false;
+            client.reader.join();
+            return true;
+        });
+    };
+
+    while (!m_stopping) {
+        const int clientSocket = accept(listener, nullptr, nullptr);
+        if (clientSocket < 0) {
+            // stop() shuts the listener down, which makes accept() fail.
+            if (errno == EINTR || m_stopping)
+                continue;
+            std::cerr << "Error: Could not accept connection: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        joinFinished();
+        Client& client = clients.emplace_back();
+        client.pConnection = std::make_shared<const Connection>(clientSocket);
+        client.reader = std::thread { [this, &client]() {
+            // Requests larger than this are not valid configurations; drop the client instead of buffering them.
+            constexpr size_t maxRequestSize = size_t(1) << 20;
+            std::string buffer;
+            char chunk[4096];
+            for (ssize_t size; (size = read(client.pConnection->socket, chunk, sizeof(chunk))) > 0;) {
+                buffer.append(chunk, size_t(size));
+                size_t lineStart = 0;
+                for (size_t lineEnd; (lineEnd = buffer.find('\n', lineStart)) != std::string::npos; lineStart = lineEnd + 1) {
+                    if (lineEnd > lineStart)
+                        push({ buffer.substr(lineStart, lineEnd - lineStart), [pConnection = client.pConnection](std::string_view response) { pConnection->send(response); } });
+                }
+                buffer.erase(0, lineStart);
+                if (buffer.size() > maxRequestSize)
+                    break;
+            }
+            client.finished = true;
+        } };
+    }
+
+    // Stop reading requests; the queued ones are still answered.
+    for (Client& client : clients)
+        shutdown(client.pConnection->socket, SHUT_RD);
+    for (Client& client : clients)
+        client.reader.join();
+    push({});
+}
+
+void RenderServer::stop()
+{
+    m_stopping = true;
+    const int listener = m_listener;
+    if (listener >= 0)
+        shutdown(listener, SHUT_RDWR);
+}
+#else
+bool RenderServer::serveSocket(const std::filesystem::path&)
+{
+    std::cerr << "Error: Unix domain sockets are not supported on this platform; serve requests from stdin instead." << std::endl;
+    return false;
+}
+
+void RenderServer::stop()
+{
+    m_stopping = true;
+}
+#endif
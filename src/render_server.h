@@ -0,0 +1,95 @@
+#pragma once
+#include "bvh_interface.h"
+#include "config.h"
+#include "scene.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <iosfwd>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Scenes and their BVHs, cached by the part of their configuration that the loaded scene and BVH depend on.
+class SceneCache {
+public:
+    struct CachedScene {
+        CachedScene(std::string key, Scene&& scene, const Features& features);
+
+        std::string key;
+        Scene scene;
+        BvhInterface bvh; // Points to scene, so cached scenes must not move.
+    };
+
+    // Scenes beyond maxScenes are evicted, least recently used first.
+    explicit SceneCache(size_t maxScenes);
+
+    // Return the scene of config, loading it if it is not cached (cached tells which).
+    CachedScene& get(const Config& config, bool& cached);
+    [[nodiscard]] size_t size() const { return m_scenes.size(); }
+
+private:
+    size_t m_maxScenes;
+    std::list<std::unique_ptr<CachedScene>> m_scenes; // Most recently used first.
+};
+
+// Long-running renderer that keeps scenes and their BVHs loaded between requests, for clients that render the same
+// scene many times (e.g. while moving the camera). Every request is a single line of JSON with the keys of the config
+// file, of which it uses the scene, instances, lights, environment map, features and bvh settings, cameras,
+// window_size, time_budget_ms and output_file (the image; with several cameras, _cam_<index> is added to its name).
+// Requests are answered in order with a line of JSON: {"status":"ok","images":[...],"samples":..,"time_ms":..,
+// "cached":..} or {"status":"error","message":".."}.
+//
+// Requests are queued and rendered one at a time on the thread that serves, each using all OpenMP threads. Settings
+// of the process (mesh and texture caches, tracing) come from the config file the server was started with.
+class RenderServer {
+public:
+    // Images are only written inside outputDir (the current directory if empty); requests for other output files are
+    // answered with an error.
+    explicit RenderServer(const std::filesystem::path& outputDir, size_t maxCachedScenes = 4);
+
+    // Serve the requests read from input, writing responses to output, until the input ends.
+    void serve(std::istream& input, std::ostream& output);
+    // Serve requests from any number of clients connecting to a Unix domain socket at socketPath, each answered over
+    // its own connection. The socket is only accessible by the user running the server. Runs until stop() is called
+    // and the queued requests are answered; returns false if the socket could not be opened.
+    bool serveSocket(const std::filesystem::path& socketPath);
+    // Stop accepting connections and requests in serveSocket(). Async-signal-safe, so it may be called from a signal
+    // handler.
+    void stop();
+
+    // Render a single request and return the response (without line break). Requests that fail, e.g. because their
+    // scene file is malformed, are answered with an error.
+    std::string handleRequest(std::string_view request);
+
+private:
+    // A request and where to send its response; an empty respond marks the end of the input.
+    struct Job {
+        std::string request;
+        std::function<void(std::string_view)> respond;
+    };
+
+    void push(Job job);
+    // Handle jobs until one marks the end of the input.
+    void run();
+    // Accept connections on listener and queue their requests until stop() is called.
+    void acceptConnections(int listener);
+    // handleRequest() without catching exceptions.
+    std::string render(std::string_view request);
+
+    std::filesystem::path m_outputDir;
+    SceneCache m_scenes;
+
+    std::mutex m_queueMutex;
+    std::condition_variable m_queueCondition;
+    std::deque<Job> m_queue;
+
+    std::atomic_bool m_stopping { false };
+    std::atomic_int m_listener { -1 };
+};
@@ -1,9 +1,13 @@
 #include "scene.h"
+#include "trace.h"
 #include <cmath>
 #include <iostream>
+#include <map>
+#include <utility>
 
 Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir)
 {
+    const TraceScope traceScope { "Load scene" };
     Scene scene;
     scene.type = type;
     switch (type) {
@@ -95,6 +99,7 @@ Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir)
 
 Scene loadSceneFromFile(const std::filesystem::path& path, const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>>& lights)
 {
+    const TraceScope traceScope { "Load scene" };
     Scene scene;
     scene.lights = std::move(lights);
 
@@ -104,3 +109,28 @@ Scene loadSceneFromFile(const std::filesystem::path& path, const std::vector<std
     return scene;
 }
 
+
+void addInstances(Scene& scene, std::span<const InstanceDescription> instances)
+{
+    if (instances.empty())
+        return;
+    // Keep the meshes of the scene by placing each of them once, without moving it.
+    if (scene.instances.empty()) {
+        for (uint32_t i = 0; i < scene.meshes.size(); i++)
+            scene.instances.push_back({ i, glm::mat4x3(1.0f) });
+    }
+
+    // Range of scene meshes loaded from each file.
+    std::map<std::filesystem::path, std::pair<uint32_t, uint32_t>> loadedFiles;
+    for (const auto& instance : instances) {
+        auto iter = loadedFiles.find(instance.meshFile);
+        if (iter == std::end(loadedFiles)) {
+            auto subMeshes = loadMesh(instance.meshFile);
+            const auto firstMesh = static_cast<uint32_t>(scene.meshes.size());
+            std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
+            iter = loadedFiles.emplace(instance.meshFile, std::pair { firstMesh, static_cast<uint32_t>(scene.meshes.size()) }).first;
+        }
+        for (uint32_t meshIndex = iter->second.first; meshIndex < iter->second.second; meshIndex++)
+            scene.instances.push_back({ meshIndex, instance.transform });
+    }
+}
@@ -2,16 +2,25 @@
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x3.hpp>
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
+#include <cstdint>
 #include <filesystem>
 #include <framework/mesh.h>
 #include <framework/ray.h>
+#include <memory>
 #include <optional>
+#include <span>
 #include <variant>
 #include <vector>
 #include "common.h"
 
+// Forward declarations.
+class EnvironmentMap;
+class LightTree;
+struct LightSet;
+
 enum SceneType {
     SingleTriangle,
     Cube,
@@ -25,11 +34,24 @@ enum SceneType {
     Custom,
 };
 
+// A mesh placed in the scene with a transform, so that an object that appears many times is stored only once.
+struct MeshInstance {
+    uint32_t meshIndex; // Into Scene::meshes; the mesh is in its own (object) coordinates.
+    glm::mat4x3 transform; // Object to world.
+};
+
 struct Scene {
     SceneType type;
     std::vector<Mesh> meshes;
+    // When empty, every mesh is seen once, as it is. Otherwise meshes are only seen through their instances.
+    std::vector<MeshInstance> instances;
     std::vector<Sphere> spheres;
     std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>> lights;
+    // Seen by rays that miss all geometry when environment mapping is enabled; shared between scenes.
+    std::shared_ptr<const EnvironmentMap> environmentMap;
+    // Built from the lights by compileSceneLights(); the light tree only when many-light sampling is enabled.
+    std::shared_ptr<const LightSet> lightSet;
+    std::shared_ptr<const LightTree> lightTree;
     // Variables for motion blur.
     int MB_samples;
     float time0 = 0.0;
@@ -46,3 +68,13 @@ Scene loadScenePrebuilt(SceneType type, const std::filesystem::path& dataDir);
 
 // Load a scene from a file.
 Scene loadSceneFromFile(const std::filesystem::path& path, const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>>& lights);
+
+// The meshes of a file placed in the scene with a transform.
+struct InstanceDescription {
+    std::filesystem::path meshFile;
+    glm::mat4x3 transform;
+};
+
+// Add instances to the scene, loading every mesh file only once however often it is placed. Meshes that were
+// already in the scene stay where they are.
+void addInstances(Scene& scene, std::span<const InstanceDescription> instances);
@@ -1,7 +1,16 @@
 #include "texture.h"
+#include <algorithm>
+#include <bit>
 #include <cmath>
+#include <cstdint>
 #include <glm/geometric.hpp>
 #include <shading.h>
+#include <tuple>
+// MSVC does not define __FMA__, but /arch:AVX2 implies FMA support.
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#define SHADING_USE_AVX2 1
+#include <immintrin.h>
+#endif
 
 const glm::vec3 computeShading(const glm::vec3& lightPosition, const glm::vec3& lightColor, const Features& features, Ray ray, HitInfo hitInfo)
 {
@@ -30,6 +39,154 @@ const glm::vec3 computeShading(const glm::vec3& lightPosition, const glm::vec3&
 }
 
 
+// fastPow() computes exp2(exponent * log2(x)). log2 splits x into exponent and mantissa m in [sqrt(1/2), sqrt(2)),
+// for which log2(m) = 2 / ln(2) * atanh(s) with s = (m - 1) / (m + 1) converges quickly (|s| < 0.172). exp2 splits
+// its argument into an integer and a fraction f in [-1/2, 1/2], and expands 2^f = e^(f ln(2)) as a Taylor series.
+// The vectorized version below evaluates exactly the same steps.
+static constexpr float log2Coefficients[] { 2.0f / 0.69314718f, 2.0f / (3.0f * 0.69314718f), 2.0f / (5.0f * 0.69314718f), 2.0f / (7.0f * 0.69314718f) };
+static constexpr float exp2Coefficients[] { 1.0f, 0.69314718f, 0.24022651f, 0.05550411f, 0.00961813f, 0.00133336f, 0.00015404f };
+
+float fastPow(float x, float exponent)
+{
+    const uint32_t bits = std::bit_cast<uint32_t>(x);
+    int integerLog2 = static_cast<int>((bits >> 23) & 0xFFu) - 127; // x is not negative, but may be -0.
+    float mantissa = std::bit_cast<float>((bits & 0x007FFFFFu) | 0x3F800000u);
+    if (mantissa > 1.41421356f) {
+        mantissa *= 0.5f;
+        integerLog2 += 1;
+    }
+    const float s = (mantissa - 1.0f) / (mantissa + 1.0f);
+    const float s2 = s * s;
+    const float log2X = static_cast<float>(integerLog2) + s * (log2Coefficients[0] + s2 * (log2Coefficients[1] + s2 * (log2Coefficients[2] + s2 * log2Coefficients[3])));
+
+    const float y = std::max(exponent * log2X, -126.0f);
+    const float integer = std::nearbyint(y);
+    const float f = y - integer;
+    float exp2F = exp2Coefficients[6];
+    for (int i = 5; i >= 0; i--)
+        exp2F = exp2F * f + exp2Coefficients[i];
+    return exp2F * std::bit_cast<float>(static_cast<uint32_t>(static_cast<int>(integer) + 127) << 23);
+}
+
+ShadingFrame computeShadingFrame(const Ray& ray, const HitInfo& hitInfo)
+{
+    const glm::vec3 rayPosition = ray.origin + ray.direction * ray.t;
+    return { rayPosition, glm::normalize(hitInfo.normal), glm::normalize(rayPosition - ray.origin), hitInfo.material.kd, hitInfo.material.ks, hitInfo.material.shininess };
+}
+
+void LightSampleBatch::clear()
+{
+    for (std::vector<float>* pComponent : { &positionX, &positionY, &positionZ, &colorR, &colorG, &colorB })
+        pComponent->clear();
+}
+
+void LightSampleBatch::push_back(const glm::vec3& position, const glm::vec3& color)
+{
+    positionX.push_back(position.x);
+    positionY.push_back(position.y);
+    positionZ.push_back(position.z);
+    colorR.push_back(color.r);
+    colorG.push_back(color.g);
+    colorB.push_back(color.b);
+}
+
+#ifdef SHADING_USE_AVX2
+static __m256 fastPow(__m256 x, __m256 exponent)
+{
+    const __m256i bits = _mm256_castps_si256(x);
+    __m256 integerLog2 = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xFF)), _mm256_set1_epi32(127)));
+    __m256 mantissa = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000)));
+    const __m256 isLarge = _mm256_cmp_ps(mantissa, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+    mantissa = _mm256_blendv_ps(mantissa, _mm256_mul_ps(mantissa, _mm256_set1_ps(0.5f)), isLarge);
+    integerLog2 = _mm256_add_ps(integerLog2, _mm256_and_ps(isLarge, _mm256_set1_ps(1.0f)));
+    const __m256 s = _mm256_div_ps(_mm256_sub_ps(mantissa, _mm256_set1_ps(1.0f)), _mm256_add_ps(mantissa, _mm256_set1_ps(1.0f)));
+    const __m256 s2 = _mm256_mul_ps(s, s);
+    __m256 series = _mm256_fmadd_ps(s2, _mm256_set1_ps(log2Coefficients[3]), _mm256_set1_ps(log2Coefficients[2]));
+    series = _mm256_fmadd_ps(s2, series, _mm256_set1_ps(log2Coefficients[1]));
+    series = _mm256_fmadd_ps(s2, series, _mm256_set1_ps(log2Coefficients[0]));
+    const __m256 log2X = _mm256_fmadd_ps(s, series, integerLog2);
+
+    const __m256 y = _mm256_max_ps(_mm256_mul_ps(exponent, log2X), _mm256_set1_ps(-126.0f));
+    const __m256 integer = _mm256_round_ps(y, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    const __m256 f = _mm256_sub_ps(y, integer);
+    __m256 exp2F = _mm256_set1_ps(exp2Coefficients[6]);
+    for (int i = 5; i >= 0; i--)
+        exp2F = _mm256_fmadd_ps(exp2F, f, _mm256_set1_ps(exp2Coefficients[i]));
+    const __m256i scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(integer), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(exp2F, _mm256_castsi256_ps(scale));
+}
+#endif
+
+void computeShadingBatch(const ShadingFrame& frame,
+    std::span<const float> positionX, std::span<const float> positionY, std::span<const float> positionZ,
+    std::span<const float> colorR, std::span<const float> colorG, std::span<const float> colorB,
+    std::span<float> red, std::span<float> green, std::span<float> blue)
+{
+    const size_t numSamples = positionX.size();
+    size_t i = 0;
+#ifdef SHADING_USE_AVX2
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f);
+    const __m256 rayPositionX = _mm256_set1_ps(frame.position.x), rayPositionY = _mm256_set1_ps(frame.position.y), rayPositionZ = _mm256_set1_ps(frame.position.z);
+    const __m256 normalX = _mm256_set1_ps(frame.normal.x), normalY = _mm256_set1_ps(frame.normal.y), normalZ = _mm256_set1_ps(frame.normal.z);
+    const __m256 cameraX = _mm256_set1_ps(frame.cameraVector.x), cameraY = _mm256_set1_ps(frame.cameraVector.y), cameraZ = _mm256_set1_ps(frame.cameraVector.z);
+    const __m256 shininess = _mm256_set1_ps(frame.shininess);
+    for (; i + 8 <= numSamples; i += 8) {
+        __m256 lightX = _mm256_sub_ps(_mm256_loadu_ps(&positionX[i]), rayPositionX);
+        __m256 lightY = _mm256_sub_ps(_mm256_loadu_ps(&positionY[i]), rayPositionY);
+        __m256 lightZ = _mm256_sub_ps(_mm256_loadu_ps(&positionZ[i]), rayPositionZ);
+        const __m256 lengthSquared = _mm256_fmadd_ps(lightX, lightX, _mm256_fmadd_ps(lightY, lightY, _mm256_mul_ps(lightZ, lightZ)));
+        const __m256 inverseLength = _mm256_div_ps(one, _mm256_sqrt_ps(lengthSquared));
+        lightX = _mm256_mul_ps(lightX, inverseLength);
+        lightY = _mm256_mul_ps(lightY, inverseLength);
+        lightZ = _mm256_mul_ps(lightZ, inverseLength);
+
+        const __m256 cosTheta = _mm256_fmadd_ps(normalX, lightX, _mm256_fmadd_ps(normalY, lightY, _mm256_mul_ps(normalZ, lightZ)));
+        const __m256 twoCosTheta = _mm256_mul_ps(two, cosTheta);
+        const __m256 reflectionX = _mm256_fmsub_ps(twoCosTheta, normalX, lightX);
+        const __m256 reflectionY = _mm256_fmsub_ps(twoCosTheta, normalY, lightY);
+        const __m256 reflectionZ = _mm256_fmsub_ps(twoCosTheta, normalZ, lightZ);
+        const __m256 cosAlpha = _mm256_fmadd_ps(reflectionX, cameraX, _mm256_fmadd_ps(reflectionY, cameraY, _mm256_mul_ps(reflectionZ, cameraZ)));
+
+        const __m256 lambertian = _mm256_min_ps(_mm256_max_ps(cosTheta, zero), one);
+        const __m256 phongSpecular = fastPow(_mm256_min_ps(_mm256_max_ps(cosAlpha, zero), one), shininess);
+        const auto shade = [&](float kd, float ks, const float* pColor, float* pResult) {
+            const __m256 factor = _mm256_fmadd_ps(_mm256_set1_ps(kd), lambertian, _mm256_mul_ps(_mm256_set1_ps(ks), phongSpecular));
+            _mm256_storeu_ps(pResult, _mm256_mul_ps(_mm256_loadu_ps(pColor), factor));
+        };
+        shade(frame.kd.r, frame.ks.r, &colorR[i], &red[i]);
+        shade(frame.kd.g, frame.ks.g, &colorG[i], &green[i]);
+        shade(frame.kd.b, frame.ks.b, &colorB[i], &blue[i]);
+    }
+#endif
+    // Remaining samples (or all of them without AVX2).
+    for (; i < numSamples; i++) {
+        float lightX = positionX[i] - frame.position.x;
+        float lightY = positionY[i] - frame.position.y;
+        float lightZ = positionZ[i] - frame.position.z;
+        const float inverseLength = 1.0f / std::sqrt(lightX * lightX + lightY * lightY + lightZ * lightZ);
+        lightX *= inverseLength;
+        lightY *= inverseLength;
+        lightZ *= inverseLength;
+
+        const float cosTheta = frame.normal.x * lightX + frame.normal.y * lightY + frame.normal.z * lightZ;
+        const float reflectionX = 2 * cosTheta * frame.normal.x - lightX;
+        const float reflectionY = 2 * cosTheta * frame.normal.y - lightY;
+        const float reflectionZ = 2 * cosTheta * frame.normal.z - lightZ;
+        const float cosAlpha = reflectionX * frame.cameraVector.x + reflectionY * frame.cameraVector.y + reflectionZ * frame.cameraVector.z;
+
+        const float lambertian = std::clamp(cosTheta, 0.0f, 1.0f);
+        const float phongSpecular = fastPow(std::clamp(cosAlpha, 0.0f, 1.0f), frame.shininess);
+        red[i] = colorR[i] * (frame.kd.r * lambertian + frame.ks.r * phongSpecular);
+        green[i] = colorG[i] * (frame.kd.g * lambertian + frame.ks.g * phongSpecular);
+        blue[i] = colorB[i] * (frame.kd.b * lambertian + frame.ks.b * phongSpecular);
+    }
+}
+
+void computeShadingBatch(const ShadingFrame& frame, const LightSampleBatch& samples, std::span<float> red, std::span<float> green, std::span<float> blue)
+{
+    computeShadingBatch(frame, samples.positionX, samples.positionY, samples.positionZ, samples.colorR, samples.colorG, samples.colorB, red, green, blue);
+}
+
 const Ray computeReflectionRay (Ray ray, HitInfo hitInfo)
 {
     Ray reflectionRay {};
@@ -46,6 +203,12 @@ const Ray computeReflectionRay (Ray ray, HitInfo hitInfo)
     // Setting the variable t to max.
     reflectionRay.t = std::numeric_limits<float>::max();
 
+    // Reflect the ray differentials as well, treating the surface as flat across the footprint of the ray.
+    const glm::vec3 normal = glm::normalize(hitInfo.normal);
+    std::tie(reflectionRay.dOriginDx, reflectionRay.dOriginDy) = computeHitDifferentials(ray, normal);
+    reflectionRay.dDirectionDx = ray.dDirectionDx - 2.0f * glm::dot(ray.dDirectionDx, normal) * normal;
+    reflectionRay.dDirectionDy = ray.dDirectionDy - 2.0f * glm::dot(ray.dDirectionDy, normal) * normal;
+
     return reflectionRay;
 
 }
\ No newline at end of file
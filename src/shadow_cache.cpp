@@ -0,0 +1,76 @@
+#include "shadow_cache.h"
+#include "bvh_statistics.h"
+#include "environment_map.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+std::optional<Primitive> OccluderCache::find(uint32_t slot, uint64_t generation) const
+{
+    if (slot >= m_entries.size() || m_entries[slot].generation != generation)
+        return {};
+    return m_entries[slot].occluder;
+}
+
+void OccluderCache::store(uint32_t slot, const Primitive& occluder, uint64_t generation)
+{
+    if (slot >= m_entries.size())
+        m_entries.resize(size_t(slot) + 1);
+    m_entries[slot] = { occluder, generation };
+}
+
+ShadowMap::ShadowMap(const glm::vec3& lightPosition, int resolution)
+    : m_lightPosition(lightPosition)
+    , m_resolution(std::max(resolution, 1))
+{
+}
+
+std::optional<bool> ShadowMap::isVisible(const glm::vec3& point, const glm::vec3& normal, const BvhInterface& bvh, const Features& features) const
+{
+    std::call_once(m_allocateFlag, [&]() {
+        m_generation = bvh.generation();
+        m_depths = std::vector<std::atomic<float>>(size_t(6) * size_t(m_resolution) * size_t(m_resolution));
+    });
+    if (m_generation != bvh.generation())
+        return {};
+
+    const glm::vec3 toPoint = point - m_lightPosition;
+    int face;
+    glm::vec2 faceCoords;
+    if (!projectOnCube(toPoint, face, faceCoords))
+        return true;
+    const auto texelIndex = [&](float coord) { return std::clamp(static_cast<int>((coord + 1.0f) * 0.5f * float(m_resolution)), 0, m_resolution - 1); };
+    const int x = texelIndex(faceCoords.x);
+    const int y = texelIndex(faceCoords.y);
+    std::atomic<float>& depth = m_depths[(size_t(face) * size_t(m_resolution) + size_t(y)) * size_t(m_resolution) + size_t(x)];
+
+    float occluderDistance = depth.load(std::memory_order_relaxed);
+    if (occluderDistance == 0.0f) {
+        // Trace the texel through its center. Two threads may do so at the same time; both store the same result.
+        const float a = (float(x) + 0.5f) / float(m_resolution) * 2.0f - 1.0f;
+        const float b = (float(y) + 0.5f) / float(m_resolution) * 2.0f - 1.0f;
+        Ray ray { m_lightPosition, glm::normalize(faceDirection(face, a, b)), std::numeric_limits<float>::max() };
+        HitInfo hitInfo;
+        Features depthFeatures = features;
+        depthFeatures.enableTextureMapping = false;
+        depthFeatures.enableNormalInterp = false;
+        const ScopedRayType rayType { RayType::Shadow };
+        occluderDistance = bvh.intersect(ray, hitInfo, depthFeatures) ? ray.t : std::numeric_limits<float>::max();
+        depth.store(occluderDistance, std::memory_order_relaxed);
+    }
+
+    // The surface containing the point itself is seen through the texel center at a slightly different distance:
+    // for a texel spanning an angle delta (at most about 2 * sqrt(2) / resolution) this differs by up to
+    // distance * delta * tan(theta), with theta the angle between the surface normal and the light direction.
+    const float distance = glm::length(toPoint);
+    const float cosTheta = std::abs(glm::dot(normal, toPoint)) / (glm::length(normal) * distance);
+    const float tanTheta = std::min(std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f)) / std::max(cosTheta, 1e-3f), 10.0f);
+    const float bias = distance * 3.0f / float(m_resolution) * tanTheta + 1e-3f;
+    return distance <= occluderDistance + bias;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "bounding_volume_hierarchy.h"
+#include "bvh_interface.h"
+#include "common.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Triangle that most recently blocked a shadow ray towards each light. Neighbouring pixels are mostly shadowed by
+// the same triangle, so testing it first answers many shadow rays without traversing the BVH. Lights are identified
+// by a slot number chosen by the caller. Entries remember the BVH generation they were recorded for and are ignored
+// once the geometry changed. Not thread safe; keep one per thread.
+class OccluderCache {
+public:
+    [[nodiscard]] std::optional<Primitive> find(uint32_t slot, uint64_t generation) const;
+    void store(uint32_t slot, const Primitive& occluder, uint64_t generation);
+
+private:
+    struct Entry {
+        Primitive occluder;
+        uint64_t generation = 0; // Generations start at 1, so 0 marks an empty entry.
+    };
+    std::vector<Entry> m_entries;
+};
+
+// Visibility of a point light stored like a shadow map: a cube map around the light holding, per texel, the
+// distance to the first surface seen from the light. A point is lit if it is not farther from the light than
+// that surface. Texels are traced the first time they are needed, so only the parts of the map seen by the
+// camera cost anything. The answer is approximate: all points within a texel share its occluder distance.
+class ShadowMap {
+public:
+    ShadowMap(const glm::vec3& lightPosition, int resolution);
+
+    // Whether the light reaches the point on a surface with the given normal, or std::nullopt if the map was
+    // filled for other geometry than the given BVH holds. Safe to call from multiple threads at once.
+    [[nodiscard]] std::optional<bool> isVisible(const glm::vec3& point, const glm::vec3& normal, const BvhInterface& bvh, const Features& features) const;
+
+    [[nodiscard]] const glm::vec3& lightPosition() const { return m_lightPosition; }
+    [[nodiscard]] int resolution() const { return m_resolution; }
+
+private:
+    glm::vec3 m_lightPosition;
+    int m_resolution;
+
+    mutable std::once_flag m_allocateFlag;
+    mutable uint64_t m_generation = 0;
+    // Distance to the first surface per texel of the six faces; 0 for texels that were not traced yet.
+    mutable std::vector<std::atomic<float>> m_depths;
+};
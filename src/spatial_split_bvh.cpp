@@ -0,0 +1,296 @@
+#include "spatial_split_bvh.h"
+#include "scene.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/vector_relational.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <limits>
+
+namespace {
+// A primitive together with the box around the part of it that lies inside the node.
+struct Reference {
+    Primitive primitive;
+    AxisAlignedBox box;
+};
+
+struct Split {
+    float cost = std::numeric_limits<float>::max();
+    int axis = -1;
+    // Object split: position in the references sorted along the axis. Spatial split: coordinate of the plane.
+    size_t index = 0;
+    float plane = 0.0f;
+    AxisAlignedBox leftBox, rightBox;
+    size_t leftCount = 0, rightCount = 0;
+};
+}
+
+static constexpr AxisAlignedBox emptyBox { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest()) };
+
+static AxisAlignedBox merge(const AxisAlignedBox& lhs, const AxisAlignedBox& rhs)
+{
+    return { glm::min(lhs.lower, rhs.lower), glm::max(lhs.upper, rhs.upper) };
+}
+
+static AxisAlignedBox intersection(const AxisAlignedBox& lhs, const AxisAlignedBox& rhs)
+{
+    return { glm::max(lhs.lower, rhs.lower), glm::min(lhs.upper, rhs.upper) };
+}
+
+static bool isEmpty(const AxisAlignedBox& box)
+{
+    return glm::any(glm::greaterThan(box.lower, box.upper));
+}
+
+static float surfaceArea(const AxisAlignedBox& box)
+{
+    if (isEmpty(box))
+        return 0.0f;
+    const glm::vec3 extent = box.upper - box.lower;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static float centroid(const Reference& reference, int axis)
+{
+    return reference.box.lower[axis] + reference.box.upper[axis];
+}
+
+// Box around the part of the primitive between the planes lower and upper along the axis, within the box of the
+// reference. Empty if nothing of the primitive lies there.
+static AxisAlignedBox clipReference(const Reference& reference, int axis, float lower, float upper, const Scene& scene)
+{
+    AxisAlignedBox box = emptyBox;
+    if (reference.primitive.isSphere()) {
+        const auto& sphere = scene.spheres[reference.primitive.triangleIndex];
+        box = { sphere.center - sphere.radius, sphere.center + sphere.radius };
+    } else {
+        const auto& mesh = scene.meshes[reference.primitive.meshIndex];
+        const auto& triangle = mesh.triangles[reference.primitive.triangleIndex];
+        // The clipped triangle is spanned by its vertices between the planes and the points where its edges cross them.
+        for (int edge = 0; edge < 3; edge++) {
+            const glm::vec3& a = mesh.vertices[triangle[edge]].position;
+            const glm::vec3& b = mesh.vertices[triangle[(edge + 1) % 3]].position;
+            if (a[axis] >= lower && a[axis] <= upper)
+                box = merge(box, { a, a });
+            for (const float plane : { lower, upper }) {
+                if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane)) {
+                    const glm::vec3 point = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+                    box = merge(box, { point, point });
+                }
+            }
+        }
+    }
+    box.lower[axis] = std::max(box.lower[axis], lower);
+    box.upper[axis] = std::min(box.upper[axis], upper);
+    return intersection(box, reference.box);
+}
+
+namespace {
+class SpatialSplitBuilder {
+public:
+    SpatialSplitBuilder(const Scene& scene, const BvhSettings& settings, size_t numPrimitives)
+        : m_scene(scene)
+        , m_settings(settings)
+        , m_maxReferences(size_t(float(numPrimitives) * std::max(settings.spatialSplitMemoryFactor, 1.0f)))
+        , m_numReferences(numPrimitives)
+    {
+    }
+
+    uint32_t build(std::vector<Reference>& references, int level)
+    {
+        AxisAlignedBox box = emptyBox;
+        for (const auto& reference : references)
+            box = merge(box, reference.box);
+        if (m_rootArea == 0.0f)
+            m_rootArea = surfaceArea(box);
+
+        if (references.size() <= size_t(m_settings.leafSize) || level > m_settings.maxDepth) {
+            const uint32_t offset = uint32_t(primitives.size());
+            for (const auto& reference : references)
+                primitives.push_back(reference.primitive);
+            nodes.push_back(Node { .box = box, .level = level, .isLeaf = true, .first = offset, .second = uint32_t(references.size()) });
+            return uint32_t(nodes.size() - 1);
+        }
+
+        std::vector<Reference> left, right;
+        const Split objectSplit = findObjectSplit(references, box);
+        // Only try splitting space if the halves of the object split overlap noticeably.
+        Split spatialSplit;
+        if (surfaceArea(intersection(objectSplit.leftBox, objectSplit.rightBox)) > 1e-5f * m_rootArea)
+            spatialSplit = findSpatialSplit(references, box);
+        if (spatialSplit.cost < objectSplit.cost) {
+            performSpatialSplit(references, spatialSplit, left, right);
+        }
+        // Split the objects, also if unsplitting moved every reference of a spatial split to the same side.
+        if (left.empty() || right.empty()) {
+            left.clear();
+            right.clear();
+            std::sort(std::begin(references), std::end(references), [&](const Reference& lhs, const Reference& rhs) {
+                return centroid(lhs, objectSplit.axis) < centroid(rhs, objectSplit.axis);
+            });
+            left.assign(std::begin(references), std::begin(references) + ptrdiff_t(objectSplit.index));
+            right.assign(std::begin(references) + ptrdiff_t(objectSplit.index), std::end(references));
+        }
+        // Free the memory of this level before descending.
+        std::vector<Reference>().swap(references);
+
+        const uint32_t leftIndex = build(left, level + 1);
+        const uint32_t rightIndex = build(right, level + 1);
+        nodes.push_back(Node { .box = box, .level = level, .isLeaf = false, .first = leftIndex, .second = rightIndex });
+        return uint32_t(nodes.size() - 1);
+    }
+
+    std::vector<Node> nodes;
+    std::vector<Primitive> primitives;
+
+private:
+    // Costs are relative to the area of the node: one for visiting it plus the expected number of primitive tests.
+    Split findObjectSplit(std::vector<Reference>& references, const AxisAlignedBox& box) const
+    {
+        const float inverseArea = 1.0f / std::max(surfaceArea(box), std::numeric_limits<float>::min());
+        std::vector<AxisAlignedBox> rightBoxes(references.size());
+        Split best;
+        for (int axis = 0; axis < 3; axis++) {
+            std::sort(std::begin(references), std::end(references), [&](const Reference& lhs, const Reference& rhs) {
+                return centroid(lhs, axis) < centroid(rhs, axis);
+            });
+            // rightBoxes[i] bounds the references from i on.
+            AxisAlignedBox rightBox = emptyBox;
+            for (size_t i = references.size(); i-- > 1;) {
+                rightBox = merge(rightBox, references[i].box);
+                rightBoxes[i] = rightBox;
+            }
+            AxisAlignedBox leftBox = emptyBox;
+            for (size_t i = 1; i < references.size(); i++) {
+                leftBox = merge(leftBox, references[i - 1].box);
+                const float cost = 1.0f + (surfaceArea(leftBox) * float(i) + surfaceArea(rightBoxes[i]) * float(references.size() - i)) * inverseArea;
+                if (cost < best.cost) {
+                    best = { .cost = cost, .axis = axis, .index = i, .plane = 0.0f, .leftBox = leftBox, .rightBox = rightBoxes[i], .leftCount = i, .rightCount = references.size() - i };
+                }
+            }
+        }
+        return best;
+    }
+
+    Split findSpatialSplit(const std::vector<Reference>& references, const AxisAlignedBox& box) const
+    {
+        Split best;
+        const size_t numBins = size_t(std::max(m_settings.binCount, 1)) + 1;
+        const float inverseArea = 1.0f / std::max(surfaceArea(box), std::numeric_limits<float>::min());
+        std::vector<AxisAlignedBox> binBoxes(numBins);
+        std::vector<size_t> entries(numBins), exits(numBins);
+        std::vector<AxisAlignedBox> rightBoxes(numBins);
+        for (int axis = 0; axis < 3; axis++) {
+            const float origin = box.lower[axis];
+            const float binSize = (box.upper[axis] - origin) / float(numBins);
+            if (!(binSize > 0.0f))
+                continue;
+            const auto binOf = [&](float coordinate) {
+                return std::min(size_t(std::max((coordinate - origin) / binSize, 0.0f)), numBins - 1);
+            };
+
+            // Chop every reference into the bins it overlaps.
+            std::fill(std::begin(binBoxes), std::end(binBoxes), emptyBox);
+            std::fill(std::begin(entries), std::end(entries), 0);
+            std::fill(std::begin(exits), std::end(exits), 0);
+            for (const auto& reference : references) {
+                const size_t firstBin = binOf(reference.box.lower[axis]);
+                const size_t lastBin = binOf(reference.box.upper[axis]);
+                for (size_t bin = firstBin; bin <= lastBin; bin++) {
+                    const float lower = bin == firstBin ? reference.box.lower[axis] : origin + binSize * float(bin);
+                    const float upper = bin == lastBin ? reference.box.upper[axis] : origin + binSize * float(bin + 1);
+                    binBoxes[bin] = merge(binBoxes[bin], clipReference(reference, axis, lower, upper, m_scene));
+                }
+                entries[firstBin]++;
+                exits[lastBin]++;
+            }
+
+            AxisAlignedBox rightBox = emptyBox;
+            for (size_t bin = numBins; bin-- > 1;) {
+                rightBox = merge(rightBox, binBoxes[bin]);
+                rightBoxes[bin] = rightBox;
+            }
+            AxisAlignedBox leftBox = emptyBox;
+            size_t leftCount = 0, rightCount = references.size();
+            for (size_t bin = 1; bin < numBins; bin++) {
+                // Plane between bin - 1 and bin.
+                leftBox = merge(leftBox, binBoxes[bin - 1]);
+                leftCount += entries[bin - 1];
+                rightCount -= exits[bin - 1];
+                if (leftCount == references.size() || rightCount == references.size() || leftCount == 0 || rightCount == 0)
+                    continue;
+                const float cost = 1.0f + (surfaceArea(leftBox) * float(leftCount) + surfaceArea(rightBoxes[bin]) * float(rightCount)) * inverseArea;
+                if (cost < best.cost) {
+                    best = { .cost = cost, .axis = axis, .index = 0, .plane = origin + binSize * float(bin), .leftBox = leftBox, .rightBox = rightBoxes[bin], .leftCount = leftCount, .rightCount = rightCount };
+                }
+            }
+        }
+        // Only split space if the references it duplicates still fit in the budget.
+        if (best.axis >= 0 && m_numReferences + best.leftCount + best.rightCount - references.size() > m_maxReferences)
+            return {};
+        return best;
+    }
+
+    void performSpatialSplit(const std::vector<Reference>& references, const Split& split, std::vector<Reference>& left, std::vector<Reference>& right)
+    {
+        const int axis = split.axis;
+        AxisAlignedBox leftBox = split.leftBox, rightBox = split.rightBox;
+        size_t leftCount = split.leftCount, rightCount = split.rightCount;
+        for (const auto& reference : references) {
+            if (reference.box.upper[axis] <= split.plane) {
+                left.push_back(reference);
+                continue;
+            }
+            if (reference.box.lower[axis] >= split.plane) {
+                right.push_back(reference);
+                continue;
+            }
+
+            // Keep the reference whole on one side if that is cheaper than duplicating it ("unsplitting").
+            const float splitCost = surfaceArea(leftBox) * float(leftCount) + surfaceArea(rightBox) * float(rightCount);
+            const AxisAlignedBox leftOnlyBox = merge(leftBox, reference.box);
+            const AxisAlignedBox rightOnlyBox = merge(rightBox, reference.box);
+            const float leftOnlyCost = surfaceArea(leftOnlyBox) * float(leftCount) + surfaceArea(rightBox) * float(rightCount - 1);
+            const float rightOnlyCost = surfaceArea(leftBox) * float(leftCount - 1) + surfaceArea(rightOnlyBox) * float(rightCount);
+            const AxisAlignedBox leftPart = clipReference(reference, axis, reference.box.lower[axis], split.plane, m_scene);
+            const AxisAlignedBox rightPart = clipReference(reference, axis, split.plane, reference.box.upper[axis], m_scene);
+            if (isEmpty(rightPart) || (!isEmpty(leftPart) && leftOnlyCost < splitCost && leftOnlyCost <= rightOnlyCost)) {
+                left.push_back(reference);
+                leftBox = leftOnlyBox;
+                rightCount--;
+            } else if (isEmpty(leftPart) || rightOnlyCost < splitCost) {
+                right.push_back(reference);
+                rightBox = rightOnlyBox;
+                leftCount--;
+            } else {
+                left.push_back({ reference.primitive, leftPart });
+                right.push_back({ reference.primitive, rightPart });
+                m_numReferences++;
+            }
+        }
+    }
+
+    const Scene& m_scene;
+    const BvhSettings& m_settings;
+    const size_t m_maxReferences;
+    size_t m_numReferences;
+    float m_rootArea = 0.0f;
+};
+}
+
+std::vector<Node> buildSpatialSplitBvh(std::vector<Primitive>& primitives, const Scene& scene, const BvhSettings& settings)
+{
+    if (primitives.empty())
+        return {};
+    std::vector<Reference> references;
+    references.reserve(primitives.size());
+    for (auto it = std::begin(primitives); it != std::end(primitives); ++it)
+        references.push_back({ *it, getBox(it, it + 1, scene) });
+
+    SpatialSplitBuilder builder { scene, settings, primitives.size() };
+    builder.build(references, 0);
+    primitives = std::move(builder.primitives);
+    return std::move(builder.nodes);
+}
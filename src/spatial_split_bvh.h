@@ -0,0 +1,18 @@
+#pragma once
+#include "bounding_volume_hierarchy.h"
+#include "common.h"
+#include <vector>
+
+// Forward declaration.
+struct Scene;
+
+// Spatial split BVH builder (Stich et al., "Spatial Splits in Bounding Volume Hierarchies", 2009). Every node is
+// split by the best SAH object partition (a full sweep over the centroids along each axis); if the two halves of
+// that partition overlap, splitting space at one of settings.binCount planes per axis is evaluated as well. A
+// spatial split clips the primitives that straddle the plane, so a long triangle ends up in several leaves, each
+// time with a tight box around the part inside that leaf. The number of references is capped at
+// settings.spatialSplitMemoryFactor times the number of primitives.
+//
+// Returns the nodes in the layout of BoundingVolumeHierarchy (children before parents, root last) and replaces
+// primitives by the references of the leaves in order, which may contain a primitive more than once.
+[[nodiscard]] std::vector<Node> buildSpatialSplitBvh(std::vector<Primitive>& primitives, const Scene& scene, const BvhSettings& settings);
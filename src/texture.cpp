@@ -1,15 +1,97 @@
 #include "texture.h"
 #include <framework/image.h>
-#include "iostream"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+
+// Bilinear interpolation between the four texels closest to the texture coordinate in a mipmap level.
+static glm::vec3 bilinearTexel(const Image& image, const glm::vec2& texCoord, int level)
+{
+    const glm::ivec2 resolution = image.levelResolution(level);
+    // Texel coordinates with the texel centers at whole numbers.
+    const float x = texCoord.x * resolution.x - 0.5f;
+    const float y = resolution.y - texCoord.y * resolution.y - 0.5f;
+    const float floorX = std::floor(x), floorY = std::floor(y);
+    const float fracX = x - floorX, fracY = y - floorY;
+
+    const int x0 = std::clamp(static_cast<int>(floorX), 0, resolution.x - 1);
+    const int x1 = std::clamp(static_cast<int>(floorX) + 1, 0, resolution.x - 1);
+    const int y0 = std::clamp(static_cast<int>(floorY), 0, resolution.y - 1);
+    const int y1 = std::clamp(static_cast<int>(floorY) + 1, 0, resolution.y - 1);
+    const glm::vec3 top = glm::mix(image.getTexel(x0, y0, level), image.getTexel(x1, y0, level), fracX);
+    const glm::vec3 bottom = glm::mix(image.getTexel(x0, y1, level), image.getTexel(x1, y1, level), fracX);
+    return glm::mix(top, bottom, fracY);
+}
 
 glm::vec3 acquireTexel(const Image& image, const glm::vec2& texCoord, const Features& features)
 {
+    return acquireTexel(image, texCoord, glm::vec2(0.0f), glm::vec2(0.0f), features);
+}
+
+glm::vec3 acquireTexel(const Image& image, const glm::vec2& texCoord, const glm::vec2& dTexCoordDx, const glm::vec2& dTexCoordDy, const Features& features)
+{
+    if (features.extra.enableMipmapTextureFiltering) {
+        // The level at which one texel covers the footprint of the pixel.
+        const glm::vec2 resolution { image.width, image.height };
+        const float footprint = std::max(glm::length(dTexCoordDx * resolution), glm::length(dTexCoordDy * resolution));
+        float lod = std::log2(footprint);
+        lod = lod > 0.0f ? std::min(lod, static_cast<float>(image.numLevels() - 1)) : 0.0f;
+
+        const int level = static_cast<int>(lod);
+        const glm::vec3 color = bilinearTexel(image, texCoord, level);
+        if (level + 1 == image.numLevels())
+            return color;
+        return glm::mix(color, bilinearTexel(image, texCoord, level + 1), lod - static_cast<float>(level));
+    }
+    if (features.extra.enableBilinearTextureFiltering)
+        return bilinearTexel(image, texCoord, 0);
+
     // TODO: implement this function.
     // Given texcoords, return the corresponding pixel of the image
     // The pixel are stored in a 1D array of row major order
     // you can convert from position (i,j) to an index using the method seen in the lecture
     // Note, the center of the first pixel is at image coordinates (0.5, 0.5)
-    int i = std::float_round_style(texCoord.x * image.width);
-    int j = std::float_round_style(image.height - texCoord.y * image.height);
-    return image.pixels[j * image.width + i];
-}
\ No newline at end of file
+    // Texture coordinates on (or beyond) the border would otherwise index outside of the image.
+    const int i = std::clamp(static_cast<int>(texCoord.x * image.width), 0, image.width - 1);
+    const int j = std::clamp(static_cast<int>(image.height - texCoord.y * image.height), 0, image.height - 1);
+    return image.getTexel(i, j);
+}
+
+std::pair<glm::vec3, glm::vec3> computeHitDifferentials(const Ray& ray, const glm::vec3& normal)
+{
+    // Move the differentials along the ray to the hit point and project them onto the surface.
+    const glm::vec3 dPositionDx = ray.dOriginDx + ray.t * ray.dDirectionDx;
+    const glm::vec3 dPositionDy = ray.dOriginDy + ray.t * ray.dDirectionDy;
+    const float cosTheta = glm::dot(ray.direction, normal);
+    if (std::abs(cosTheta) < 1e-6f)
+        return { dPositionDx, dPositionDy };
+    return {
+        dPositionDx - glm::dot(dPositionDx, normal) / cosTheta * ray.direction,
+        dPositionDy - glm::dot(dPositionDy, normal) / cosTheta * ray.direction
+    };
+}
+
+std::pair<glm::vec2, glm::vec2> computeTexCoordDifferentials(const Ray& ray, const Vertex& v0, const Vertex& v1, const Vertex& v2)
+{
+    const glm::vec3 edge1 = v1.position - v0.position;
+    const glm::vec3 edge2 = v2.position - v0.position;
+    const float e11 = glm::dot(edge1, edge1), e12 = glm::dot(edge1, edge2), e22 = glm::dot(edge2, edge2);
+    const float determinant = e11 * e22 - e12 * e12;
+    if (determinant <= 0.0f)
+        return { glm::vec2(0.0f), glm::vec2(0.0f) };
+    const auto [dPositionDx, dPositionDy] = computeHitDifferentials(ray, glm::normalize(glm::cross(edge1, edge2)));
+
+    // Express the change of position in the edges of the triangle and apply the same change to the texture coordinates.
+    const auto toTexCoord = [&](const glm::vec3& dPosition) {
+        const float d1 = glm::dot(dPosition, edge1), d2 = glm::dot(dPosition, edge2);
+        const float b1 = (e22 * d1 - e12 * d2) / determinant;
+        const float b2 = (e11 * d2 - e12 * d1) / determinant;
+        return b1 * (v1.texCoord - v0.texCoord) + b2 * (v2.texCoord - v0.texCoord);
+    };
+    return { toTexCoord(dPositionDx), toTexCoord(dPositionDy) };
+}
@@ -6,9 +6,21 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
+#include <framework/ray.h>
+#include <utility>
 
 // Forward declarations.
 struct Image;
 
 // Given an image and a texture coordinate, return the corresponding texel.
-glm::vec3 acquireTexel(const Image& image, const glm::vec2& texCoord, const Features& features);
\ No newline at end of file
+glm::vec3 acquireTexel(const Image& image, const glm::vec2& texCoord, const Features& features);
+
+// Same as above, with the change of the texture coordinate per pixel in x and y (zero if unknown). With mipmap
+// filtering enabled these select the mipmap level, which is then sampled trilinearly.
+glm::vec3 acquireTexel(const Image& image, const glm::vec2& texCoord, const glm::vec2& dTexCoordDx, const glm::vec2& dTexCoordDy, const Features& features);
+
+// Change of the hit point ray.origin + ray.t * ray.direction per pixel in x and y, on a surface with the given normal.
+std::pair<glm::vec3, glm::vec3> computeHitDifferentials(const Ray& ray, const glm::vec3& normal);
+
+// Change of the texture coordinate per pixel in x and y at the point where the ray hits the triangle.
+std::pair<glm::vec2, glm::vec2> computeTexCoordDifferentials(const Ray& ray, const Vertex& v0, const Vertex& v1, const Vertex& v2);
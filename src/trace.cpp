@@ -0,0 +1,84 @@
+#include "trace.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+bool enableTracing = false;
+
+namespace {
+struct TraceEvent {
+    const char* name;
+    int64_t index;
+    int64_t start; // Nanoseconds since traceEpoch.
+    int64_t duration;
+};
+
+struct ThreadTrace {
+    uint32_t threadIndex;
+    std::vector<TraceEvent> events;
+};
+
+const auto traceEpoch = std::chrono::steady_clock::now();
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadTrace>> registry;
+}
+
+static int64_t traceTime()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch).count();
+}
+
+// Buffer of the calling thread; only the first event of a thread takes the lock, to register its buffer.
+static ThreadTrace& threadTrace()
+{
+    thread_local ThreadTrace* pTrace = [] {
+        std::scoped_lock lock { registryMutex };
+        registry.push_back(std::make_unique<ThreadTrace>(ThreadTrace { uint32_t(registry.size()), {} }));
+        return registry.back().get();
+    }();
+    return *pTrace;
+}
+
+TraceScope::TraceScope(const char* name, int64_t index)
+    : m_name(name)
+    , m_index(index)
+{
+    if (enableTracing)
+        m_start = traceTime();
+}
+
+TraceScope::~TraceScope()
+{
+    if (m_start >= 0)
+        threadTrace().events.push_back({ m_name, m_index, m_start, traceTime() - m_start });
+}
+
+bool writeTrace(const std::filesystem::path& filePath)
+{
+    std::ofstream stream { filePath };
+    stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    std::scoped_lock lock { registryMutex };
+    for (const auto& pTrace : registry) {
+        // Chrome trace timestamps are in (fractional) microseconds.
+        stream << (first ? "\n" : ",\n")
+               << fmt::format(R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":"Thread {}"}}}})", pTrace->threadIndex, pTrace->threadIndex);
+        first = false;
+        for (const auto& event : pTrace->events) {
+            stream << ",\n"
+                   << fmt::format(R"({{"name":"{}","ph":"X","pid":1,"tid":{},"ts":{:.3f},"dur":{:.3f})", event.name, pTrace->threadIndex, double(event.start) * 1e-3, double(event.duration) * 1e-3);
+            if (event.index >= 0)
+                stream << fmt::format(R"(,"args":{{"index":{}}})", event.index);
+            stream << "}";
+        }
+    }
+    stream << "\n]}" << std::endl;
+    return bool(stream);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+
+// Flag to enable/disable recording trace events (see TraceScope).
+extern bool enableTracing;
+
+// Records the time spent in a stage of the renderer, from construction to destruction, as an event on the timeline
+// of the calling thread. Every thread appends to a buffer of its own, so recording takes no locks. Does nothing
+// unless enableTracing was set when the scope started.
+class TraceScope {
+public:
+    // name must outlive the trace (a string literal); index tells apart repeated stages, e.g. the camera or row.
+    explicit TraceScope(const char* name, int64_t index = -1);
+    ~TraceScope();
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* m_name;
+    int64_t m_index;
+    int64_t m_start = -1; // Nanoseconds since the start of the program; negative if not recording.
+};
+
+// Write all events recorded so far as Chrome trace JSON, which chrome://tracing and ui.perfetto.dev can open.
+// Threads must not record events meanwhile. Returns false if the file could not be written.
+bool writeTrace(const std::filesystem::path& filePath);
@@ -0,0 +1,219 @@
+#include "bounding_volume_hierarchy.h"
+#include "bvh_interface.h"
+#include "bvh_statistics.h"
+#include "draw.h"
+#include "scene.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+// Every hierarchy must find exactly the hits of the naive loop over all primitives: the same primitive at the
+// same (bitwise equal) distance, so that faster builders and traversals render identical images.
+
+static std::vector<Ray> randomRays(const Scene& scene, size_t count)
+{
+    AxisAlignedBox bounds { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) };
+    for (const auto& mesh : scene.meshes) {
+        for (const auto& vertex : mesh.vertices) {
+            bounds.lower = glm::min(bounds.lower, vertex.position);
+            bounds.upper = glm::max(bounds.upper, vertex.position);
+        }
+    }
+    for (const auto& sphere : scene.spheres) {
+        bounds.lower = glm::min(bounds.lower, sphere.center - sphere.radius);
+        bounds.upper = glm::max(bounds.upper, sphere.center + sphere.radius);
+    }
+    // Origins inside and around the scene, towards random points of the scene.
+    const glm::vec3 center = (bounds.lower + bounds.upper) * 0.5f, extent = bounds.upper - bounds.lower;
+    std::mt19937 rng { 42 };
+    std::uniform_real_distribution<float> uniform { -1.0f, 1.0f };
+    const auto randomPoint = [&](float scale) { return center + glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * extent * scale; };
+    std::vector<Ray> rays;
+    for (size_t i = 0; i < count; i++) {
+        const glm::vec3 origin = randomPoint(1.0f);
+        rays.push_back(Ray { origin, glm::normalize(randomPoint(0.5f) - origin) });
+    }
+    return rays;
+}
+
+static void requireSameHits(const BvhInterface& bvh, const Scene& scene, const Features& features)
+{
+    Features naiveFeatures = features;
+    naiveFeatures.enableAccelStructure = false;
+    for (const Ray& cameraRay : randomRays(scene, 2000)) {
+        Ray naiveRay = cameraRay, ray = cameraRay, anyRay = cameraRay;
+        HitInfo naiveHitInfo, hitInfo;
+        const bool naiveHit = bvh.intersect(naiveRay, naiveHitInfo, naiveFeatures);
+        const bool hit = bvh.intersect(ray, hitInfo, features);
+        REQUIRE(hit == naiveHit);
+        REQUIRE(bvh.intersectAny(anyRay, features) == naiveHit);
+        if (hit) {
+            REQUIRE(std::bit_cast<uint32_t>(ray.t) == std::bit_cast<uint32_t>(naiveRay.t));
+            REQUIRE(hitInfo.material.kd == naiveHitInfo.material.kd);
+        }
+    }
+}
+
+static void requireSameHits(Scene& scene, const Features& features)
+{
+    const BvhInterface bvh { &scene, features };
+    requireSameHits(bvh, scene, features);
+}
+
+TEST_CASE("BVH traversal finds the same hits as the naive loop", "[bvh]")
+{
+    enableDebugDraw = false;
+    const auto sceneType = GENERATE(SceneType::CornellBox, SceneType::Monkey, SceneType::Teapot, SceneType::Spheres, SceneType::Custom);
+    Scene scene = loadScenePrebuilt(sceneType, DATA_DIR);
+
+    Features features {};
+    features.enableAccelStructure = true;
+    SECTION("Median splits")
+    {
+        requireSameHits(scene, features);
+    }
+    SECTION("SAH binning")
+    {
+        features.extra.enableBvhSahBinning = true;
+        requireSameHits(scene, features);
+    }
+    SECTION("Linear BVH with rotations and larger leaves")
+    {
+        features.bvh.buildQuality = BvhBuildQuality::Fast;
+        features.bvh.optimizationPasses = 2;
+        features.bvh.leafSize = 4;
+        requireSameHits(scene, features);
+    }
+    SECTION("Spatial splits")
+    {
+        features.bvh.buildQuality = BvhBuildQuality::High;
+        requireSameHits(scene, features);
+    }
+}
+
+TEST_CASE("Two-level hierarchy finds the same hits as the naive loop over its instances", "[bvh]")
+{
+    enableDebugDraw = false;
+    Scene scene = loadScenePrebuilt(SceneType::Teapot, DATA_DIR);
+    scene.instances.push_back(MeshInstance { 0, glm::mat4x3(1.0f) });
+    scene.instances.push_back(MeshInstance { 0, glm::mat4x3(glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 0.0f, 0.0f)), 1.0f, glm::vec3(0.0f, 1.0f, 0.0f))) });
+    Features features {};
+    features.enableAccelStructure = true;
+    requireSameHits(scene, features);
+}
+
+TEST_CASE("Refitting a hierarchy whose vertices did not move keeps it", "[bvh]")
+{
+    enableDebugDraw = false;
+    Scene scene = loadScenePrebuilt(SceneType::Monkey, DATA_DIR);
+    Features features {};
+    features.enableAccelStructure = true;
+    features.bvh.buildQuality = GENERATE(BvhBuildQuality::Full, BvhBuildQuality::Fast, BvhBuildQuality::High);
+    // Spatial splits clip leaf boxes, which refitting does not; that alone must not count as degradation.
+    features.bvh.refitRebuildThreshold = 1.0f;
+    BoundingVolumeHierarchy bvh { &scene, features };
+    CHECK(!bvh.refit(features));
+    CHECK(!bvh.refit(features));
+}
+
+TEST_CASE("Refitted and rebuilt hierarchies find the same hits as the naive loop", "[bvh]")
+{
+    enableDebugDraw = false;
+    Scene scene = loadScenePrebuilt(SceneType::Monkey, DATA_DIR);
+    Features features {};
+    features.enableAccelStructure = true;
+    features.bvh.buildQuality = GENERATE(BvhBuildQuality::Full, BvhBuildQuality::Fast, BvhBuildQuality::High);
+    BvhInterface bvh { &scene, features };
+    const uint64_t builtGeneration = bvh.generation();
+
+    // A smooth deformation keeps the structure of the hierarchy useful, so it is refitted.
+    for (Mesh& mesh : scene.meshes) {
+        for (Vertex& vertex : mesh.vertices)
+            vertex.position += glm::vec3(0.1f * std::sin(4.0f * vertex.position.y), 0.05f * vertex.position.x, 0.0f);
+    }
+    features.bvh.refitRebuildThreshold = 1e6f;
+    CHECK(!bvh.refit(features));
+    CHECK(bvh.generation() != builtGeneration);
+    requireSameHits(bvh, scene, features);
+
+    // Scattering the vertices makes every box span most of the scene, so the hierarchy is rebuilt.
+    std::mt19937 rng { 3 };
+    for (Mesh& mesh : scene.meshes)
+        std::shuffle(std::begin(mesh.vertices), std::end(mesh.vertices), rng);
+    features.bvh.refitRebuildThreshold = 1.5f;
+    CHECK(bvh.refit(features));
+    requireSameHits(bvh, scene, features);
+}
+
+TEST_CASE("Stored hierarchies load for the same scene and settings only", "[bvh]")
+{
+    enableDebugDraw = false;
+    Scene scene = loadScenePrebuilt(SceneType::Teapot, DATA_DIR);
+    Features features {};
+    features.enableAccelStructure = true;
+    features.bvh.buildQuality = GENERATE(BvhBuildQuality::Full, BvhBuildQuality::Fast, BvhBuildQuality::High);
+    const auto cacheFile = std::filesystem::temp_directory_path() / "final_project_tests" / "teapot.bvh";
+    std::filesystem::create_directories(cacheFile.parent_path());
+    std::filesystem::remove(cacheFile);
+
+    const BoundingVolumeHierarchy built { &scene, features, cacheFile };
+    REQUIRE(std::filesystem::exists(cacheFile));
+    Features otherFeatures = features;
+    otherFeatures.bvh.buildQuality = features.bvh.buildQuality == BvhBuildQuality::Full ? BvhBuildQuality::Fast : BvhBuildQuality::Full;
+    BoundingVolumeHierarchy loaded { &scene, otherFeatures };
+    CHECK(!loaded.load(cacheFile, otherFeatures));
+    REQUIRE(loaded.load(cacheFile, features));
+    const BvhStatistics builtStatistics = built.statistics(), loadedStatistics = loaded.statistics();
+    CHECK(loadedStatistics.numNodes == builtStatistics.numNodes);
+    CHECK(loadedStatistics.numReferences == builtStatistics.numReferences);
+    CHECK(loadedStatistics.sahCost == builtStatistics.sahCost);
+
+    // The loaded hierarchy is used through BvhInterface as well.
+    const BvhInterface bvh { &scene, features, cacheFile };
+    CHECK(bvh.statistics().sahCost == builtStatistics.sahCost);
+    requireSameHits(bvh, scene, features);
+
+    scene.meshes[0].vertices[0].position += glm::vec3(0.01f);
+    CHECK(!loaded.load(cacheFile, features));
+    std::filesystem::remove(cacheFile);
+}
+
+TEST_CASE("BVH traversal throughput", "[.][benchmark]")
+{
+    enableDebugDraw = false;
+    Scene scene = loadScenePrebuilt(SceneType::Teapot, DATA_DIR);
+    Features features {};
+    features.enableAccelStructure = true;
+    const BvhInterface bvh { &scene, features };
+    const std::vector<Ray> rays = randomRays(scene, 1024);
+
+    BENCHMARK("BvhInterface::intersect x1024 (teapot)")
+    {
+        int numHits = 0;
+        for (Ray ray : rays) {
+            HitInfo hitInfo;
+            numHits += bvh.intersect(ray, hitInfo, features);
+        }
+        return numHits;
+    };
+    BENCHMARK("BvhInterface::intersectAny x1024 (teapot)")
+    {
+        int numHits = 0;
+        for (Ray ray : rays)
+            numHits += bvh.intersectAny(ray, features);
+        return numHits;
+    };
+}
@@ -0,0 +1,50 @@
+#include "config.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <catch2/catch_test_macros.hpp>
+DISABLE_WARNINGS_POP()
+#include <string>
+
+// Render server requests are configurations written as JSON; they must read exactly like the equivalent TOML file.
+
+TEST_CASE("JSON configurations read like TOML files", "[config]")
+{
+    std::string error;
+    const std::optional<Config> config = readConfigJson(R"({
+        "scene": "teapot", "window_size": [640, 480], "output_file": "/tmp/image.bmp", "time_budget_ms": 250,
+        "features": { "enable_shading": true, "extra": { "enable_bloom_effect": true, "light_samples": 8 } },
+        "bvh": { "build_quality": "high", "spatial_split_memory_factor": 2 },
+        "cameras": [ { "field_of_view": 60, "look_at": [0, 1.5, -2e-1] }, {} ],
+        "lights": [ { "type": "point", "position": [1, 2, 3], "color": [1, 1, 1] } ],
+        "comment": "café 😀 \"quoted\"", "ignored": null })",
+        error);
+    REQUIRE(config);
+    CHECK(std::get<SceneType>(config->scene) == SceneType::Teapot);
+    CHECK(config->windowSize == glm::ivec2(640, 480));
+    CHECK(config->outputFile == "/tmp/image.bmp");
+    CHECK(config->timeBudgetMs == 250.0f);
+    CHECK(config->features.enableShading);
+    CHECK(!config->features.enableRecursive);
+    CHECK(config->features.extra.enableBloomEffect);
+    CHECK(config->features.extra.lightSamples == 8);
+    CHECK(config->features.bvh.buildQuality == BvhBuildQuality::High);
+    CHECK(config->features.bvh.spatialSplitMemoryFactor == 2.0f);
+    REQUIRE(config->cameras.size() == 2);
+    CHECK(config->cameras[0].fieldOfView == 60.0f);
+    CHECK(config->cameras[0].lookAt == glm::vec3(0.0f, 1.5f, -0.2f));
+    CHECK(config->cameras[1].fieldOfView == CameraConfig {}.fieldOfView);
+    CHECK(config->lights.size() == 1);
+}
+
+TEST_CASE("Invalid JSON configurations are rejected", "[config]")
+{
+    for (const char* json : { "", "[]", R"({"scene": "teapot")", R"({"scene": teapot})", R"({"scene": "teapot"} x)", R"({"scene": "\u12"})" }) {
+        std::string error;
+        CHECK(!readConfigJson(json, error));
+        CHECK(!error.empty());
+    }
+    std::string error;
+    CHECK(!readConfigJson(R"({"scene": "missing.obj"})", error));
+    CHECK(error.find("missing.obj") != std::string::npos);
+}
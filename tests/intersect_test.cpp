@@ -0,0 +1,252 @@
+#include "intersect.h"
+#include "interpolate.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <random>
+#include <vector>
+
+// The kernels are compared against the same computations in double precision, on rays and shapes drawn from a
+// fixed seed so that every run tests the same cases.
+
+using dvec3 = glm::dvec3;
+
+namespace {
+struct RandomGeometry {
+    std::mt19937 rng { 12345 };
+    std::uniform_real_distribution<float> uniform { -1.0f, 1.0f };
+
+    glm::vec3 point(float scale = 1.0f) { return glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * scale; }
+    glm::vec3 direction()
+    {
+        glm::vec3 direction;
+        do {
+            direction = point();
+        } while (glm::dot(direction, direction) < 1e-4f || glm::dot(direction, direction) > 1.0f);
+        return glm::normalize(direction);
+    }
+    Ray ray() { return Ray { point(3.0f), direction() }; }
+};
+}
+
+// Distance to the triangle along the ray and the barycentric coordinates of the hit, or nothing if the ray is parallel.
+static std::optional<std::pair<double, dvec3>> referenceTriangle(dvec3 v0, dvec3 v1, dvec3 v2, const Ray& ray)
+{
+    const dvec3 origin = ray.origin, direction = ray.direction;
+    const dvec3 e1 = v1 - v0, e2 = v2 - v0;
+    const dvec3 p = glm::cross(direction, e2);
+    const double determinant = glm::dot(e1, p);
+    if (std::abs(determinant) < 1e-12)
+        return {};
+    const dvec3 s = origin - v0;
+    const double u = glm::dot(s, p) / determinant;
+    const dvec3 q = glm::cross(s, e1);
+    const double v = glm::dot(direction, q) / determinant;
+    const double t = glm::dot(e2, q) / determinant;
+    return std::pair { t, dvec3(1.0 - u - v, u, v) };
+}
+
+TEST_CASE("intersectRayWithTriangle agrees with a double precision reference", "[intersect]")
+{
+    RandomGeometry random;
+    int numHits = 0;
+    for (int i = 0; i < 20000; i++) {
+        const glm::vec3 v0 = random.point(), v1 = random.point(), v2 = random.point();
+        Ray ray = random.ray();
+        const auto reference = referenceTriangle(v0, v1, v2, ray);
+        if (!reference || glm::length(glm::cross(v1 - v0, v2 - v0)) < 1e-3f)
+            continue;
+        const auto& [t, barycentric] = *reference;
+        const double minBarycentric = std::min({ barycentric.x, barycentric.y, barycentric.z });
+        // Rays through an edge or starting (nearly) on the plane may go either way.
+        if (std::abs(minBarycentric) < 1e-4 || std::abs(t) < 1e-4)
+            continue;
+        const bool expectedHit = t > 0.0 && minBarycentric > 0.0;
+        HitInfo hitInfo;
+        const bool hit = intersectRayWithTriangle(v0, v1, v2, ray, hitInfo);
+        REQUIRE(hit == expectedHit);
+        if (hit) {
+            numHits++;
+            REQUIRE(std::abs(double(ray.t) - t) <= 1e-4 * std::max(t, 1.0));
+        } else {
+            REQUIRE(ray.t == std::numeric_limits<float>::max());
+        }
+    }
+    REQUIRE(numHits > 100);
+}
+
+TEST_CASE("intersectRayWithTriangle only reports hits closer than ray.t", "[intersect]")
+{
+    const glm::vec3 v0 { -1.0f, -1.0f, 0.0f }, v1 { 1.0f, -1.0f, 0.0f }, v2 { 0.0f, 1.0f, 0.0f };
+    HitInfo hitInfo;
+    Ray ray { glm::vec3(0.0f, 0.0f, 2.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+    REQUIRE(intersectRayWithTriangle(v0, v1, v2, ray, hitInfo));
+    REQUIRE(ray.t == 2.0f);
+
+    Ray shortRay { glm::vec3(0.0f, 0.0f, 2.0f), glm::vec3(0.0f, 0.0f, -1.0f), 1.5f };
+    REQUIRE_FALSE(intersectRayWithTriangle(v0, v1, v2, shortRay, hitInfo));
+    REQUIRE(shortRay.t == 1.5f);
+
+    Ray awayRay { glm::vec3(0.0f, 0.0f, 2.0f), glm::vec3(0.0f, 0.0f, 1.0f) };
+    REQUIRE_FALSE(intersectRayWithTriangle(v0, v1, v2, awayRay, hitInfo));
+}
+
+TEST_CASE("intersectRayWithShape(Sphere) agrees with a double precision reference", "[intersect]")
+{
+    RandomGeometry random;
+    int numHits = 0;
+    for (int i = 0; i < 20000; i++) {
+        const Sphere sphere { random.point(), std::abs(random.uniform(random.rng)) + 0.01f };
+        Ray ray = random.ray();
+        // Nearest root of |o + t d - c|^2 = r^2 with t > 0.
+        const dvec3 f = dvec3(ray.origin) - dvec3(sphere.center), direction = ray.direction;
+        const double b = glm::dot(f, direction), c = glm::dot(f, f) - double(sphere.radius) * double(sphere.radius);
+        const double discriminant = b * b - c;
+        // Grazing rays may go either way.
+        if (std::abs(discriminant) < 1e-4)
+            continue;
+        std::optional<double> expected;
+        if (discriminant > 0.0) {
+            const double t0 = -b - std::sqrt(discriminant), t1 = -b + std::sqrt(discriminant);
+            if (t0 > 1e-4)
+                expected = t0;
+            else if (t1 > 1e-4 && t0 < -1e-4)
+                expected = t1;
+            else if (t1 > -1e-4)
+                continue; // The origin lies (nearly) on the sphere.
+        }
+        HitInfo hitInfo;
+        const bool hit = intersectRayWithShape(sphere, ray, hitInfo);
+        REQUIRE(hit == expected.has_value());
+        if (hit) {
+            numHits++;
+            REQUIRE(std::abs(double(ray.t) - *expected) <= 1e-5 * std::max(*expected, 1.0));
+        }
+    }
+    REQUIRE(numHits > 100);
+}
+
+TEST_CASE("intersectRayWithShape(AxisAlignedBox) and boxEntryDistance agree with a slab test", "[intersect]")
+{
+    RandomGeometry random;
+    int numHits = 0;
+    for (int i = 0; i < 20000; i++) {
+        const glm::vec3 a = random.point(), b = random.point();
+        const AxisAlignedBox box { glm::min(a, b), glm::max(a, b) };
+        Ray ray = random.ray();
+        double tIn = -std::numeric_limits<double>::infinity(), tOut = std::numeric_limits<double>::infinity();
+        for (int axis = 0; axis < 3; axis++) {
+            const double t0 = (double(box.lower[axis]) - double(ray.origin[axis])) / double(ray.direction[axis]);
+            const double t1 = (double(box.upper[axis]) - double(ray.origin[axis])) / double(ray.direction[axis]);
+            tIn = std::max(tIn, std::min(t0, t1));
+            tOut = std::min(tOut, std::max(t0, t1));
+        }
+        // Rays through an edge or starting on a face may go either way.
+        if (std::abs(tIn - tOut) < 1e-4 || std::abs(tIn) < 1e-4 || std::abs(tOut) < 1e-4)
+            continue;
+        const bool expectedHit = tIn < tOut && tOut > 0.0;
+
+        const float entryDistance = boxEntryDistance(box, ray);
+        const bool hit = intersectRayWithShape(box, ray);
+        REQUIRE(hit == expectedHit);
+        REQUIRE(std::isinf(entryDistance) == !expectedHit);
+        if (hit) {
+            numHits++;
+            const double expectedEntry = std::max(tIn, 0.0);
+            REQUIRE(std::abs(double(entryDistance) - expectedEntry) <= 1e-5 * std::max(expectedEntry, 1.0));
+            REQUIRE(std::abs(double(ray.t) - (tIn > 0.0 ? tIn : tOut)) <= 1e-5 * std::max(std::abs(tIn > 0.0 ? tIn : tOut), 1.0));
+        }
+    }
+    REQUIRE(numHits > 100);
+}
+
+TEST_CASE("computeBarycentricCoord reconstructs points inside the triangle", "[intersect]")
+{
+    RandomGeometry random;
+    std::uniform_real_distribution<float> unit { 0.0f, 1.0f };
+    for (int i = 0; i < 20000; i++) {
+        const glm::vec3 v0 = random.point(), v1 = random.point(), v2 = random.point();
+        if (glm::length(glm::cross(v1 - v0, v2 - v0)) < 1e-2f)
+            continue;
+        float u = unit(random.rng), v = unit(random.rng);
+        if (u + v > 1.0f) {
+            u = 1.0f - u;
+            v = 1.0f - v;
+        }
+        const glm::vec3 expected { 1.0f - u - v, u, v };
+        const glm::vec3 barycentric = computeBarycentricCoord(v0, v1, v2, expected.x * v0 + expected.y * v1 + expected.z * v2);
+        REQUIRE(std::abs(barycentric.x + barycentric.y + barycentric.z - 1.0f) < 1e-5f);
+        REQUIRE(glm::length(barycentric - expected) < 1e-3f);
+    }
+}
+
+TEST_CASE("Intersection kernel throughput", "[.][benchmark]")
+{
+    RandomGeometry random;
+    constexpr size_t count = 1024;
+    std::vector<Ray> rays;
+    std::vector<glm::vec3> vertices;
+    std::vector<Sphere> spheres;
+    std::vector<AxisAlignedBox> boxes;
+    for (size_t i = 0; i < count; i++) {
+        rays.push_back(random.ray());
+        for (int j = 0; j < 3; j++)
+            vertices.push_back(random.point());
+        spheres.push_back(Sphere { random.point(), 0.5f });
+        const glm::vec3 a = random.point(), b = random.point();
+        boxes.push_back(AxisAlignedBox { glm::min(a, b), glm::max(a, b) });
+    }
+
+    BENCHMARK("intersectRayWithTriangle x1024")
+    {
+        int numHits = 0;
+        HitInfo hitInfo;
+        for (size_t i = 0; i < count; i++) {
+            Ray ray = rays[i];
+            numHits += intersectRayWithTriangle(vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2], ray, hitInfo);
+        }
+        return numHits;
+    };
+    BENCHMARK("intersectRayWithShape(Sphere) x1024")
+    {
+        int numHits = 0;
+        HitInfo hitInfo;
+        for (size_t i = 0; i < count; i++) {
+            Ray ray = rays[i];
+            numHits += intersectRayWithShape(spheres[i], ray, hitInfo);
+        }
+        return numHits;
+    };
+    BENCHMARK("intersectRayWithShape(AxisAlignedBox) x1024")
+    {
+        int numHits = 0;
+        for (size_t i = 0; i < count; i++) {
+            Ray ray = rays[i];
+            numHits += intersectRayWithShape(boxes[i], ray);
+        }
+        return numHits;
+    };
+    BENCHMARK("boxEntryDistance x1024")
+    {
+        float sum = 0.0f;
+        for (size_t i = 0; i < count; i++)
+            sum += std::min(boxEntryDistance(boxes[i], rays[i]), 1.0f);
+        return sum;
+    };
+    BENCHMARK("computeBarycentricCoord x1024")
+    {
+        glm::vec3 sum { 0.0f };
+        for (size_t i = 0; i < count; i++)
+            sum += computeBarycentricCoord(vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2], rays[i].origin);
+        return sum;
+    };
+}
@@ -0,0 +1,164 @@
+#include "alias_table.h"
+#include "light.h"
+#include "light_set.h"
+#include "light_tree.h"
+#include "scene.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <catch2/catch_test_macros.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <variant>
+#include <vector>
+
+// Light sampling is only unbiased if every sampler reports exactly the probability with which it picks each light.
+
+TEST_CASE("Alias table samples indices proportionally to their weights", "[light]")
+{
+    const std::vector<float> weights { 1.0f, 0.0f, 3.0f, 4.0f, 0.5f };
+    const AliasTable table { weights };
+    REQUIRE(table.size() == weights.size());
+    CHECK(table.totalWeight() == 8.5f);
+
+    // Evenly spaced random numbers hit every index exactly in proportion to its probability (up to one step).
+    constexpr int numSamples = 100000;
+    std::vector<int> counts(weights.size(), 0);
+    for (int i = 0; i < numSamples; i++)
+        counts[table.sample((float(i) + 0.5f) / float(numSamples))]++;
+    for (uint32_t i = 0; i < weights.size(); i++) {
+        INFO("index " << i);
+        CHECK(std::abs(table.probability(i) - weights[i] / 8.5f) < 1e-6f);
+        CHECK(std::abs(float(counts[i]) / float(numSamples) - table.probability(i)) < 1e-3f);
+    }
+    CHECK(counts[1] == 0);
+
+    const std::vector<float> zeros(4, 0.0f);
+    const AliasTable uniformTable { zeros };
+    for (uint32_t i = 0; i < zeros.size(); i++)
+        CHECK(uniformTable.probability(i) == 0.25f);
+}
+
+TEST_CASE("Compiled lights keep the order and properties of the scene lights", "[light]")
+{
+    const std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>> lights {
+        PointLight { glm::vec3(1, 2, 3), glm::vec3(1, 0, 0) },
+        ParallelogramLight { glm::vec3(0), glm::vec3(2, 0, 0), glm::vec3(0, 0, 3), glm::vec3(1), glm::vec3(1), glm::vec3(0), glm::vec3(0) },
+        SegmentLight { glm::vec3(0), glm::vec3(0, 4, 0), glm::vec3(1), glm::vec3(0) },
+        PointLight { glm::vec3(-1), glm::vec3(0, 1, 0) },
+    };
+    const LightSet lightSet = compileLights(lights);
+    REQUIRE(lightSet.lights.size() == 4);
+    CHECK(lightSet.lights[0].type == LightSet::Type::Point);
+    CHECK(lightSet.lights[0].index == 0);
+    CHECK(lightSet.lights[1].type == LightSet::Type::Parallelogram);
+    CHECK(lightSet.lights[2].type == LightSet::Type::Segment);
+    CHECK(lightSet.lights[3].type == LightSet::Type::Point);
+    CHECK(lightSet.lights[3].index == 1);
+
+    const LightSet::PointLights& pointLights = lightSet.pointLights;
+    REQUIRE(pointLights.size() == 2);
+    CHECK(glm::vec3(pointLights.positionX[0], pointLights.positionY[0], pointLights.positionZ[0]) == glm::vec3(1, 2, 3));
+    CHECK(glm::vec3(pointLights.colorR[1], pointLights.colorG[1], pointLights.colorB[1]) == glm::vec3(0, 1, 0));
+    CHECK(pointLights.power[0] == lightPower(glm::vec3(1, 0, 0)));
+    CHECK(pointLights.shadowMaps.empty());
+    CHECK(lightSet.segmentLights.length[0] == 4.0f);
+    CHECK(lightSet.segmentLights.power[0] == lightPower(glm::vec3(0.5f)));
+    CHECK(lightSet.parallelogramLights.area[0] == 6.0f);
+    // Right-handed: edge01 x edge02.
+    CHECK(lightSet.parallelogramLights.normal[0] == glm::vec3(0, -1, 0));
+    CHECK(lightSet.parallelogramLights.power[0] == lightPower(glm::vec3(0.5f)));
+}
+
+TEST_CASE("Light tree reports the probability with which it samples each light", "[light]")
+{
+    std::mt19937 rng { 7 };
+    std::uniform_real_distribution<float> uniform { -5.0f, 5.0f };
+    std::vector<std::variant<PointLight, SegmentLight, ParallelogramLight>> lights;
+    for (int i = 0; i < 40; i++)
+        lights.push_back(PointLight { glm::vec3(uniform(rng), uniform(rng), uniform(rng)), glm::abs(glm::vec3(uniform(rng), uniform(rng), uniform(rng))) });
+    // Without soft shadows, area lights emit nothing and are never sampled.
+    lights.push_back(SegmentLight { glm::vec3(0), glm::vec3(1), glm::vec3(1), glm::vec3(1) });
+    const LightSet lightSet = compileLights(lights);
+    const LightTree tree { lightSet, Features {} };
+    CHECK(tree.numLights() == 40);
+
+    for (int point = 0; point < 10; point++) {
+        const glm::vec3 position { uniform(rng), uniform(rng), uniform(rng) };
+        float totalProbability = 0.0f;
+        for (uint32_t i = 0; i < lightSet.lights.size(); i++)
+            totalProbability += tree.probability(position, i);
+        CHECK(std::abs(totalProbability - 1.0f) < 1e-4f);
+        CHECK(tree.probability(position, 40) == 0.0f);
+
+        constexpr int numSamples = 20000;
+        std::vector<int> counts(lightSet.lights.size(), 0);
+        for (int i = 0; i < numSamples; i++) {
+            const LightTree::Sample sample = tree.sample(position, (float(i) + 0.5f) / float(numSamples));
+            REQUIRE(sample.lightIndex < 40);
+            REQUIRE(std::abs(sample.probability - tree.probability(position, sample.lightIndex)) <= 1e-5f * sample.probability);
+            counts[sample.lightIndex]++;
+        }
+        for (uint32_t i = 0; i < lightSet.lights.size(); i++)
+            CHECK(std::abs(float(counts[i]) / float(numSamples) - tree.probability(position, i)) < 2e-3f);
+    }
+}
+
+TEST_CASE("Recompiling lights keeps the shadow maps of lights that did not move", "[light]")
+{
+    Scene scene;
+    scene.lights = { PointLight { glm::vec3(0, 1, 0), glm::vec3(1) }, PointLight { glm::vec3(2, 1, 0), glm::vec3(1) } };
+    Features features {};
+    features.enableHardShadow = true;
+    features.extra.enableShadowMapCache = true;
+    compileSceneLights(scene, features);
+    REQUIRE(scene.lightSet);
+    const auto previousShadowMaps = scene.lightSet->pointLights.shadowMaps;
+    REQUIRE(previousShadowMaps.size() == 2);
+
+    std::get<PointLight>(scene.lights[0]).color = glm::vec3(0.5f);
+    std::get<PointLight>(scene.lights[1]).position = glm::vec3(3, 1, 0);
+    compileSceneLights(scene, features);
+    CHECK(scene.lightSet->pointLights.colorR[0] == 0.5f);
+    CHECK(scene.lightSet->pointLights.shadowMaps[0] == previousShadowMaps[0]);
+    CHECK(scene.lightSet->pointLights.shadowMaps[1] != previousShadowMaps[1]);
+
+    features.extra.shadowMapResolution *= 2;
+    compileSceneLights(scene, features);
+    CHECK(scene.lightSet->pointLights.shadowMaps[0] != previousShadowMaps[0]);
+
+    features.extra.enableShadowMapCache = false;
+    compileSceneLights(scene, features);
+    CHECK(scene.lightSet->pointLights.shadowMaps.empty());
+    CHECK(!scene.lightTree);
+}
+
+TEST_CASE("Lights that were not compiled shade like compiled lights", "[light]")
+{
+    enableDebugDraw = false;
+    Scene scene = loadScenePrebuilt(SceneType::SingleTriangle, DATA_DIR);
+    scene.lights = { PointLight { glm::vec3(0, 1, 2), glm::vec3(1) }, PointLight { glm::vec3(-2, 3, 1), glm::vec3(0.2f, 0.5f, 1.0f) } };
+    Features features {};
+    features.enableShading = true;
+    features.enableHardShadow = true;
+    const BvhInterface bvh { &scene, features };
+    const Ray ray { glm::vec3(0, 0, 3), glm::vec3(0, 0, -1), 3.0f };
+    HitInfo hitInfo {};
+    hitInfo.normal = glm::vec3(0, 0, 1);
+    hitInfo.material.kd = glm::vec3(0.8f);
+    hitInfo.material.ks = glm::vec3(0.5f);
+    hitInfo.material.shininess = 20.0f;
+
+    REQUIRE(!scene.lightSet);
+    const glm::vec3 uncompiled = computeLightContribution(scene, bvh, features, ray, hitInfo);
+    compileSceneLights(scene, features);
+    const glm::vec3 compiled = computeLightContribution(scene, bvh, features, ray, hitInfo);
+    CHECK(uncompiled != glm::vec3(0.0f));
+    for (int c = 0; c < 3; c++)
+        CHECK(std::abs(uncompiled[c] - compiled[c]) <= 1e-4f * std::max(1.0f, compiled[c]));
+}
@@ -0,0 +1,175 @@
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <catch2/catch_test_macros.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/mesh.h>
+#include <framework/mesh_cache.h>
+#include <framework/obj_loader.h>
+#include <framework/texture_cache.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <vector>
+
+// Meshes must read the same from OBJ files and from the binary mesh cache; corrupt input is rejected instead of
+// producing meshes with indices out of range.
+
+static std::filesystem::path testDirectory()
+{
+    const auto directory = std::filesystem::temp_directory_path() / "final_project_tests";
+    std::filesystem::create_directories(directory);
+    return directory;
+}
+
+static std::filesystem::path writeTestFile(std::string_view fileName, std::string_view contents)
+{
+    const auto filePath = testDirectory() / fileName;
+    std::ofstream { filePath, std::ios::binary } << contents;
+    return filePath;
+}
+
+static std::vector<glm::vec3> positions(const Mesh& mesh)
+{
+    std::vector<glm::vec3> result;
+    for (const Vertex& vertex : mesh.vertices)
+        result.push_back(vertex.position);
+    return result;
+}
+
+TEST_CASE("OBJ parser splits groups, triangulates polygons and resolves relative indices", "[obj]")
+{
+    const auto objFile = writeTestFile("groups.obj", R"(# Comment
+v 0 0 0
+v 1 0 0
+v 1 1 0
+v 0 1 0
+f 1 2 3 4
+g second
+f -4 -2 -1
+v 1 2 0
+f 1 3 5
+)");
+    const std::vector<Mesh> meshes = loadObj(objFile);
+    REQUIRE(meshes.size() == 2);
+    CHECK(meshes[0].triangles.size() == 2);
+    CHECK(meshes[0].vertices.size() == 4);
+    // Vertices are numbered in order of first use and shared between the triangles of a sub mesh.
+    REQUIRE(meshes[1].triangles.size() == 2);
+    CHECK(positions(meshes[1]) == std::vector { glm::vec3(0, 0, 0), glm::vec3(1, 1, 0), glm::vec3(0, 1, 0), glm::vec3(1, 2, 0) });
+    CHECK(meshes[1].triangles[0] == glm::uvec3(0, 1, 2));
+    CHECK(meshes[1].triangles[1] == glm::uvec3(0, 1, 3));
+}
+
+TEST_CASE("OBJ parser rejects indices of attributes that do not exist", "[obj]")
+{
+    const char* faces[] {
+        "f 1 2 4", // Past the last vertex.
+        "f 0 1 2", // Indices are one based.
+        "f -4 1 2", // Before the first vertex.
+        "f 1 2 4294967298", // Wraps around to 2 when narrowed to 32 bits.
+        "f 1 2 -4294967295",
+        "f 1/2 2/2 3/2", // No texture coordinate 2.
+    };
+    for (const char* face : faces) {
+        INFO(face);
+        const auto objFile = writeTestFile("invalid.obj", std::string("v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\n") + face + "\n");
+        CHECK_THROWS(loadObj(objFile));
+    }
+}
+
+TEST_CASE("Mesh cache returns the meshes it stored", "[mesh_cache]")
+{
+    const auto objFile = std::filesystem::path(DATA_DIR) / "cube-textured.obj";
+    const std::vector<Mesh> meshes = loadObj(objFile);
+    REQUIRE(!meshes.empty());
+    const auto cacheFile = testDirectory() / "cube-textured.mesh";
+    REQUIRE(writeMeshCache(cacheFile, objFile, false, meshes));
+
+    const auto cachedMeshes = readMeshCache(cacheFile, objFile, false);
+    REQUIRE(cachedMeshes);
+    REQUIRE(cachedMeshes->size() == meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const Mesh& mesh = meshes[i];
+        const Mesh& cachedMesh = (*cachedMeshes)[i];
+        CHECK(cachedMesh.vertices == mesh.vertices);
+        CHECK(cachedMesh.triangles == mesh.triangles);
+        CHECK(cachedMesh.material.kd == mesh.material.kd);
+        CHECK(cachedMesh.material.ks == mesh.material.ks);
+        CHECK(cachedMesh.material.shininess == mesh.material.shininess);
+        CHECK(cachedMesh.material.transparency == mesh.material.transparency);
+        REQUIRE(bool(cachedMesh.material.kdTexture) == bool(mesh.material.kdTexture));
+        if (mesh.material.kdTexture)
+            CHECK(cachedMesh.material.kdTexture == mesh.material.kdTexture);
+    }
+
+    // Normalized meshes are stored separately, and damaged files are rejected.
+    CHECK(!readMeshCache(cacheFile, objFile, true));
+    std::filesystem::resize_file(cacheFile, std::filesystem::file_size(cacheFile) / 2);
+    CHECK(!readMeshCache(cacheFile, objFile, false));
+    CHECK(!readMeshCache(testDirectory() / "missing.mesh", objFile, false));
+}
+
+TEST_CASE("Mesh cache records new modification times of unchanged files", "[mesh_cache]")
+{
+    const auto objFile = writeTestFile("touched.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n");
+    const auto cacheFile = testDirectory() / "touched.mesh";
+    REQUIRE(writeMeshCache(cacheFile, objFile, false, loadObj(objFile)));
+
+    // Touching the file does not invalidate the cache, since its contents hash the same.
+    const auto touchTime = std::filesystem::last_write_time(objFile) + std::chrono::hours(1);
+    std::filesystem::last_write_time(objFile, touchTime);
+    REQUIRE(readMeshCache(cacheFile, objFile, false));
+
+    // The new modification time was written to the cache file, so the contents are no longer hashed while it stays
+    // the same: a change of the same size that keeps the modification time goes unnoticed.
+    writeTestFile("touched.obj", "v 0 0 1\nv 1 0 0\nv 0 1 0\nf 1 2 3\n");
+    std::filesystem::last_write_time(objFile, touchTime);
+    const auto cachedMeshes = readMeshCache(cacheFile, objFile, false);
+    REQUIRE(cachedMeshes);
+    CHECK(positions((*cachedMeshes)[0])[0] == glm::vec3(0, 0, 0));
+}
+
+TEST_CASE("Texture cache evicts the least recently used textures", "[texture_cache]")
+{
+    // Start from an empty cache.
+    setTextureCacheBudget(0);
+    setTextureCacheBudget(size_t(1) << 30);
+    const std::filesystem::path dataDirectory { DATA_DIR };
+    auto pFirst = loadTexture(dataDirectory / "default.png");
+    auto pSecond = loadTexture(dataDirectory / "texture.png");
+    const size_t firstSize = pFirst->image().sizeInBytes();
+    const size_t secondSize = pSecond->image().sizeInBytes();
+    CHECK(pFirst->isLoaded());
+    // Looking up a texel counts as a use, so the second texture is now the least recently used one.
+    (void)loadTexture(dataDirectory / "cube_map.jpg");
+    (void)pFirst->image();
+    CHECK(pSecond->lastUse() < pFirst->lastUse());
+
+    // Textures that are still referenced stay in the cache, but their images are unloaded to fit in the budget and
+    // decoded again on their next access.
+    const size_t evictions = textureCacheStatistics().evictions;
+    setTextureCacheBudget(firstSize);
+    const TextureCacheStatistics trimmed = textureCacheStatistics();
+    CHECK(trimmed.evictions == evictions + 1);
+    CHECK(trimmed.numLoaded == 1);
+    CHECK(trimmed.memoryUsage == firstSize);
+    CHECK(pFirst->isLoaded());
+    CHECK(!pSecond->isLoaded());
+    CHECK(pSecond->image().sizeInBytes() == secondSize);
+    CHECK(pSecond->isLoaded());
+
+    // Textures that are no longer referenced are dropped.
+    pFirst.reset();
+    pSecond.reset();
+    setTextureCacheBudget(0);
+    const TextureCacheStatistics emptied = textureCacheStatistics();
+    CHECK(emptied.numLoaded == 0);
+    CHECK(emptied.memoryUsage == 0);
+    (void)loadTexture(dataDirectory / "default.png");
+    CHECK(textureCacheStatistics().misses == emptied.misses + 1);
+
+    setTextureCacheBudget(size_t(512) << 20);
+}
@@ -0,0 +1,90 @@
+#include "render_server.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <catch2/catch_test_macros.hpp>
+DISABLE_WARNINGS_POP()
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+// The render server keeps few scenes loaded; evicted scenes (and their BVHs) must be freed. A request that fails must
+// not keep the server from answering the next ones.
+
+static Config sceneConfig(SceneType sceneType)
+{
+    Config config {};
+    config.scene = sceneType;
+    return config;
+}
+
+TEST_CASE("Scene cache evicts the least recently used scene", "[render_server]")
+{
+    SceneCache cache { 2 };
+    bool cached;
+    const std::weak_ptr<const LightSet> pTriangleLights = cache.get(sceneConfig(SceneType::SingleTriangle), cached).scene.lightSet;
+    CHECK(!cached);
+    cache.get(sceneConfig(SceneType::Cube), cached);
+    CHECK(!cached);
+    cache.get(sceneConfig(SceneType::SingleTriangle), cached);
+    CHECK(cached);
+
+    // The cube was used least recently.
+    cache.get(sceneConfig(SceneType::CornellBox), cached);
+    CHECK(!cached);
+    CHECK(cache.size() == 2);
+    cache.get(sceneConfig(SceneType::SingleTriangle), cached);
+    CHECK(cached);
+    cache.get(sceneConfig(SceneType::Cube), cached);
+    CHECK(!cached);
+    CHECK(!pTriangleLights.expired());
+
+    cache.get(sceneConfig(SceneType::CornellBox), cached);
+    CHECK(!cached);
+    CHECK(cache.size() == 2);
+    CHECK(pTriangleLights.expired());
+}
+
+TEST_CASE("Scene cache tells apart settings that change the BVH", "[render_server]")
+{
+    SceneCache cache { 2 };
+    Config config = sceneConfig(SceneType::Cube);
+    bool cached;
+    cache.get(config, cached);
+    config.features.bvh.buildQuality = BvhBuildQuality::High;
+    cache.get(config, cached);
+    CHECK(!cached);
+    // Neither cameras nor output files are part of the scene.
+    config.cameras.emplace_back(CameraConfig {});
+    config.outputFile = "image.bmp";
+    cache.get(config, cached);
+    CHECK(cached);
+}
+
+TEST_CASE("Render server keeps serving after a request with a malformed scene", "[render_server]")
+{
+    const auto directory = std::filesystem::temp_directory_path() / "final_project_tests" / "render_server";
+    std::filesystem::create_directories(directory);
+    // The face refers to a vertex that does not exist, so loading the scene throws.
+    const auto objFile = directory / "malformed.obj";
+    std::ofstream { objFile } << "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 99999999999\n";
+    const auto imageFile = directory / "image.bmp";
+    std::filesystem::remove(imageFile);
+
+    const std::string common = R"("window_size": [16, 8], "output_file": ")" + imageFile.generic_string() + R"("})";
+    std::istringstream requests { R"({"scene": ")" + objFile.generic_string() + R"(", )" + common + "\n" + R"({"scene": "single_triangle", )" + common + "\n" };
+    std::ostringstream responses;
+    RenderServer server { directory };
+    server.serve(requests, responses);
+
+    std::istringstream lines { responses.str() };
+    std::string response;
+    REQUIRE(std::getline(lines, response));
+    CHECK(response.starts_with(R"({"status":"error")"));
+    REQUIRE(std::getline(lines, response));
+    CHECK(response.starts_with(R"({"status":"ok")"));
+    CHECK(!std::getline(lines, response));
+    CHECK(std::filesystem::exists(imageFile));
+}
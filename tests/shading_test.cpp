@@ -0,0 +1,64 @@
+#include "shading.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <catch2/catch_test_macros.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// The batched shading (vectorized when built with ENABLE_AVX2) must match computeShading() up to the error of
+// fastPow(), for any number of samples, including those that do not fill a whole vector.
+
+TEST_CASE("fastPow approximates pow", "[shading]")
+{
+    for (const float exponent : { 0.0f, 0.5f, 1.0f, 2.0f, 7.5f, 32.0f, 100.0f, 1000.0f }) {
+        for (int i = 0; i <= 1000; i++) {
+            const float x = float(i) / 1000.0f;
+            const double exact = std::pow(double(x), double(exponent));
+            INFO("x = " << x << ", exponent = " << exponent);
+            // pow(0, exponent) comes out as a tiny positive number instead of 0.
+            REQUIRE(std::abs(double(fastPow(x, exponent)) - exact) <= 2e-5 * exact + 1e-15);
+        }
+    }
+}
+
+TEST_CASE("Batched shading matches computeShading()", "[shading]")
+{
+    std::mt19937 rng { 4321 };
+    std::uniform_real_distribution<float> uniform { -1.0f, 1.0f };
+    const auto randomVector = [&](float scale) { return glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * scale; };
+    const auto randomColor = [&]() { return glm::abs(randomVector(1.0f)); };
+    const Features features {};
+
+    for (const size_t numSamples : { size_t(1), size_t(7), size_t(8), size_t(37) }) {
+        for (int intersection = 0; intersection < 50; intersection++) {
+            const Ray ray { randomVector(3.0f), glm::normalize(randomVector(1.0f) + glm::vec3(0.0f, 0.0f, 0.01f)), 1.0f + std::abs(uniform(rng)) * 4.0f };
+            HitInfo hitInfo {};
+            hitInfo.normal = glm::normalize(randomVector(1.0f) + glm::vec3(0.01f, 0.0f, 0.0f)) * 2.0f; // Not normalized by the caller.
+            hitInfo.material.kd = randomColor();
+            hitInfo.material.ks = randomColor();
+            hitInfo.material.shininess = std::array { 1.0f, 8.0f, 32.0f, 100.5f }[size_t(intersection) % 4];
+
+            LightSampleBatch samples;
+            for (size_t i = 0; i < numSamples; i++)
+                samples.push_back(randomVector(5.0f), randomColor());
+            std::vector<float> red(numSamples), green(numSamples), blue(numSamples);
+            computeShadingBatch(computeShadingFrame(ray, hitInfo), samples, red, green, blue);
+
+            for (size_t i = 0; i < numSamples; i++) {
+                const glm::vec3 position { samples.positionX[i], samples.positionY[i], samples.positionZ[i] };
+                const glm::vec3 color { samples.colorR[i], samples.colorG[i], samples.colorB[i] };
+                const glm::vec3 expected = computeShading(position, color, features, ray, hitInfo);
+                const glm::vec3 batched { red[i], green[i], blue[i] };
+                for (int c = 0; c < 3; c++)
+                    REQUIRE(std::abs(batched[c] - expected[c]) <= 1e-4f * std::max(1.0f, expected[c]));
+            }
+        }
+    }
+}